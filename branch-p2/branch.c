@@ -173,6 +173,11 @@ uint64_t branchRequest(trace_op *op, int processorNum) {
 
 int tick() { return 1; }
 
+// The predictor only changes state on branchRequest.
+int64_t nextTick(void) { return INT64_MAX; }
+
+void skipTicks(int64_t ticks) {}
+
 int finish(int outFd) { return 0; }
 
 int destroy(void) {
@@ -1,11 +1,21 @@
 #include "../common/cache.h"
 #include "../common/trace.h"
+#include "cache_line.h"
+#include "deadblock.h"
+#include "future.h"
+#include "missstream.h"
+#include "mrc.h"
+#include "pool.h"
+#include "prefetch.h"
+#include "replacement.h"
+#include "sets.h"
 
 #include <assert.h>
 #include <getopt.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #define DPRINTF(args...)                                                       \
     if (CADSS_VERBOSE) {                                                       \
@@ -13,7 +23,7 @@
     }
 
 typedef enum cacheResult_ { HIT , MISS , MISS_EVICT , NA } cacheResult;
-typedef enum reqType_ { PERM , INV } reqType;
+typedef enum reqType_ { PERM , INV , WRITE } reqType;
 
 typedef struct _pendingRequest {
     int64_t addr;
@@ -21,6 +31,9 @@ typedef struct _pendingRequest {
     bool isLoad;
     reqType requestType;
     cacheResult cacheResult;
+    int mshr; // MSHR it waits on in non-blocking mode, -1 if none
+    unsigned long readyAt; // first tick it can start, after outer lookups
+    unsigned long startedAt; // INV - tick its flush started
     struct _pendingRequest *next;
 } pendingRequest;
 
@@ -30,6 +43,8 @@ typedef struct _memRequest {
     pendingRequest* tail;
     void (*memCallback)(int, int64_t);
     int64_t requestTag;
+    bool reserved; // holds back an MSHR for a miss it has yet to start
+    bool prefetch; // issued by the core's prefetcher, so nothing waits on it
     struct _memRequest *next;
 } memRequest;
 
@@ -38,8 +53,12 @@ typedef struct _requestQueue {
     memRequest* tail;
 } requestQueue;
 
+// memRequests and pendingRequests for every core come from these, sized
+// for the most a run keeps in flight
+pool memRequestPool;
+pool pendingRequestPool;
+
 // int64_t globalTag = 0;
-int8_t procNum = 0;
 
 // void (*memCallback)(int, int64_t);
 
@@ -50,7 +69,159 @@ int processorCount = 1;
 int CADSS_VERBOSE = 0;
 // memRequest q = {0};
 
-requestQueue memReqQueue = {0};
+// Non-blocking mode (-M) tracks each outstanding coherence request in an
+// MSHR, and starts later requests under it.  A request to a block that
+// already has one merges into it, and requests that find every MSHR in use
+// wait.  With no MSHRs, only the head of memReqQueue is worked on.
+typedef struct _mshr {
+    bool valid;
+    int64_t addr;
+    reqType requestType;
+    bool isLoad;
+} mshr;
+
+unsigned long mshrCount = 0;
+
+// Write policy (-W).  Each core's requests give lines up to coherence
+// (INV), which flushes them if they were modified, and by default the
+// request waits for that writeback like any other access.
+//
+//   With a write buffer, a release instead moves into a free entry and the
+// request goes on.  The buffer drains in the background, giving one
+// release a tick to coherence, oldest first, so the request's own miss
+// gets to the bus ahead of it; an entry is free again once its flush
+// completes, or right away for a line that needed none.  A request whose
+// release finds every entry in use stalls until one frees, and an access
+// to a block whose release is still in the buffer waits for it.
+//
+//   Write-through (hit=through) keeps L1's lines clean, sending every
+// store's block out through the buffer (WRITE), where it holds an entry
+// for lat ticks; stores to a block already waiting there coalesce with it.
+// Coherence still sees stored lines as modified, so their release still
+// flushes.  No-write-allocate (miss=around) leaves L1 as it was on a store
+// miss; the store still gets write permission and fills the levels past
+// L1, and the line is given up again if none of them kept it.
+typedef struct _wbuf_entry {
+    bool valid;
+    bool flush; // a release, or else a write-through
+    bool issued; // release - given to coherence, and waiting on its flush
+    int64_t addr;
+    unsigned long startedAt;
+    unsigned long doneAt; // write-through - tick it reaches the next level
+} wbuf_entry;
+
+bool writePolicySet = false; // whether to print the Write Summary
+bool writeThrough = false;
+bool writeAround = false;
+unsigned long wbufCount = 0; // entries per core, 0 for no buffer
+unsigned long wbufLatency = 0;
+
+// Levels past L1 (-2, -3).  Each core has a private L2 and all cores share
+// the LLC, both using L1's block size.  Like L1, a level is filled when it
+// is looked up, and an access that has to look in a level waits its latency
+// before going on to coherence.
+//
+//   Coherence sees each core's levels as one cache: a core only gives up a
+// line (invlReq) once none of its levels hold the line anymore.  So an L1
+// miss that hits further out still has permission, and costs only the
+// lookup latencies.  Since the LLC is shared, it remembers which cores each
+// line is held for.
+//
+//   Inclusion (-I) applies between every pair of levels:
+//     nine      - lines are filled into every level they missed in, and each
+//                 level evicts on its own (the default)
+//     inclusive - as nine, but a line evicted from a level is also
+//                 invalidated in the levels inside it (back-invalidation)
+//     exclusive - a line is in one level at a time.  Fills only go to L1,
+//                 a hit further out moves the line to L1, and a level's
+//                 victims move out to the next level.
+typedef enum inclusion_ { NINE , INCLUSIVE , EXCLUSIVE } inclusion;
+
+typedef struct _cache_level {
+    const char *name;
+    unsigned long s, S, E;
+    unsigned long latency;
+    // S sets of E lines each, like main_cache.  In the LLC, each set's lines
+    // are followed by a bit mask per line of the cores it is held for.
+    set_store *lines;
+    bool shared;
+    replacement *policy;
+
+    // statistics
+    uint64_t hits;
+    uint64_t misses;
+} cache_level;
+
+inclusion inclusionPolicy = NINE;
+// shared by every core, NULL without -3
+cache_level *llc = NULL;
+uint64_t backInvalidations = 0;
+// every core's demand accesses are written here, NULL without -A
+FILE *recordFile = NULL;
+// every L1 miss, dirty eviction and invalidation is written here, NULL
+// without -m
+FILE *missFile = NULL;
+
+// Each core has a private cache, sharing only the configuration below.
+// Coherence keeps them consistent, and its callbacks name the core.
+typedef struct _core_cache {
+    int procNum;
+    // S sets of E lines each
+    set_store *main_cache;
+    // 1d array of cache_lines
+    cache_line *victim_cache;
+    // replacement policy of the main cache (-P); the victim cache is always LRU
+    replacement *policy;
+    // private L2, NULL without -2
+    cache_level *l2;
+    // NULL without -f
+    prefetcher *prefetcher;
+    // sampled miss ratio curve of the core's demand accesses, NULL without -S
+    mrc *mrc;
+    // recorded demand accesses OPT looks ahead in, NULL without -O
+    future *future;
+    // predicts which of L1's demand fills will never be hit, NULL without -D
+    deadblock *deadblock;
+    requestQueue memReqQueue;
+
+    mshr *mshrs;
+    // can briefly exceed mshrCount, see startAccess
+    unsigned long mshrCapacity;
+    unsigned long mshrsInUse;
+    // requests with a miss that have not yet taken an MSHR
+    unsigned long mshrsReserved;
+
+    // wbufCount entries, NULL without a buffer
+    wbuf_entry *wbuf;
+    unsigned long wbufInUse;
+    // whether a request waited on the buffer this tick
+    bool wbufWaiting;
+
+    // statistics
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    uint64_t mshrAllocs;
+    uint64_t mshrMerges;
+    uint64_t mshrFullTicks;
+    uint64_t prefetches;
+    // demand hits on lines a prefetch brought in, and those of them that
+    // came while the prefetch was still waiting on coherence
+    uint64_t prefetchHits;
+    uint64_t latePrefetches;
+    // lines given up to coherence, those of them it flushed, and the ticks
+    // the flushes took
+    uint64_t releases;
+    uint64_t flushes;
+    uint64_t flushTicks;
+    uint64_t writesThrough;
+    uint64_t writesCoalesced;
+    uint64_t wbufPeak;
+    uint64_t wbufStallTicks;
+} core_cache;
+
+// processorCount caches
+core_cache *caches = NULL;
 
 // pushes a new pending request (PERM/INV) to the end of a single memory request's queue
 void enqueueNode(memRequest* req, pendingRequest* node) {
@@ -76,55 +247,62 @@ void dequeuePendingRequest(memRequest* req) {
     }
     req->head = req->head->next;
     DPRINTF("address of head: %p\n", req->head);
-    free(temp);
+    pool_free(&pendingRequestPool, temp);
 }
 
 // given pending request (PERM/INV) fields, create the pending request and enqueue it to the
 // given memory request's queue
-void enqueuePendingRequest(memRequest* req, int64_t addr, bool isLoad,
+pendingRequest *enqueuePendingRequest(memRequest* req, int64_t addr, bool isLoad,
                     reqType requestType, cacheResult cacheResult) {
-    struct _pendingRequest *newReq = malloc(sizeof(struct _pendingRequest));
+    pendingRequest *newReq = pool_alloc(&pendingRequestPool);
     // initialize newReq
     newReq->addr = addr;
     newReq->isStarted = false;
     newReq->isLoad = isLoad;
     newReq->requestType = requestType;
     newReq->cacheResult = cacheResult;
+    newReq->mshr = -1;
+    newReq->readyAt = 0;
+    newReq->startedAt = 0;
     newReq->next = NULL;
     enqueueNode(req, newReq);
+    return newReq;
 }
 
-memRequest *enqueueMemRequest(void (*memCallback)(int, int64_t), int64_t requestTag) {
-    memRequest *memReq = malloc(sizeof(struct _memRequest));
+memRequest *enqueueMemRequest(core_cache *cc, void (*memCallback)(int, int64_t),
+                              int64_t requestTag) {
+    memRequest *memReq = pool_alloc(&memRequestPool);
     memReq->head = NULL;
     memReq->tail = NULL;
     memReq->memCallback = memCallback;
     memReq->requestTag = requestTag;
+    memReq->reserved = false;
+    memReq->prefetch = false;
     memReq->next = NULL;
 
-    if (memReqQueue.head == NULL) {
-        memReqQueue.head = memReq;
-       memReqQueue.tail = memReq;
+    if (cc->memReqQueue.head == NULL) {
+        cc->memReqQueue.head = memReq;
+       cc->memReqQueue.tail = memReq;
     } else {
-        assert(memReqQueue.tail != NULL);
-       memReqQueue.tail->next = memReq;
-       memReqQueue.tail = memReq;
+        assert(cc->memReqQueue.tail != NULL);
+       cc->memReqQueue.tail->next = memReq;
+       cc->memReqQueue.tail = memReq;
     }
 
-    assert(memReqQueue.head != NULL && memReqQueue.tail != NULL);
+    assert(cc->memReqQueue.head != NULL && cc->memReqQueue.tail != NULL);
     return memReq;
 }
 
-void dequeueMemRequest(memRequest* memReq) {
-    assert(memReqQueue.head != NULL && memReqQueue.tail != NULL);
+void dequeueMemRequest(core_cache *cc) {
+    assert(cc->memReqQueue.head != NULL && cc->memReqQueue.tail != NULL);
     DPRINTF("popping from queue\n");
-    memRequest* temp = memReqQueue.head;
-    if (memReqQueue.head == memReqQueue.tail) {
-        memReqQueue.tail = NULL;
+    memRequest* temp = cc->memReqQueue.head;
+    if (cc->memReqQueue.head == cc->memReqQueue.tail) {
+        cc->memReqQueue.tail = NULL;
     }
-    memReqQueue.head = memReqQueue.head->next;
-    DPRINTF("address of head: %p\n", memReqQueue.head);
-    free(temp);
+    cc->memReqQueue.head = cc->memReqQueue.head->next;
+    DPRINTF("address of head: %p\n", cc->memReqQueue.head);
+    pool_free(&memRequestPool, temp);
 }
 
 void memoryRequest(trace_op *op, int processorNum, int64_t tag,
@@ -134,102 +312,125 @@ void coherCallback(int type, int procNum, int64_t addr);
 unsigned long E, s, b, victim_i, k = 0;
 unsigned long S, B, R = 0;
 unsigned long iteration = 0; // timestamp used for LRU
-bool is_rrip = false;
-
-typedef struct {
-    bool valid_bit;
-    bool dirty_bit;
-    unsigned long tag;
-    size_t LRU_counter;
-    size_t RRPV;
-} cache_line;
 
-cache_line **main_cache = NULL;
-// 1d array of cache_lines
-cache_line *victim_cache = NULL;
+// set searches, scalar or vectorized depending on the host (-L)
+const lookup_impl *lookup = NULL;
 
 void assert_set_all_valid(cache_line* set, size_t E) {
-    for (unsigned long line_index = 0; line_index < E; line_index++) {
-        assert(set[line_index].valid_bit);
+    assert(lookup->find_invalid(set, E) == E);
+}
+
+// records an L1 miss or writeback, or an invalidation, of addr for -m
+void recordStream(core_cache *cc, unsigned long addr, int type) {
+    if (missFile != NULL) {
+        miss_entry e = {addr >> b, iteration, cc->procNum, type};
+        missstream_write(missFile, &e);
     }
 }
 
-size_t find_evict(cache_line* set, size_t E, bool evict_rrip) {
-    // need to evict from MAIN
-    unsigned long evict_index = 0;
-    if (evict_rrip) {
-        assert_set_all_valid(set, E);
-        // find first index predicted to be accessed in distant future
-        bool found_evict = false;
-        while (!found_evict) {
-            for (size_t line_index = 0; line_index < E; line_index++) {
-                assert(set[line_index].RRPV <= R);
-                if (set[line_index].RRPV == R) {
-                    found_evict = true;
-                    evict_index = line_index;
-                    break;
-                }
-            }
-            if (!found_evict) {
-                for (size_t line_index = 0; line_index < E; line_index++) {
-                    set[line_index].RRPV++;
-                }
-            }
-        }
-    } else {
-        unsigned long smallest_LRU = set[0].LRU_counter;
-        for (unsigned long line_index = 1; line_index < E; line_index++) {
-            if (set[line_index].LRU_counter < smallest_LRU) {
-                smallest_LRU = set[line_index].LRU_counter;
-                evict_index = line_index;
-            }
-        }
+// How an address picks its MAIN set (-H).  bits takes the s bits above the
+// block offset, xor folds every s bits of the tag into them, and prime
+// takes the block number modulo the largest prime up to S, leaving the sets
+// past it unused.  skew gives each way its own hash of the block number,
+// so a block's candidate lines lie in a different set per way, and tags
+// hold the whole block number.  Whatever the function, an evicted line's
+// address comes back from its tag and set.
+enum INDEX_FN { INDEX_BITS , INDEX_XOR , INDEX_PRIME , INDEX_SKEW };
+enum INDEX_FN indexFn = INDEX_BITS;
+unsigned long P = 0; // prime - sets in use
+
+// every s bits of tag, XORed together
+static inline unsigned long xorFold(unsigned long tag) {
+    unsigned long folded = 0;
+    for (; tag != 0; tag >>= s) folded ^= tag;
+    return folded;
+}
+
+// MAIN set of addr, setting its tag there (not skewed)
+static inline unsigned long setIndex(unsigned long addr, unsigned long *tag) {
+    switch (indexFn) {
+    case INDEX_XOR:
+        *tag = addr >> (s + b);
+        if (s == 0) return 0;
+        return ((addr >> b) ^ xorFold(*tag)) & (S - 1);
+    case INDEX_PRIME:
+        *tag = (addr >> b) / P;
+        return (addr >> b) % P;
+    default:
+        *tag = addr >> (s + b);
+        return (addr << (64UL - (s + b))) >> (64UL - s);
+    }
+}
+
+// block number of the MAIN line holding tag in set_index (not skewed)
+static inline unsigned long lineBlock(unsigned long tag,
+                                      unsigned long set_index) {
+    switch (indexFn) {
+    case INDEX_XOR:
+        if (s == 0) return tag;
+        return (tag << s) | ((set_index ^ xorFold(tag)) & (S - 1));
+    case INDEX_PRIME:
+        return tag * P + set_index;
+    default:
+        return (tag << s) + set_index;
     }
-    return evict_index;
 }
 
-int cache_access(unsigned long addr, unsigned long *evict_addr, bool is_store) {
+// skew - MAIN set holding way of block's line
+static inline unsigned long skewIndex(unsigned long block, unsigned long way) {
+    if (s == 0) return 0;
+    return ((block ^ (way * 0xD6E8FEB86659FD93UL)) * 0x9E3779B97F4A7C15UL) >>
+           (64 - s);
+}
+
+// picks the line to evict from a full MAIN set
+unsigned long find_evict(core_cache *cc, cache_line *set, unsigned long set_index) {
+    assert_set_all_valid(set, E);
+    return cc->policy->ops->victim(cc->policy, set, set_index);
+}
+
+int cache_access(core_cache *cc, unsigned long addr, unsigned long pc,
+                 unsigned long *evict_addr, bool is_store) {
     unsigned long addr_set_index, addr_tag;
-    addr_tag = addr >> (s + b);
-    addr_set_index = (addr << (64UL - (s + b))) >> (64UL - s);
+    addr_set_index = setIndex(addr, &addr_tag);
+
+    cache_line *curr_set = set_store_get(cc->main_cache, addr_set_index);
 
-    cache_line *curr_set = main_cache[addr_set_index];
-    
 
     // Look for MAIN hit
-    for (unsigned long line_index = 0; line_index < E; line_index++) {
-        if ((curr_set[line_index].tag == addr_tag) &&
-            curr_set[line_index].valid_bit) {
-            // Found tag + valid bit YAY, hit!!
-            // update LRU_counter
-            curr_set[line_index].LRU_counter = iteration;
-            // update dirty bit
-            if (is_store) curr_set[line_index].dirty_bit = true;
-            // update RRPV
-            curr_set[line_index].RRPV = 0;
-            return 0; // MAIN HIT
-        }
+    unsigned long line_index = lookup->find_tag(curr_set, E, addr_tag);
+    if (line_index < E) {
+        // Found tag + valid bit YAY, hit!!
+        // update LRU_counter
+        curr_set[line_index].LRU_counter = iteration;
+        // update dirty bit
+        if (is_store) curr_set[line_index].dirty_bit = true;
+        cc->policy->ops->hit(cc->policy, curr_set, addr_set_index, line_index, pc);
+        return 0; // MAIN HIT
     }
+    recordStream(cc, addr, is_store ? MISS_STORE : MISS_LOAD);
 
     // can freely bring into MAIN
-    for (unsigned long line_index = 0; line_index < E; line_index++) {
-        if (!curr_set[line_index].valid_bit) {
-            // Found invalid bit? - YAY miss
-            // update curr_set[line_index] with values....
-            curr_set[line_index].valid_bit = true;
-            curr_set[line_index].dirty_bit = is_store;
-            curr_set[line_index].tag = addr_tag;
-            curr_set[line_index].LRU_counter = iteration;
-            curr_set[line_index].RRPV = R - 1;
-            return 1; // MAIN MISS, VICTIM MISS, no overall evict
-        }
+    line_index = lookup->find_invalid(curr_set, E);
+    if (line_index < E) {
+        // Found invalid bit? - YAY miss
+        // update curr_set[line_index] with values....
+        curr_set[line_index].valid_bit = true;
+        curr_set[line_index].dirty_bit = is_store;
+        curr_set[line_index].tag = addr_tag;
+        curr_set[line_index].LRU_counter = iteration;
+        cc->policy->ops->fill(cc->policy, curr_set, addr_set_index, line_index, pc);
+        return 1; // MAIN MISS, VICTIM MISS, no overall evict
     }
 
     // need to evict from MAIN
-    unsigned long evict_index = find_evict(curr_set, E, is_rrip);
+    unsigned long evict_index = find_evict(cc, curr_set, addr_set_index);
 
     DPRINTF("set index: %lX\n", addr_set_index);
-    *evict_addr = (curr_set[evict_index].tag << (s + b)) + (addr_set_index << b);
+    *evict_addr = lineBlock(curr_set[evict_index].tag, addr_set_index) << b;
+    if (curr_set[evict_index].dirty_bit) {
+        recordStream(cc, *evict_addr, MISS_WRITEBACK);
+    }
 
     DPRINTF("calculated evict address: 0x%lX\n", *evict_addr);
 
@@ -242,85 +443,97 @@ int cache_access(unsigned long addr, unsigned long *evict_addr, bool is_store) {
     // update tag and evict_counter
     curr_set[evict_index].tag = addr_tag;
     curr_set[evict_index].LRU_counter = iteration;
-    curr_set[evict_index].RRPV = R - 1;
+    cc->policy->ops->fill(cc->policy, curr_set, addr_set_index, evict_index, pc);
 
     return 2; // MISS and EVICT
 }
 
-int cache_access_victim(unsigned long addr, unsigned long *evict_addr, bool is_store) {
+int cache_access_victim(core_cache *cc, unsigned long addr, unsigned long pc,
+                        unsigned long *evict_addr, bool is_store) {
     unsigned long addr_set_index, addr_tag, victim_addr_tag;
-    addr_tag = addr >> (s + b);
     victim_addr_tag = addr >> b;
-    addr_set_index = (addr << (64UL - (s + b))) >> (64UL - s);
+    addr_set_index = setIndex(addr, &addr_tag);
 
-    cache_line *curr_set = main_cache[addr_set_index];
+    cache_line *curr_set = set_store_get(cc->main_cache, addr_set_index);
 
     // Look for MAIN hit
-    for (unsigned long line_index = 0; line_index < E; line_index++) {
-        if ((curr_set[line_index].tag == addr_tag) &&
-            curr_set[line_index].valid_bit) {
-            // Found tag + valid bit YAY, hit!!
-            // update LRU_counter
-            curr_set[line_index].LRU_counter = iteration;
-            // update dirty bit
-            if (is_store) curr_set[line_index].dirty_bit = true;
-            // update RRPV
-            curr_set[line_index].RRPV = 0;
-            return 0; // MAIN HIT
-        }
+    unsigned long line_index = lookup->find_tag(curr_set, E, addr_tag);
+    if (line_index < E) {
+        // Found tag + valid bit YAY, hit!!
+        // update LRU_counter
+        curr_set[line_index].LRU_counter = iteration;
+        // update dirty bit
+        if (is_store) curr_set[line_index].dirty_bit = true;
+        cc->policy->ops->hit(cc->policy, curr_set, addr_set_index, line_index, pc);
+        return 0; // MAIN HIT
     }
 
     // MAIN miss, Look for VICTIM HIT
-    for (unsigned long vic_line_index = 0; vic_line_index < victim_i; vic_line_index++) {
-        if ((victim_cache[vic_line_index].tag == victim_addr_tag) &&
-            victim_cache[vic_line_index].valid_bit) {
-            // Found tag + valid bit YAY, victim hit!!
-            // update LRU_counter
-            victim_cache[vic_line_index].LRU_counter = iteration;
-            // update dirty bit
-            if (is_store) victim_cache[vic_line_index].dirty_bit = true;
-            // update RRPV
-            victim_cache[vic_line_index].RRPV = 0;
-
-            // swap into main cache (guaranteed corresponding main cache set is full)
-            assert_set_all_valid(curr_set, E);
-
-            // Find evict index in main cache set
-            unsigned long evict_index = find_evict(curr_set, E, is_rrip); 
-
-            // make new tags as we are switching cache configurations
-            unsigned long lru_to_victim_tag = (curr_set[evict_index].tag << s) + addr_set_index;
-            unsigned long victim_to_lru_tag = addr_tag;
-
-            // swap
-            cache_line temp = {0};
-
-            memcpy(&temp, &victim_cache[vic_line_index], sizeof(cache_line));
-            memcpy(&victim_cache[vic_line_index], &curr_set[evict_index], 
-                    sizeof(cache_line));
-            memcpy(&curr_set[evict_index], &temp, sizeof(cache_line));
-
-            victim_cache[vic_line_index].tag = lru_to_victim_tag;
-            curr_set[evict_index].tag = victim_to_lru_tag;
+    unsigned long vic_line_index =
+        lookup->find_tag(cc->victim_cache, victim_i, victim_addr_tag);
+    if (vic_line_index < victim_i) {
+        // Found tag + valid bit YAY, victim hit!!
+        // update LRU_counter
+        cc->victim_cache[vic_line_index].LRU_counter = iteration;
+        // update dirty bit
+        if (is_store) cc->victim_cache[vic_line_index].dirty_bit = true;
+
+        // a coherence invalidation can leave a way free, and then the line
+        // just moves into it
+        line_index = lookup->find_invalid(curr_set, E);
+        if (line_index < E) {
+            memcpy(&curr_set[line_index], &cc->victim_cache[vic_line_index],
+                   sizeof(cache_line));
+            curr_set[line_index].tag = addr_tag;
+            cc->victim_cache[vic_line_index].valid_bit = false;
+            cc->victim_cache[vic_line_index].dirty_bit = false;
 
+            cc->policy->ops->fill(cc->policy, curr_set, addr_set_index, line_index, pc);
+            cc->policy->ops->hit(cc->policy, curr_set, addr_set_index, line_index, pc);
             return 0; // MAIN MISS, VICTIM HIT
         }
+
+        // otherwise swap with a line of the full main cache set
+        // Find evict index in main cache set
+        unsigned long evict_index = find_evict(cc, curr_set, addr_set_index); 
+
+        // make new tags as we are switching cache configurations
+        unsigned long lru_to_victim_tag =
+            lineBlock(curr_set[evict_index].tag, addr_set_index);
+        unsigned long victim_to_lru_tag = addr_tag;
+
+        // swap
+        cache_line temp = {0};
+
+        memcpy(&temp, &cc->victim_cache[vic_line_index], sizeof(cache_line));
+        memcpy(&cc->victim_cache[vic_line_index], &curr_set[evict_index], 
+                sizeof(cache_line));
+        memcpy(&curr_set[evict_index], &temp, sizeof(cache_line));
+
+        cc->victim_cache[vic_line_index].tag = lru_to_victim_tag;
+        curr_set[evict_index].tag = victim_to_lru_tag;
+
+        // to the policy the line is new to MAIN, and hit
+        cc->policy->ops->fill(cc->policy, curr_set, addr_set_index, evict_index, pc);
+        cc->policy->ops->hit(cc->policy, curr_set, addr_set_index, evict_index, pc);
+
+        return 0; // MAIN MISS, VICTIM HIT
     }
 
     // MAIN MISS, VICTIM MISS
+    recordStream(cc, addr, is_store ? MISS_STORE : MISS_LOAD);
 
     // can freely bring into MAIN
-    for (unsigned long line_index = 0; line_index < E; line_index++) {
-        if (!curr_set[line_index].valid_bit) {
-            // Found invalid bit? - YAY miss
-            // update curr_set[line_index] with values....
-            curr_set[line_index].valid_bit = true;
-            curr_set[line_index].dirty_bit = is_store;
-            curr_set[line_index].tag = addr_tag;
-            curr_set[line_index].LRU_counter = iteration;
-            curr_set[line_index].RRPV = R - 1;
-            return 1; // MAIN MISS, VICTIM MISS, no overall evict
-        }
+    line_index = lookup->find_invalid(curr_set, E);
+    if (line_index < E) {
+        // Found invalid bit? - YAY miss
+        // update curr_set[line_index] with values....
+        curr_set[line_index].valid_bit = true;
+        curr_set[line_index].dirty_bit = is_store;
+        curr_set[line_index].tag = addr_tag;
+        curr_set[line_index].LRU_counter = iteration;
+        cc->policy->ops->fill(cc->policy, curr_set, addr_set_index, line_index, pc);
+        return 1; // MAIN MISS, VICTIM MISS, no overall evict
     }
 
     // now we are handling main miss, victim miss, evict from main cache
@@ -329,92 +542,464 @@ int cache_access_victim(unsigned long addr, unsigned long *evict_addr, bool is_s
     // if victim cache needs to evict, then evict address is reported
 
     // need to evict from MAIN
-    unsigned long evict_index = find_evict(curr_set, E, is_rrip); 
+    unsigned long evict_index = find_evict(cc, curr_set, addr_set_index); 
 
     // can freely bring into VICTIM
-    for (unsigned long vic_line_index = 0; vic_line_index < victim_i; vic_line_index++) {
-        if (!victim_cache[vic_line_index].valid_bit) {
-            // make new tags as we are switching cache configurations
-            unsigned long lru_to_victim_tag = (curr_set[evict_index].tag << s) + 
-                                                (addr_set_index);
-
-            // main LRU evict -> victim free spot
-            victim_cache[vic_line_index].valid_bit = true;
-            victim_cache[vic_line_index].dirty_bit = curr_set[evict_index].dirty_bit;
-            victim_cache[vic_line_index].tag = lru_to_victim_tag;
-            victim_cache[vic_line_index].LRU_counter = curr_set[evict_index].LRU_counter;
-            victim_cache[vic_line_index].RRPV = curr_set[evict_index].RRPV;
-
-            // new address -> main
-            curr_set[evict_index].valid_bit = true;
-            curr_set[evict_index].dirty_bit = is_store;
-            curr_set[evict_index].tag = addr_tag;
-            curr_set[evict_index].LRU_counter = iteration;
-            curr_set[evict_index].RRPV = R - 1;
-            return 1; // MAIN MISS, VICTIM MISS, EVICT FROM MAIN TO VICTIM CACHE, 
-                      // no overall evict, just permreq
-        }
+    vic_line_index = lookup->find_invalid(cc->victim_cache, victim_i);
+    if (vic_line_index < victim_i) {
+        // make new tags as we are switching cache configurations
+        unsigned long lru_to_victim_tag =
+            lineBlock(curr_set[evict_index].tag, addr_set_index);
+
+        // main LRU evict -> victim free spot
+        cc->victim_cache[vic_line_index].valid_bit = true;
+        cc->victim_cache[vic_line_index].dirty_bit = curr_set[evict_index].dirty_bit;
+        cc->victim_cache[vic_line_index].tag = lru_to_victim_tag;
+        cc->victim_cache[vic_line_index].LRU_counter = curr_set[evict_index].LRU_counter;
+        cc->victim_cache[vic_line_index].RRPV = curr_set[evict_index].RRPV;
+        cc->victim_cache[vic_line_index].prefetched = curr_set[evict_index].prefetched;
+
+        // new address -> main
+        curr_set[evict_index].valid_bit = true;
+        curr_set[evict_index].dirty_bit = is_store;
+        curr_set[evict_index].tag = addr_tag;
+        curr_set[evict_index].LRU_counter = iteration;
+        cc->policy->ops->fill(cc->policy, curr_set, addr_set_index, evict_index, pc);
+        return 1; // MAIN MISS, VICTIM MISS, EVICT FROM MAIN TO VICTIM CACHE, 
+                  // no overall evict, just permreq
     }
 
     // evict from VICTIM
-    unsigned long vic_LRU_index = find_evict(victim_cache, victim_i, false);
+    unsigned long vic_LRU_index = lookup->find_oldest(cc->victim_cache, victim_i);
 
     // victim cache doesn't have room, evict victim LRU + replace w/ new address info
     // evict victim LRU -- set evict_addr = victim tag << b
     // main LRU -> victim LRU -- from before
     // new address -> main cache -- from before
     
-    *evict_addr = victim_cache[vic_LRU_index].tag << b;
+    *evict_addr = cc->victim_cache[vic_LRU_index].tag << b;
+    if (cc->victim_cache[vic_LRU_index].dirty_bit) {
+        recordStream(cc, *evict_addr, MISS_WRITEBACK);
+    }
 
     // make new tags as we are switching cache configurations
-    unsigned long lru_to_victim_tag = (curr_set[evict_index].tag << s) + 
-                                        addr_set_index;
+    unsigned long lru_to_victim_tag =
+        lineBlock(curr_set[evict_index].tag, addr_set_index);
 
     // main LRU evict -> victim LRU spot 
-    victim_cache[vic_LRU_index].valid_bit = true;
-    victim_cache[vic_LRU_index].dirty_bit = curr_set[evict_index].dirty_bit;
-    victim_cache[vic_LRU_index].tag = lru_to_victim_tag;
-    victim_cache[vic_LRU_index].LRU_counter = curr_set[evict_index].LRU_counter;
-    victim_cache[vic_LRU_index].RRPV = curr_set[evict_index].RRPV;
+    cc->victim_cache[vic_LRU_index].valid_bit = true;
+    cc->victim_cache[vic_LRU_index].dirty_bit = curr_set[evict_index].dirty_bit;
+    cc->victim_cache[vic_LRU_index].tag = lru_to_victim_tag;
+    cc->victim_cache[vic_LRU_index].LRU_counter = curr_set[evict_index].LRU_counter;
+    cc->victim_cache[vic_LRU_index].RRPV = curr_set[evict_index].RRPV;
+    cc->victim_cache[vic_LRU_index].prefetched = curr_set[evict_index].prefetched;
 
     // new address -> main
     curr_set[evict_index].valid_bit = true;
     curr_set[evict_index].dirty_bit = is_store;
     curr_set[evict_index].tag = addr_tag;
     curr_set[evict_index].LRU_counter = iteration;
-    curr_set[evict_index].RRPV = R - 1;
+    cc->policy->ops->fill(cc->policy, curr_set, addr_set_index, evict_index, pc);
 
     return 2; // BOTH MISS, EVICT
 }
 
+// skew - way i of a block's line is in set skewIndex(block, i), so the LRU
+// line is found among one line per way.  Skewing only supports LRU, whose
+// state is all in the lines, and no victim cache.
+int cache_access_skewed(core_cache *cc, unsigned long addr,
+                        unsigned long *evict_addr, bool is_store) {
+    unsigned long block = addr >> b;
+    cache_line *victim = NULL;
+    for (unsigned long way = 0; way < E; way++) {
+        cache_line *line =
+            (cache_line *)set_store_get(cc->main_cache, skewIndex(block, way)) +
+            way;
+        if (line->valid_bit && line->tag == block) {
+            line->LRU_counter = iteration;
+            if (is_store) line->dirty_bit = true;
+            return 0; // MAIN HIT
+        }
+        // an invalid line beats any valid one, then the least recently used
+        if (victim == NULL ||
+            (victim->valid_bit &&
+             (!line->valid_bit || line->LRU_counter < victim->LRU_counter))) {
+            victim = line;
+        }
+    }
+    recordStream(cc, addr, is_store ? MISS_STORE : MISS_LOAD);
+
+    bool evicted = victim->valid_bit;
+    if (evicted) {
+        *evict_addr = victim->tag << b;
+        if (victim->dirty_bit) {
+            recordStream(cc, *evict_addr, MISS_WRITEBACK);
+        }
+    }
+    victim->valid_bit = true;
+    victim->dirty_bit = is_store;
+    victim->tag = block;
+    victim->LRU_counter = iteration;
+    return evicted ? 2 : 1;
+}
+
+// an access to L1, however it is organized
+int l1Access(core_cache *cc, unsigned long addr, unsigned long pc,
+             unsigned long *evict_addr, bool is_store) {
+    if (indexFn == INDEX_SKEW) return cache_access_skewed(cc, addr, evict_addr, is_store);
+    return victim_i > 0 ? cache_access_victim(cc, addr, pc, evict_addr, is_store) : cache_access(cc, addr, pc, evict_addr, is_store);
+}
+
+cache_line *findLine(core_cache *cc, unsigned long addr);
+
+// what L1 does with fills predicted dead (-D): keep them out, or insert
+// them where they are the next to go
+bool deadBypass = true;
+
+// set_index * E + way of the MAIN line holding addr, or -1
+long lineSlot(core_cache *cc, unsigned long addr) {
+    if (indexFn == INDEX_SKEW) {
+        for (unsigned long way = 0; way < E; way++) {
+            unsigned long set_index = skewIndex(addr >> b, way);
+            cache_line *line =
+                (cache_line *)set_store_find(cc->main_cache, set_index) + way;
+            if (line->valid_bit && line->tag == addr >> b) {
+                return set_index * E + way;
+            }
+        }
+        return -1;
+    }
+    unsigned long addr_tag;
+    unsigned long set_index = setIndex(addr, &addr_tag);
+    cache_line *set = set_store_find(cc->main_cache, set_index);
+    unsigned long way = lookup->find_tag(set, E, addr_tag);
+    return way < E ? (long)(set_index * E + way) : -1;
+}
+
+// l1Access, consulting cc's dead block predictor on misses.  Prefetches
+// (not demand) are always filled, and are not predicted on.
+int predictedAccess(core_cache *cc, unsigned long addr, unsigned long pc,
+                    unsigned long *evict_addr, bool is_store, bool demand) {
+    deadblock *db = cc->deadblock;
+    long slot = lineSlot(cc, addr);
+    if (slot != -1) {
+        deadblock_hit(db, slot);
+        return l1Access(cc, addr, pc, evict_addr, is_store);
+    }
+
+    uint16_t signature = deadblock_signature(db, addr, pc);
+    bool dead = demand && deadblock_predict(db, addr >> b, signature);
+    if (dead && deadBypass) {
+        DPRINTF("core %d bypasses %lX\n", cc->procNum, addr);
+        deadblock_bypass(db, addr >> b, signature);
+        recordStream(cc, addr, is_store ? MISS_STORE : MISS_LOAD);
+        return 1;
+    }
+
+    // the new line takes the place of the one it evicts
+    int res = l1Access(cc, addr, pc, evict_addr, is_store);
+    slot = lineSlot(cc, addr);
+    if (res == 2) {
+        deadblock_evict(db, slot);
+    }
+    deadblock_fill(db, slot, signature, dead, demand);
+    if (dead) {
+        cache_line *line = findLine(cc, addr);
+        line->RRPV = R;
+        line->LRU_counter = 0;
+    }
+    return res;
+}
+
 /**
  * @brief Simulates a load into the cache
  * Very similar to store, but the two functions kept separate for clarity
  *
  * @param[in]     addr         Address we are reading from
+ * @param[in]     pc           Address of the load op
  *
  * Updates cache with result of load operation using a given address
  */
-int load(unsigned long addr, unsigned long *evict_addr) {
-    return victim_i > 0 ? cache_access_victim(addr, evict_addr, false) : cache_access(addr, evict_addr, false);
+int load(core_cache *cc, unsigned long addr, unsigned long pc, unsigned long *evict_addr) {
+    if (cc->deadblock != NULL) return predictedAccess(cc, addr, pc, evict_addr, false, true);
+    return l1Access(cc, addr, pc, evict_addr, false);
 }
 
 /**
  * @brief Simulates a store into the cache
  *
  * @param[in]     addr         Address we are writing to
+ * @param[in]     pc           Address of the store op
  *
  * Updates cache with result of store operation using a given address
  */
-int store(unsigned long addr, unsigned long *evict_addr) {
-    return victim_i > 0 ? cache_access_victim(addr, evict_addr, true) : cache_access(addr, evict_addr, true);
+int store(core_cache *cc, unsigned long addr, unsigned long pc, unsigned long *evict_addr) {
+    // no-write-allocate - a miss writes around L1
+    if (writeAround && findLine(cc, addr) == NULL) {
+        recordStream(cc, addr, MISS_STORE);
+        return 1;
+    }
+    int res = cc->deadblock != NULL
+                  ? predictedAccess(cc, addr, pc, evict_addr, true, true)
+                  : l1Access(cc, addr, pc, evict_addr, true);
+    // write-through - the store's data goes out, so the line stays clean,
+    // if it was not kept out of L1 as dead
+    if (writeThrough) {
+        cache_line *line = findLine(cc, addr);
+        if (line != NULL) line->dirty_bit = false;
+    }
+    return res;
+}
+
+// shape of a level past L1, as given to -2 or -3
+typedef struct _level_config {
+    bool enabled;
+    unsigned long s, E, latency;
+} level_config;
+
+static char *const levelTokens[] = {"s", "E", "lat", NULL};
+
+enum LEVEL_TOKEN { T_SETS , T_WAYS , T_LATENCY };
+
+// parses "s=<set bits>,E=<lines per set>,lat=<ticks>" into lc
+int parseLevel(char *spec, level_config *lc) {
+    char *value;
+    lc->enabled = true;
+    while (*spec != '\0') {
+        int token = getsubopt(&spec, levelTokens, &value);
+        if (token == -1 || value == NULL) {
+            fprintf(stderr, "Unknown cache level setting - %s\n", value);
+            return -1;
+        }
+        unsigned long v = strtoul(value, NULL, 10);
+        switch (token) {
+        case T_SETS: lc->s = v; break;
+        case T_WAYS: lc->E = v; break;
+        case T_LATENCY: lc->latency = v; break;
+        }
+    }
+    if (lc->E == 0 || lc->s + b >= 64) {
+        fprintf(stderr, "Cache level settings are out of range\n");
+        return -1;
+    }
+    return 0;
+}
+
+static char *const prefetchTokens[] = {"degree", "distance", NULL};
+
+enum PREFETCH_TOKEN { T_DEGREE , T_DISTANCE };
+
+// parses "<name>,degree=<blocks>,distance=<blocks>", cutting spec down to
+// the name
+int parsePrefetch(char *spec, unsigned long *degree, unsigned long *distance) {
+    char *settings = strchr(spec, ',');
+    if (settings == NULL) {
+        return 0;
+    }
+    *settings++ = '\0';
+
+    char *value;
+    while (*settings != '\0') {
+        int token = getsubopt(&settings, prefetchTokens, &value);
+        if (token == -1 || value == NULL) {
+            fprintf(stderr, "Unknown prefetcher setting - %s\n", value);
+            return -1;
+        }
+        unsigned long v = strtoul(value, NULL, 10);
+        switch (token) {
+        case T_DEGREE: *degree = v; break;
+        case T_DISTANCE: *distance = v; break;
+        }
+    }
+    if (*degree == 0 || *distance == 0) {
+        fprintf(stderr, "Prefetch degree and distance must be at least 1\n");
+        return -1;
+    }
+    return 0;
+}
+
+static char *const sampleTokens[] = {"max", "rate", NULL};
+
+enum SAMPLE_TOKEN { T_MAX , T_RATE };
+
+// parses "max=<blocks>,rate=<fraction>"
+int parseSampling(char *spec, unsigned long *max_blocks, double *rate) {
+    char *value;
+    while (*spec != '\0') {
+        int token = getsubopt(&spec, sampleTokens, &value);
+        if (token == -1 || value == NULL) {
+            fprintf(stderr, "Unknown sampling setting - %s\n", value);
+            return -1;
+        }
+        switch (token) {
+        case T_MAX: *max_blocks = strtoul(value, NULL, 10); break;
+        case T_RATE: *rate = strtod(value, NULL); break;
+        }
+    }
+    if (*max_blocks == 0 || *rate <= 0.0 || *rate > 1.0) {
+        fprintf(stderr, "Sampling settings are out of range\n");
+        return -1;
+    }
+    return 0;
+}
+
+static char *const futureTokens[] = {"window", NULL};
+
+enum FUTURE_TOKEN { T_WINDOW };
+
+// parses "<file>,window=<accesses>", cutting spec down to the file
+int parseFuture(char *spec, uint64_t *window) {
+    char *settings = strchr(spec, ',');
+    if (settings == NULL) {
+        return 0;
+    }
+    *settings++ = '\0';
+
+    char *value;
+    while (*settings != '\0') {
+        int token = getsubopt(&settings, futureTokens, &value);
+        if (token == -1 || value == NULL) {
+            fprintf(stderr, "Unknown OPT setting - %s\n", value);
+            return -1;
+        }
+        switch (token) {
+        case T_WINDOW: *window = strtoull(value, NULL, 10); break;
+        }
+    }
+    if (*window == 0) {
+        fprintf(stderr, "The OPT window must be at least 1 access\n");
+        return -1;
+    }
+    return 0;
+}
+
+static char *const deadblockTokens[] = {"fill", "region", NULL};
+
+enum DEADBLOCK_TOKEN { T_FILL , T_REGION };
+
+// parses the ",fill=<bypass|distant>,region=<bits>" after the predictor's
+// name, cutting them off it
+int parseDeadblock(char *spec, unsigned long *region_bits) {
+    char *settings = strchr(spec, ',');
+    if (settings == NULL) {
+        return 0;
+    }
+    *settings++ = '\0';
+
+    char *value;
+    while (*settings != '\0') {
+        int token = getsubopt(&settings, deadblockTokens, &value);
+        if (token == -1 || value == NULL) {
+            fprintf(stderr, "Unknown dead block setting - %s\n", value);
+            return -1;
+        }
+        switch (token) {
+        case T_FILL:
+            deadBypass = strcmp(value, "bypass") == 0;
+            if (!deadBypass && strcmp(value, "distant") != 0) {
+                fprintf(stderr, "Unknown dead block fill %s\n", value);
+                return -1;
+            }
+            break;
+        case T_REGION: *region_bits = strtoul(value, NULL, 10); break;
+        }
+    }
+    if (*region_bits >= 64) {
+        fprintf(stderr, "Dead block regions are out of range\n");
+        return -1;
+    }
+    return 0;
+}
+
+static char *const writeTokens[] = {"hit", "miss", "buffer", "lat", NULL};
+
+enum WRITE_TOKEN { T_HIT , T_MISS , T_BUFFER , T_WRITE_LATENCY };
+
+// parses "hit=<back|through>,miss=<allocate|around>,buffer=<entries>,
+// lat=<ticks>"
+int parseWrite(char *spec, unsigned long *latency) {
+    char *value;
+    while (*spec != '\0') {
+        int token = getsubopt(&spec, writeTokens, &value);
+        if (token == -1 || value == NULL) {
+            fprintf(stderr, "Unknown write policy setting - %s\n", value);
+            return -1;
+        }
+        switch (token) {
+        case T_HIT:
+            writeThrough = strcmp(value, "through") == 0;
+            if (!writeThrough && strcmp(value, "back") != 0) {
+                fprintf(stderr, "Unknown write hit policy %s\n", value);
+                return -1;
+            }
+            break;
+        case T_MISS:
+            writeAround = strcmp(value, "around") == 0;
+            if (!writeAround && strcmp(value, "allocate") != 0) {
+                fprintf(stderr, "Unknown write miss policy %s\n", value);
+                return -1;
+            }
+            break;
+        case T_BUFFER: wbufCount = strtoul(value, NULL, 10); break;
+        case T_WRITE_LATENCY: *latency = strtoul(value, NULL, 10); break;
+        }
+    }
+    if (writeThrough && wbufCount == 0) {
+        fprintf(stderr, "Write-through needs a write buffer\n");
+        return -1;
+    }
+    return 0;
+}
+
+cache_level *createLevel(const char *name, level_config *lc,
+                         const char *policy_name, bool shared, bool sparse) {
+    cache_level *lv = calloc(1, sizeof(cache_level));
+    if (lv == NULL) {
+        return NULL;
+    }
+    lv->name = name;
+    lv->s = lc->s;
+    lv->S = 1UL << lc->s;
+    lv->E = lc->E;
+    lv->latency = lc->latency;
+    lv->shared = shared;
+    size_t set_bytes =
+        lv->E * (sizeof(cache_line) + (shared ? sizeof(uint64_t) : 0));
+    lv->lines = set_store_create(lv->S, set_bytes, sparse);
+    lv->policy = replacement_create(policy_name, lv->S, lv->E, R, lookup);
+    if (lv->lines == NULL || lv->policy == NULL) {
+        return NULL;
+    }
+    return lv;
+}
+
+void destroyLevel(cache_level *lv) {
+    if (lv == NULL) return;
+    set_store_destroy(lv->lines);
+    replacement_destroy(lv->policy);
+    free(lv);
 }
 
 cache *init(cache_sim_args *csa) {
     int op;
+    char *lookup_name = NULL;
+    char *policy_name = NULL;
+    char *l2_spec = NULL;
+    char *llc_spec = NULL;
+    char *inclusion_name = NULL;
+    char *prefetch_name = NULL;
+    char *sample_spec = NULL;
+    char *future_spec = NULL;
+    char *record_name = NULL;
+    char *backing_name = NULL;
+    char *miss_name = NULL;
+    char *index_name = NULL;
+    char *write_spec = NULL;
+    char *deadblock_name = NULL;
 
     // get argument list from assignment
-    while ((op = getopt(csa->arg_count, csa->arg_list, "E:s:b:i:R:")) != -1) {
+    while ((op = getopt(csa->arg_count, csa->arg_list,
+                        "E:s:b:i:R:L:P:M:2:3:I:f:S:O:A:B:m:H:W:D:")) != -1) {
         switch (op) {
         // Lines per set
         case 'E':
@@ -424,13 +1009,11 @@ cache *init(cache_sim_args *csa) {
         // Sets per cache
         case 's':
             s = strtoul(optarg, NULL, 10);
-            S = 1UL << s;
             break;
 
         // block size in bits
         case 'b':
             b = strtoul(optarg, NULL, 10);
-            B = 1 << b;
             break;
 
         // entries in victim cache
@@ -441,25 +1024,337 @@ cache *init(cache_sim_args *csa) {
         // bits in a RRIP-based replacement policy
         case 'R':
             k = strtoul(optarg, NULL, 10);
-            if (k != 0) {
-                is_rrip = true;
-                R = (1UL << k) - 1;
+            if (k > RRPV_BITS) {
+                fprintf(stderr, "RRIP supports at most %d bits\n", RRPV_BITS);
+                return NULL;
             }
             break;
+
+        // replacement policy: lru, plru, srrip, brrip, drrip, ship or opt
+        // (default is srrip if -R is given, lru otherwise).  opt needs -O,
+        // and only applies to L1; L2 and the LLC use lru alongside it.
+        case 'P':
+            policy_name = optarg;
+            break;
+
+        // MSHRs, making the cache non-blocking (default 0, blocking)
+        case 'M':
+            mshrCount = strtoul(optarg, NULL, 10);
+            break;
+
+        // set search implementation: scalar, sse2 or avx2
+        // (default is the fastest the host supports)
+        case 'L':
+            lookup_name = optarg;
+            break;
+
+        // private L2 and shared LLC, each as s=<set bits>,E=<lines per
+        // set>,lat=<ticks> (default none)
+        case '2':
+            l2_spec = optarg;
+            break;
+        case '3':
+            llc_spec = optarg;
+            break;
+
+        // inclusion between levels: nine, inclusive or exclusive
+        // (default nine)
+        case 'I':
+            inclusion_name = optarg;
+            break;
+
+        // prefetcher: nextline, stream or stride, optionally followed by
+        // ,degree=<blocks>,distance=<blocks> (default none; degree and
+        // distance default to 1)
+        case 'f':
+            prefetch_name = optarg;
+            break;
+
+        // sampled miss ratio curves, as max=<blocks tracked>,rate=<starting
+        // fraction of blocks tracked> (default none; max defaults to 8192
+        // and rate to 1)
+        case 'S':
+            sample_spec = optarg;
+            break;
+
+        // accesses for opt to look ahead in, as <file>,window=<accesses>
+        // (default none; window defaults to no limit).  The file is written
+        // by -A in an earlier run with the same trace, cores and -b.
+        case 'O':
+            future_spec = optarg;
+            break;
+
+        // file to record each core's demand accesses in, for -O
+        // (default none)
+        case 'A':
+            record_name = optarg;
+            break;
+
+        // host memory for sets: dense, allocated up front, or sparse,
+        // allocated a page at a time as sets are first used (default dense)
+        case 'B':
+            backing_name = optarg;
+            break;
+
+        // file to record L1's misses and dirty evictions in, along with
+        // invalidations, for cadss-replay (default none)
+        case 'm':
+            miss_name = optarg;
+            break;
+
+        // MAIN set index function: bits, xor, prime or skew (default bits).
+        // skew needs lru and no victim cache, and opt needs bits.
+        case 'H':
+            index_name = optarg;
+            break;
+
+        // write policy, as hit=<back|through>,miss=<allocate|around>,
+        // buffer=<entries>,lat=<ticks> (default write-back, write-allocate
+        // and no write buffer).  Write-through needs a buffer, and lat is
+        // how long its writes hold an entry (default the latency of the
+        // first level past L1, or 90 ticks for memory without one).
+        case 'W':
+            write_spec = optarg;
+            break;
+
+        // dead block predictor for L1: pc or region, optionally followed by
+        // ,fill=<bypass|distant>,region=<bits> (default none; fills
+        // predicted dead bypass L1, and regions are 2^12 bytes).  It needs
+        // no victim cache, and distant fills need lru or an RRIP policy.
+        case 'D':
+            deadblock_name = optarg;
+            break;
         }
     }
 
-    // create cache in memory
-    main_cache = (cache_line **)calloc(
-        S, sizeof(cache_line *)); // equivalent to cache[S][E]
+    lookup = select_lookup(lookup_name);
+    if (lookup == NULL) {
+        fprintf(stderr, "Set lookup %s is not supported here\n", lookup_name);
+        return NULL;
+    }
+    DPRINTF("using %s set lookup\n", lookup->name);
+
+    S = 1UL << s;
+    B = 1UL << b;
 
-    // initialize/clear the cache
-    for (unsigned long i = 0; i < S; i++) {
-        main_cache[i] = (cache_line *)calloc(E, sizeof(cache_line));
+    if (policy_name == NULL) {
+        policy_name = k != 0 ? "srrip" : "lru";
     }
-    
-    // create victim cache -- i lines
-    victim_cache = (cache_line *)calloc(victim_i, sizeof(cache_line));
+    bool opt = strcmp(policy_name, "opt") == 0;
+    if (opt != (future_spec != NULL)) {
+        fprintf(stderr, "-P opt and -O go together\n");
+        return NULL;
+    }
+    if (index_name == NULL || strcmp(index_name, "bits") == 0) {
+        indexFn = INDEX_BITS;
+    } else if (strcmp(index_name, "xor") == 0) {
+        indexFn = INDEX_XOR;
+    } else if (strcmp(index_name, "prime") == 0) {
+        indexFn = INDEX_PRIME;
+    } else if (strcmp(index_name, "skew") == 0) {
+        indexFn = INDEX_SKEW;
+    } else {
+        fprintf(stderr, "Unknown set index function %s\n", index_name);
+        return NULL;
+    }
+    if (indexFn == INDEX_SKEW &&
+        (strcmp(policy_name, "lru") != 0 || victim_i > 0)) {
+        fprintf(stderr, "-H skew needs -P lru and no victim cache\n");
+        return NULL;
+    }
+    if (indexFn != INDEX_BITS && opt) {
+        fprintf(stderr, "-P opt needs -H bits\n");
+        return NULL;
+    }
+    // largest prime up to S, or 1
+    P = S;
+    while (indexFn == INDEX_PRIME && P > 2) {
+        bool prime = true;
+        for (unsigned long d = 2; d * d <= P && prime; d++) {
+            prime = P % d != 0;
+        }
+        if (prime) break;
+        P--;
+    }
+    if (replacement_uses_rrpv(policy_name)) {
+        if (k == 0) k = 2;
+        R = (1UL << k) - 1;
+    }
+    level_config l2_config = {false, 0, 1, 10};
+    level_config llc_config = {false, 0, 1, 30};
+    if ((l2_spec != NULL && parseLevel(l2_spec, &l2_config) != 0) ||
+        (llc_spec != NULL && parseLevel(llc_spec, &llc_config) != 0)) {
+        return NULL;
+    }
+    // writes go to the first level past L1
+    wbufLatency = l2_config.enabled    ? l2_config.latency
+                  : llc_config.enabled ? llc_config.latency
+                                       : 90;
+    if (write_spec != NULL) {
+        writePolicySet = true;
+        if (parseWrite(write_spec, &wbufLatency) != 0) {
+            return NULL;
+        }
+    }
+    unsigned long region_bits = 12;
+    if (deadblock_name != NULL) {
+        if (parseDeadblock(deadblock_name, &region_bits) != 0) {
+            return NULL;
+        }
+        if (victim_i > 0) {
+            fprintf(stderr, "-D needs no victim cache\n");
+            return NULL;
+        }
+        if (!deadBypass && strcmp(policy_name, "lru") != 0 &&
+            !replacement_uses_rrpv(policy_name)) {
+            fprintf(stderr, "-D fill=distant needs lru or an RRIP policy\n");
+            return NULL;
+        }
+    }
+    unsigned long sample_max = 8192;
+    double sample_rate = 1.0;
+    if (sample_spec != NULL &&
+        parseSampling(sample_spec, &sample_max, &sample_rate) != 0) {
+        return NULL;
+    }
+    unsigned long prefetch_degree = 1, prefetch_distance = 1;
+    if (prefetch_name != NULL &&
+        parsePrefetch(prefetch_name, &prefetch_degree, &prefetch_distance) != 0) {
+        return NULL;
+    }
+    uint64_t future_window = FUTURE_NEVER;
+    future **futures = NULL;
+    if (future_spec != NULL) {
+        futures = calloc(processorCount, sizeof(future *));
+        if (futures == NULL ||
+            parseFuture(future_spec, &future_window) != 0 ||
+            future_load(future_spec, b, processorCount, future_window,
+                        futures) != 0) {
+            return NULL;
+        }
+    }
+    if (record_name != NULL) {
+        recordFile = future_record_open(record_name, b, processorCount);
+        if (recordFile == NULL) {
+            fprintf(stderr, "Cannot write accesses to %s\n", record_name);
+            return NULL;
+        }
+    }
+    if (miss_name != NULL) {
+        missFile = missstream_create(miss_name, b, processorCount);
+        if (missFile == NULL) {
+            fprintf(stderr, "Cannot write misses to %s\n", miss_name);
+            return NULL;
+        }
+    }
+    const char *level_policy = opt ? "lru" : policy_name;
+    bool sparse = backing_name != NULL && strcmp(backing_name, "sparse") == 0;
+    if (backing_name != NULL && !sparse && strcmp(backing_name, "dense") != 0) {
+        fprintf(stderr, "Unknown set backing %s\n", backing_name);
+        return NULL;
+    }
+    if (inclusion_name == NULL || strcmp(inclusion_name, "nine") == 0) {
+        inclusionPolicy = NINE;
+    } else if (strcmp(inclusion_name, "inclusive") == 0) {
+        inclusionPolicy = INCLUSIVE;
+    } else if (strcmp(inclusion_name, "exclusive") == 0) {
+        inclusionPolicy = EXCLUSIVE;
+    } else {
+        fprintf(stderr, "Unknown inclusion policy %s\n", inclusion_name);
+        return NULL;
+    }
+
+    if (llc_config.enabled) {
+        if (processorCount > 64) {
+            fprintf(stderr, "The LLC supports at most 64 cores\n");
+            return NULL;
+        }
+        llc = createLevel("LLC", &llc_config, level_policy, true, sparse);
+        if (llc == NULL) {
+            return NULL;
+        }
+    }
+
+    caches = calloc(processorCount, sizeof(core_cache));
+    if (caches == NULL) {
+        return NULL;
+    }
+
+    // A core has a request per MSHR in flight (one when blocking), along
+    // with a few giving up lines or prefetching, and each rarely holds more
+    // than two pending requests.  Pools grow past this if they must.
+    unsigned long inFlight = processorCount * (mshrCount + 4);
+    pool_init(&memRequestPool, sizeof(memRequest), inFlight);
+    pool_init(&pendingRequestPool, sizeof(pendingRequest), 2 * inFlight);
+
+    for (int i = 0; i < processorCount; i++) {
+        core_cache *cc = &caches[i];
+        cc->procNum = i;
+
+        cc->policy = replacement_create(policy_name, S, E, R, lookup);
+        if (cc->policy == NULL) {
+            return NULL;
+        }
+        if (futures != NULL) {
+            cc->future = futures[i];
+            cc->policy->future = cc->future;
+        }
+
+        if (mshrCount > 0) {
+            cc->mshrCapacity = mshrCount;
+            cc->mshrs = calloc(cc->mshrCapacity, sizeof(mshr));
+            if (cc->mshrs == NULL) {
+                return NULL;
+            }
+        }
+
+        if (wbufCount > 0) {
+            cc->wbuf = calloc(wbufCount, sizeof(wbuf_entry));
+            if (cc->wbuf == NULL) {
+                return NULL;
+            }
+        }
+
+        // create cache in memory, equivalent to cache[S][E]
+        cc->main_cache = set_store_create(S, E * sizeof(cache_line), sparse);
+        if (cc->main_cache == NULL) {
+            return NULL;
+        }
+
+        // create victim cache -- i lines
+        cc->victim_cache = (cache_line *)calloc(victim_i, sizeof(cache_line));
+
+        if (l2_config.enabled) {
+            cc->l2 = createLevel("L2", &l2_config, level_policy, false, sparse);
+            if (cc->l2 == NULL) {
+                return NULL;
+            }
+        }
+
+        if (prefetch_name != NULL) {
+            cc->prefetcher = prefetcher_create(prefetch_name, b, prefetch_degree,
+                                               prefetch_distance);
+            if (cc->prefetcher == NULL) {
+                return NULL;
+            }
+        }
+
+        if (deadblock_name != NULL) {
+            cc->deadblock = deadblock_create(deadblock_name, S * E, region_bits);
+            if (cc->deadblock == NULL) {
+                return NULL;
+            }
+        }
+
+        if (sample_spec != NULL) {
+            cc->mrc = mrc_create(sample_max, sample_rate);
+            if (cc->mrc == NULL) {
+                return NULL;
+            }
+        }
+    }
+    free(futures);
+    DPRINTF("using %s replacement in %d caches\n", policy_name, processorCount);
 
     self = malloc(sizeof(cache));
     self->memoryRequest = memoryRequest;
@@ -478,50 +1373,816 @@ cache *init(cache_sim_args *csa) {
 // according to coherence. in those cases we won't get a callback so we just need to advance 
 // the queue manually ourselves (aka we can't wait for next tick)
 // note this only happens if permReq returns 1
-void handlePermReq() {
-    memRequest *q = memReqQueue.head;
+void handlePermReq(core_cache *cc) {
+    memRequest *q = cc->memReqQueue.head;
     q->head->isStarted = true;
-    if (coherComp->permReq(q->head->isLoad, q->head->addr, procNum)) {
+    if (coherComp->permReq(q->head->isLoad, q->head->addr, cc->procNum)) {
         dequeuePendingRequest(q);
     }
 }
 
+void startNextAccess(core_cache *cc);
+
 // invReq's equivalent to permReq's handlePermReq
-void handleInvReq() {
-    memRequest *q = memReqQueue.head;
+void handleInvReq(core_cache *cc) {
+    memRequest *q = cc->memReqQueue.head;
     q->head->isStarted = true;
-    // invlReq should return 1 for P1 (aka wait)
-    assert(coherComp->invlReq(q->head->addr, procNum));
-}
-
-// This routine is a linkage to the rest of the memory hierarchy
-void coherCallback(int type, int procNum, int64_t addr) {
-    memRequest *q = memReqQueue.head;
-    switch (type) {
-    case NO_ACTION:
-        DPRINTF("** received inv callback\n");
-        // dq current invreq
-        dequeuePendingRequest(q);
-        handlePermReq();
-        break;
-    case DATA_RECV:
-        // This indicates that the cache has received data from memory
-
-        // check that the addr is the pending access
-        assert(addr == q->head->addr);
+    cc->releases++;
+    // Without a flush there is no callback to wait for.  This happens when
+    // another core's request has already taken the line from us.
+    if (!coherComp->invlReq(q->head->addr, cc->procNum)) {
         dequeuePendingRequest(q);
-        break;
-
-    case INVALIDATE:
-        // This is taught later in the semester.
-        break;
-
-    default:
-        break;
+        startNextAccess(cc);
+        return;
+    }
+    cc->flushes++;
+    q->head->startedAt = iteration;
+}
+
+// the buffer entry holding addr, a release if flush, or -1
+int wbufFind(core_cache *cc, int64_t addr, bool flush) {
+    for (unsigned long i = 0; i < wbufCount; i++) {
+        if (cc->wbuf[i].valid && cc->wbuf[i].flush == flush &&
+            cc->wbuf[i].addr == addr) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// whether p has to wait on cc's write buffer: an access to a block whose
+// release is still draining, or a release or write-through with no entry
+bool wbufBlocks(core_cache *cc, pendingRequest *p) {
+    if (p->requestType == PERM) {
+        return wbufFind(cc, p->addr, true) != -1;
+    }
+    if (p->requestType == WRITE && wbufFind(cc, p->addr, false) != -1) {
+        return false;
+    }
+    return cc->wbufInUse == wbufCount;
+}
+
+// moves p, a release or write-through that wbufBlocks let through, into
+// cc's write buffer
+void wbufTake(core_cache *cc, pendingRequest *p) {
+    bool flush = p->requestType == INV;
+    if (!flush) {
+        cc->writesThrough++;
+        if (wbufFind(cc, p->addr, false) != -1) {
+            cc->writesCoalesced++;
+            return;
+        }
+    }
+
+    unsigned long i = 0;
+    while (cc->wbuf[i].valid) i++;
+    cc->wbuf[i].valid = true;
+    cc->wbuf[i].flush = flush;
+    cc->wbuf[i].issued = false;
+    cc->wbuf[i].addr = p->addr;
+    cc->wbuf[i].startedAt = iteration;
+    cc->wbuf[i].doneAt = iteration + wbufLatency;
+    if (++cc->wbufInUse > cc->wbufPeak) cc->wbufPeak = cc->wbufInUse;
+    DPRINTF("core %d buffered %s of %lX\n", cc->procNum,
+            flush ? "release" : "write", p->addr);
+}
+
+void wbufFree(core_cache *cc, int i) {
+    cc->wbuf[i].valid = false;
+    cc->wbufInUse--;
+}
+
+// frees cc's write-throughs that have reached the next level, and gives
+// its oldest waiting release to coherence
+void wbufDrain(core_cache *cc) {
+    int oldest = -1;
+    for (unsigned long i = 0; i < wbufCount; i++) {
+        wbuf_entry *w = &cc->wbuf[i];
+        if (!w->valid) continue;
+        if (!w->flush && w->doneAt <= iteration) {
+            wbufFree(cc, i);
+        } else if (w->flush && !w->issued &&
+                   (oldest == -1 || w->startedAt < cc->wbuf[oldest].startedAt)) {
+            oldest = i;
+        }
+    }
+    if (oldest == -1) {
+        return;
+    }
+
+    wbuf_entry *w = &cc->wbuf[oldest];
+    cc->releases++;
+    // no flush means no callback
+    if (!coherComp->invlReq(w->addr, cc->procNum)) {
+        wbufFree(cc, oldest);
+        return;
+    }
+    cc->flushes++;
+    w->issued = true;
+    w->startedAt = iteration;
+}
+
+// coherence finished flushing addr.  Returns whether it was buffered.
+bool wbufFlushed(core_cache *cc, int64_t addr) {
+    int i = wbufFind(cc, addr, true);
+    if (i == -1 || !cc->wbuf[i].issued) {
+        return false;
+    }
+    cc->flushTicks += iteration - cc->wbuf[i].startedAt;
+    wbufFree(cc, i);
+    return true;
+}
+
+// ticks until cc's buffer next drains, or INT64_MAX if it waits on
+// coherence
+int64_t wbufNextTick(core_cache *cc) {
+    int64_t next = INT64_MAX;
+    for (unsigned long i = 0; i < wbufCount; i++) {
+        if (cc->wbuf[i].valid && cc->wbuf[i].flush && !cc->wbuf[i].issued) {
+            return 1;
+        }
+        if (cc->wbuf[i].valid && !cc->wbuf[i].flush) {
+            int64_t n = cc->wbuf[i].doneAt > iteration
+                            ? (int64_t)(cc->wbuf[i].doneAt - iteration)
+                            : 1;
+            if (n < next) next = n;
+        }
+    }
+    return next;
+}
+
+// starts the head request's next access, if it has one that is ready
+void startNextAccess(core_cache *cc) {
+    pendingRequest *p = cc->memReqQueue.head->head;
+    if (p == NULL || p->isStarted || p->readyAt > iteration) {
+        return;
+    }
+    if (wbufCount > 0) {
+        if (wbufBlocks(cc, p)) {
+            cc->wbufWaiting = true;
+            return;
+        }
+        if (p->requestType != PERM) {
+            wbufTake(cc, p);
+            dequeuePendingRequest(cc->memReqQueue.head);
+            startNextAccess(cc);
+            return;
+        }
+    }
+    p->requestType == INV ? handleInvReq(cc) : handlePermReq(cc);
+}
+
+int findMSHR(core_cache *cc, int64_t addr) {
+    for (unsigned long i = 0; i < cc->mshrCapacity; i++) {
+        if (cc->mshrs[i].valid && cc->mshrs[i].addr == addr) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+int allocMSHR(core_cache *cc, pendingRequest *p) {
+    unsigned long i = 0;
+    while (i < cc->mshrCapacity && cc->mshrs[i].valid) i++;
+    if (i == cc->mshrCapacity) {
+        cc->mshrs = realloc(cc->mshrs, 2 * cc->mshrCapacity * sizeof(mshr));
+        assert(cc->mshrs != NULL);
+        memset(&cc->mshrs[cc->mshrCapacity], 0, cc->mshrCapacity * sizeof(mshr));
+        cc->mshrCapacity *= 2;
+    }
+
+    cc->mshrs[i].valid = true;
+    cc->mshrs[i].addr = p->addr;
+    cc->mshrs[i].requestType = p->requestType;
+    cc->mshrs[i].isLoad = p->isLoad;
+    cc->mshrsInUse++;
+    cc->mshrAllocs++;
+    return i;
+}
+
+void releaseReservation(core_cache *cc, memRequest *q) {
+    if (q->reserved) {
+        q->reserved = false;
+        cc->mshrsReserved--;
+    }
+}
+
+// loads can wait on any fetch of the block, stores only on one for writing
+bool canMerge(pendingRequest *p, mshr *m) {
+    return p->requestType == PERM && m->requestType == PERM &&
+           (p->isLoad || !m->isLoad);
+}
+
+// whether a request ahead of q still has to access the block, keeping each
+// core's accesses to a block in order
+bool blockBusy(core_cache *cc, memRequest *q, int64_t addr) {
+    for (memRequest *r = cc->memReqQueue.head; r != q; r = r->next) {
+        for (pendingRequest *p = r->head; p != NULL; p = p->next) {
+            if (p->addr == addr) return true;
+        }
+    }
+    return false;
+}
+
+// whether q's next access can start (or merge) this tick
+bool accessReady(core_cache *cc, memRequest *q) {
+    pendingRequest *p = q->head;
+    if (p->readyAt > iteration) {
+        return false;
+    }
+    int m = findMSHR(cc, p->addr);
+    if (m != -1) {
+        return canMerge(p, &cc->mshrs[m]);
+    }
+    if (blockBusy(cc, q, p->addr)) {
+        return false;
+    }
+    if (wbufCount > 0) {
+        if (wbufBlocks(cc, p)) {
+            cc->wbufWaiting = true;
+            return false;
+        }
+        if (p->requestType != PERM) {
+            return true;
+        }
+    }
+    // tag hits usually have permission already, so they only need an MSHR
+    // if coherence says otherwise
+    return (p->requestType == PERM && p->cacheResult == HIT) ||
+           cc->mshrsInUse < mshrCount;
+}
+
+void startAccess(core_cache *cc, memRequest *q) {
+    pendingRequest *p = q->head;
+    p->isStarted = true;
+
+    int m = findMSHR(cc, p->addr);
+    if (m != -1) {
+        DPRINTF("merged %lX into MSHR %d\n", p->addr, m);
+        p->mshr = m;
+        cc->mshrMerges++;
+        releaseReservation(cc, q);
+        return;
+    }
+    if (wbufCount > 0 && p->requestType != PERM) {
+        wbufTake(cc, p);
+        dequeuePendingRequest(q);
+        return;
+    }
+
+    bool done;
+    if (p->requestType == PERM) {
+        done = coherComp->permReq(p->isLoad, p->addr, cc->procNum);
+    } else {
+        // no flush means no callback
+        cc->releases++;
+        done = !coherComp->invlReq(p->addr, cc->procNum);
+        if (!done) {
+            cc->flushes++;
+            p->startedAt = iteration;
+        }
+    }
+    if (done) {
+        dequeuePendingRequest(q);
+        return;
+    }
+
+    // A tag hit that coherence turned into a miss is already on its way,
+    // so it takes an MSHR even if none is free.
+    p->mshr = allocMSHR(cc, p);
+    DPRINTF("%lX waits on MSHR %d\n", p->addr, p->mshr);
+    releaseReservation(cc, q);
+}
+
+// ends MSHR m, completing every access waiting on it
+void completeMSHR(core_cache *cc, int m) {
+    for (memRequest *q = cc->memReqQueue.head; q != NULL; q = q->next) {
+        if (q->head != NULL && q->head->isStarted && q->head->mshr == m) {
+            if (q->head->requestType == INV) {
+                cc->flushTicks += iteration - q->head->startedAt;
+            }
+            dequeuePendingRequest(q);
+        }
+    }
+    cc->mshrs[m].valid = false;
+    cc->mshrsInUse--;
+}
+
+// Non-blocking equivalent of advanceQueue.  Requests complete in any order,
+// and every request's next access is started if it can be.
+void advanceQueueNonBlocking(core_cache *cc) {
+    memRequest *prev = NULL;
+    memRequest *q = cc->memReqQueue.head;
+    while (q != NULL) {
+        memRequest *next = q->next;
+        if (q->head == NULL) {
+            releaseReservation(cc, q);
+            if (q->memCallback != NULL) {
+                q->memCallback(cc->procNum, q->requestTag);
+            }
+            if (prev == NULL) {
+                cc->memReqQueue.head = next;
+            } else {
+                prev->next = next;
+            }
+            pool_free(&memRequestPool, q);
+        } else {
+            prev = q;
+        }
+        q = next;
+    }
+    cc->memReqQueue.tail = prev;
+
+    for (q = cc->memReqQueue.head; q != NULL; q = q->next) {
+        if (!q->head->isStarted && accessReady(cc, q)) {
+            startAccess(cc, q);
+        }
+    }
+
+    if (cc->mshrsInUse >= mshrCount) {
+        cc->mshrFullTicks++;
+    }
+}
+
+// the line holding addr in the main or victim cache, without touching it
+cache_line *findLine(core_cache *cc, unsigned long addr) {
+    if (indexFn == INDEX_SKEW) {
+        for (unsigned long way = 0; way < E; way++) {
+            cache_line *line = (cache_line *)set_store_find(
+                                   cc->main_cache, skewIndex(addr >> b, way)) +
+                               way;
+            if (line->valid_bit && line->tag == addr >> b) {
+                return line;
+            }
+        }
+        return NULL;
+    }
+    unsigned long addr_tag;
+    unsigned long addr_set_index = setIndex(addr, &addr_tag);
+    cache_line *set = set_store_find(cc->main_cache, addr_set_index);
+    unsigned long line_index = lookup->find_tag(set, E, addr_tag);
+    if (line_index < E) {
+        return &set[line_index];
+    }
+    if (victim_i > 0) {
+        line_index = lookup->find_tag(cc->victim_cache, victim_i, addr >> b);
+        if (line_index < victim_i) {
+            return &cc->victim_cache[line_index];
+        }
+    }
+    return NULL;
+}
+
+bool linePresent(core_cache *cc, unsigned long addr) {
+    return findLine(cc, addr) != NULL;
+}
+
+// the line holding addr in lv, and its index, set_index * E + way
+cache_line *levelFind(cache_level *lv, unsigned long addr, unsigned long *index) {
+    unsigned long set_index = (addr >> b) & (lv->S - 1);
+    cache_line *set = set_store_find(lv->lines, set_index);
+    unsigned long way = lookup->find_tag(set, lv->E, addr >> (lv->s + b));
+    if (way == lv->E) {
+        return NULL;
+    }
+    *index = set_index * lv->E + way;
+    return &set[way];
+}
+
+// the cores the shared level's line at index is held for
+uint64_t *levelSharers(cache_level *lv, unsigned long index) {
+    cache_line *set = set_store_find(lv->lines, index / lv->E);
+    return (uint64_t *)(set + lv->E) + index % lv->E;
+}
+
+// looks addr up in lv for cc, updating it on a hit as L1 would
+bool levelLookup(cache_level *lv, core_cache *cc, unsigned long addr,
+                 unsigned long pc) {
+    unsigned long index;
+    cache_line *line = levelFind(lv, addr, &index);
+    if (line == NULL) {
+        lv->misses++;
+        return false;
+    }
+
+    lv->hits++;
+    line->LRU_counter = iteration;
+    unsigned long set_index = index / lv->E;
+    lv->policy->ops->hit(lv->policy, line - index % lv->E, set_index,
+                         index % lv->E, pc);
+    if (lv->shared) {
+        *levelSharers(lv, index) |= 1UL << cc->procNum;
+    }
+    return true;
+}
+
+// Puts addr in lv, held for the cores in sharers.  Returns whether another
+// line had to make room, setting its address and sharers.
+bool levelInsert(cache_level *lv, unsigned long addr, unsigned long pc,
+                 uint64_t sharers, unsigned long *evict_addr,
+                 uint64_t *evict_sharers) {
+    unsigned long index;
+    if (levelFind(lv, addr, &index) != NULL) {
+        if (lv->shared) *levelSharers(lv, index) |= sharers;
+        return false;
+    }
+
+    unsigned long set_index = (addr >> b) & (lv->S - 1);
+    cache_line *set = set_store_get(lv->lines, set_index);
+    unsigned long way = lookup->find_invalid(set, lv->E);
+    bool evicted = way == lv->E;
+    if (evicted) {
+        way = lv->policy->ops->victim(lv->policy, set, set_index);
+        *evict_addr = (set[way].tag << (lv->s + b)) | (set_index << b);
+        *evict_sharers =
+            lv->shared ? *levelSharers(lv, set_index * lv->E + way) : 0;
+    }
+
+    set[way].valid_bit = true;
+    set[way].dirty_bit = false;
+    set[way].tag = addr >> (lv->s + b);
+    set[way].LRU_counter = iteration;
+    lv->policy->ops->fill(lv->policy, set, set_index, way, pc);
+    if (lv->shared) {
+        *levelSharers(lv, set_index * lv->E + way) = sharers;
+    }
+    return evicted;
+}
+
+// takes addr out of lv, setting the cores it was held for
+bool levelRemove(cache_level *lv, unsigned long addr, uint64_t *sharers) {
+    unsigned long index;
+    cache_line *line = levelFind(lv, addr, &index);
+    if (line == NULL) {
+        return false;
+    }
+    line->valid_bit = false;
+    *sharers = lv->shared ? *levelSharers(lv, index) : 0;
+    return true;
+}
+
+// the levels past cc's L1, innermost first
+int outerLevels(core_cache *cc, cache_level **levels) {
+    int n = 0;
+    if (cc->l2 != NULL) levels[n++] = cc->l2;
+    if (llc != NULL) levels[n++] = llc;
+    return n;
+}
+
+// whether any of cc's levels hold addr for it
+bool holdsLine(core_cache *cc, unsigned long addr) {
+    unsigned long index;
+    if (linePresent(cc, addr)) {
+        return true;
+    }
+    if (cc->l2 != NULL && levelFind(cc->l2, addr, &index) != NULL) {
+        return true;
+    }
+    return llc != NULL && levelFind(llc, addr, &index) != NULL &&
+           ((*levelSharers(llc, index) >> cc->procNum) & 1);
+}
+
+// addr left one of cc's levels.  Once none of them hold it, coherence is
+// told, after whatever cc has already queued.  memReq is the request cc is
+// making, or NULL if another core's request pushed the line out.
+void releaseLine(core_cache *cc, memRequest *memReq, unsigned long addr) {
+    if ((cc->l2 != NULL || llc != NULL) && holdsLine(cc, addr)) {
+        return;
+    }
+    if (memReq == NULL) {
+        memReq = enqueueMemRequest(cc, NULL, 0);
+    }
+    DPRINTF("core %d releases %lX\n", cc->procNum, addr);
+    enqueuePendingRequest(memReq, addr, false, INV, MISS_EVICT);
+}
+
+// INCLUSIVE - addr left lv, so it leaves dc's levels inside lv as well.
+// Returns whether any of them had it.
+bool backInvalidate(core_cache *dc, cache_level *lv, unsigned long addr) {
+    bool found = false;
+    cache_line *line = findLine(dc, addr);
+    if (line != NULL) {
+        line->valid_bit = false;
+        line->dirty_bit = false;
+        found = true;
+    }
+    uint64_t sharers;
+    if (lv == llc && dc->l2 != NULL && levelRemove(dc->l2, addr, &sharers)) {
+        found = true;
+    }
+    if (found) {
+        backInvalidations++;
+    }
+    return found;
+}
+
+void levelEvicted(core_cache *cc, memRequest *memReq, cache_level *lv,
+                  unsigned long addr, uint64_t sharers);
+
+// EXCLUSIVE - addr was pushed out of the level inside lv, so it moves to lv
+void demoteLine(core_cache *cc, memRequest *memReq, cache_level *lv,
+                unsigned long addr, uint64_t sharers) {
+    unsigned long evict_addr;
+    uint64_t evict_sharers;
+    if (levelInsert(lv, addr, 0, sharers, &evict_addr, &evict_sharers)) {
+        levelEvicted(cc, memReq, lv, evict_addr, evict_sharers);
+    }
+}
+
+// addr was pushed out of lv by cc's request.  For the LLC, sharers are the
+// cores it was held for.
+void levelEvicted(core_cache *cc, memRequest *memReq, cache_level *lv,
+                  unsigned long addr, uint64_t sharers) {
+    DPRINTF("%s evicted %lX\n", lv->name, addr);
+    if (lv != llc) {
+        if (inclusionPolicy == EXCLUSIVE && llc != NULL) {
+            demoteLine(cc, memReq, llc, addr, 1UL << cc->procNum);
+            return;
+        }
+        if (inclusionPolicy == INCLUSIVE) {
+            backInvalidate(cc, lv, addr);
+        }
+        releaseLine(cc, memReq, addr);
+        return;
+    }
+
+    for (int i = 0; i < processorCount; i++) {
+        core_cache *dc = &caches[i];
+        bool held = (sharers >> i) & 1;
+        if (inclusionPolicy == INCLUSIVE && backInvalidate(dc, lv, addr)) {
+            held = true;
+        }
+        if (held) {
+            releaseLine(dc, dc == cc ? memReq : NULL, addr);
+        }
+    }
+}
+
+// After L1 missed addr for cc, looks for it in the levels past L1 and moves
+// it between them as the inclusion policy says.  Returns the first tick the
+// access can go on to coherence.
+unsigned long outerMiss(core_cache *cc, memRequest *memReq, unsigned long addr,
+                        unsigned long pc) {
+    cache_level *levels[2];
+    int n = outerLevels(cc, levels);
+    unsigned long latency = 0;
+    int hit = n;
+    for (int i = 0; i < n; i++) {
+        latency += levels[i]->latency;
+        if (levelLookup(levels[i], cc, addr, pc)) {
+            hit = i;
+            break;
+        }
+    }
+
+    if (inclusionPolicy == EXCLUSIVE) {
+        // the line moves to L1, out of reach of any other core
+        uint64_t sharers;
+        if (hit < n && levelRemove(levels[hit], addr, &sharers)) {
+            for (int i = 0; i < processorCount; i++) {
+                if (i != cc->procNum && ((sharers >> i) & 1)) {
+                    releaseLine(&caches[i], NULL, addr);
+                }
+            }
+        }
+    } else {
+        for (int i = 0; i < hit; i++) {
+            unsigned long evict_addr;
+            uint64_t evict_sharers;
+            if (levelInsert(levels[i], addr, pc, 1UL << cc->procNum,
+                            &evict_addr, &evict_sharers)) {
+                levelEvicted(cc, memReq, levels[i], evict_addr, evict_sharers);
+            }
+        }
+    }
+    return iteration + 1 + latency;
+}
+
+// L1 gave up addr while making cc's request
+void l1Evicted(core_cache *cc, memRequest *memReq, unsigned long addr) {
+    cache_level *levels[2];
+    if (inclusionPolicy == EXCLUSIVE && outerLevels(cc, levels) > 0) {
+        demoteLine(cc, memReq, levels[0], addr, 1UL << cc->procNum);
+    }
+    releaseLine(cc, memReq, addr);
+}
+
+// another core took the line, so our next access to it has to miss
+void invalidateLine(core_cache *cc, unsigned long addr) {
+    addr &= ~(B - 1);
+    recordStream(cc, addr, MISS_INVALIDATE);
+    cache_line *line = findLine(cc, addr);
+    if (line != NULL) {
+        DPRINTF("core %d invalidated %lX\n", cc->procNum, addr);
+        line->valid_bit = 0;
+        line->dirty_bit = 0;
+    }
+
+    unsigned long index;
+    uint64_t sharers;
+    if (cc->l2 != NULL) {
+        levelRemove(cc->l2, addr, &sharers);
+    }
+    if (llc != NULL && levelFind(llc, addr, &index) != NULL) {
+        *levelSharers(llc, index) &= ~(1UL << cc->procNum);
+    }
+}
+
+// Prefetching (-f).  Each core's prefetcher is trained on its demand
+// accesses, and the blocks it suggests are fetched by requests of their own:
+// a load miss into L1 with no callback, going to coherence through permReq
+// like any other.  They have low priority, so a core only issues one while
+// none of its demand accesses are waiting to start (in non-blocking mode,
+// into an MSHR nothing else has a claim on, and never the last free one),
+// and at most one a tick.
+//
+//   Accuracy is the share of prefetches that were hit before being evicted,
+// coverage the share of would-be misses they turned into hits, and a hit is
+// late if it found the prefetch still waiting on coherence.
+
+// whether a prefetch of addr is still waiting on coherence
+bool prefetchInFlight(core_cache *cc, unsigned long addr) {
+    for (memRequest *q = cc->memReqQueue.head; q != NULL; q = q->next) {
+        if (q->prefetch && q->tail != NULL && q->tail->addr == addr) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Counts a demand access to addr, now in L1, that res says hit or missed.
+// Returns whether the prefetcher should treat it as a miss.
+bool prefetchUsed(core_cache *cc, unsigned long addr, int res) {
+    cache_line *line = findLine(cc, addr);
+    if (res != 0) {
+        // misses that bypassed L1 or wrote around it left no line
+        if (line != NULL) line->prefetched = 0;
+        return true;
+    }
+    if (!line->prefetched) {
+        return false;
+    }
+    line->prefetched = 0;
+    cc->prefetchHits++;
+    if (prefetchInFlight(cc, addr)) {
+        cc->latePrefetches++;
+    }
+    return true;
+}
+
+bool prefetchReady(core_cache *cc) {
+    if (cc->prefetcher == NULL || cc->prefetcher->queue_count == 0) {
+        return false;
+    }
+    if (mshrCount == 0) {
+        return cc->memReqQueue.head == NULL;
+    }
+    // the last MSHR is left to demand accesses, since a prefetch can hold
+    // its MSHR while a writeback waits on the interconnect, and a processor
+    // with all its accesses refused would see itself as finished
+    if (cc->mshrsInUse + cc->mshrsReserved + 1 >= mshrCount) {
+        return false;
+    }
+    for (memRequest *q = cc->memReqQueue.head; q != NULL; q = q->next) {
+        if (q->head != NULL && !q->head->isStarted) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// issues cc's oldest prefetch candidate that L1 does not already hold
+void issuePrefetch(core_cache *cc) {
+    unsigned long addr;
+    while (prefetcher_next(cc->prefetcher, &addr)) {
+        if (linePresent(cc, addr)) {
+            continue;
+        }
+
+        memRequest *memReq = enqueueMemRequest(cc, NULL, 0);
+        memReq->prefetch = true;
+        unsigned long evict_addr;
+        int res = cc->deadblock != NULL
+                      ? predictedAccess(cc, addr, 0, &evict_addr, false, false)
+                      : load(cc, addr, 0, &evict_addr);
+        findLine(cc, addr)->prefetched = 1;
+        DPRINTF("core %d prefetches %lX\n", cc->procNum, addr);
+
+        unsigned long readyAt = outerMiss(cc, memReq, addr, 0);
+        if (res == 2) {
+            l1Evicted(cc, memReq, evict_addr);
+        }
+        enqueuePendingRequest(memReq, addr, true, PERM,
+                              res == 2 ? MISS_EVICT : MISS)->readyAt = readyAt;
+        if (mshrCount > 0) {
+            memReq->reserved = true;
+            cc->mshrsReserved++;
+        }
+        cc->prefetches++;
+        return;
+    }
+}
+
+// Hits are always taken, misses only while an MSHR is left for them.
+int memoryRequestReady(trace_op *op, int processorNum) {
+    core_cache *cc = &caches[processorNum];
+    if (mshrCount == 0) {
+        // Blocking, one demand request at a time.  It waits behind any
+        // prefetch or release queued ahead of it, since a processor with
+        // nothing in flight would otherwise see itself as finished.
+        for (memRequest *q = cc->memReqQueue.head; q != NULL; q = q->next) {
+            if (q->memCallback != NULL) return MEM_ONE_AT_A_TIME;
+        }
+        return 1;
+    }
+
+    if (cc->mshrsInUse + cc->mshrsReserved < mshrCount) {
+        return 1;
+    }
+    uint64_t first = op->memAddress & ~(B - 1);
+    uint64_t last = (op->memAddress + op->size - 1) & ~(B - 1);
+    return s > 0 && linePresent(cc, first) && linePresent(cc, last);
+}
+
+// This routine is a linkage to the rest of the memory hierarchy
+void coherCallback(int type, int procNum, int64_t addr) {
+    core_cache *cc = &caches[procNum];
+    if (type == INVALIDATE) {
+        invalidateLine(cc, addr);
+        return;
+    }
+    if (type == NO_ACTION && wbufCount > 0 && wbufFlushed(cc, addr)) {
+        return;
+    }
+
+    if (mshrCount > 0) {
+        // anything not matching an MSHR is snooped traffic
+        int m = findMSHR(cc, addr);
+        if (m == -1) return;
+        if ((type == DATA_RECV && cc->mshrs[m].requestType == PERM) ||
+            (type == NO_ACTION && cc->mshrs[m].requestType == INV)) {
+            completeMSHR(cc, m);
+        }
+        return;
+    }
+
+    memRequest *q = cc->memReqQueue.head;
+    switch (type) {
+    case NO_ACTION:
+        // also sent when we only snooped another core's request
+        if (q == NULL || q->head == NULL || !q->head->isStarted ||
+            q->head->requestType != INV || q->head->addr != addr) {
+            break;
+        }
+        DPRINTF("** received inv callback\n");
+        cc->flushTicks += iteration - q->head->startedAt;
+        // dq current invreq
+        dequeuePendingRequest(q);
+        startNextAccess(cc);
+        break;
+    case DATA_RECV:
+        // This indicates that the cache has received data from memory
+
+        // check that the addr is the pending access
+        assert(q != NULL && addr == q->head->addr);
+        dequeuePendingRequest(q);
+        break;
+
+    default:
+        break;
+    }
+}
+
+// a demand access to the block at addr, before L1 sees it
+void demandAccess(core_cache *cc, uint64_t addr) {
+    if (cc->mrc != NULL) {
+        mrc_access(cc->mrc, addr >> b);
+    }
+    if (cc->future != NULL) {
+        future_advance(cc->future, addr >> b);
+    }
+    if (recordFile != NULL) {
+        future_record(recordFile, cc->procNum, addr >> b);
+    }
+}
+
+// A miss that left addr out of L1 wrote around it or bypassed it, so once
+// done, the line is given up like one L1 evicted.
+void missBypassed(core_cache *cc, memRequest *memReq, unsigned long addr) {
+    if ((writeAround || cc->deadblock != NULL) && !linePresent(cc, addr)) {
+        l1Evicted(cc, memReq, addr);
+    }
+}
+
+void countResult(core_cache *cc, int res) {
+    if (res == 0) {
+        cc->hits++;
+    } else {
+        cc->misses++;
+        if (res == 2) cc->evictions++;
     }
 }
 
-
 void memoryRequest(trace_op *op, int processorNum, int64_t tag,
                    void (*callback)(int, int64_t)) {
     assert(op != NULL);
@@ -535,14 +2196,14 @@ void memoryRequest(trace_op *op, int processorNum, int64_t tag,
     //     assert(pending.memCallback != NULL);
     //     pending.memCallback(pending.procNum, pending.tag);
     // }
-    memRequest *memReq = enqueueMemRequest(callback, tag);
-    assert(memReqQueue.head != NULL && memReqQueue.tail != NULL);
+    core_cache *cc = &caches[processorNum];
+    memRequest *memReq = enqueueMemRequest(cc, callback, tag);
+    assert(cc->memReqQueue.head != NULL && cc->memReqQueue.tail != NULL);
     assert(memReq->head == NULL && memReq->tail == NULL);
 
     // In a real cache simulator, the delay is based
     // on whether the request is a hit or miss.
     // globalTag = tag;
-    procNum = processorNum;
     // memCallback = callback;
 
     int res1, res2 = 0;
@@ -554,54 +2215,89 @@ void memoryRequest(trace_op *op, int processorNum, int64_t tag,
         // load first address
         ;
         uint64_t addr = op->memAddress & ~(B - 1);
-        res1 = op->op == MEM_LOAD ? load(addr, &evict_addr)
-                                  : store(addr, &evict_addr);
+        demandAccess(cc, addr);
+        res1 = op->op == MEM_LOAD ? load(cc, addr, op->pcAddress, &evict_addr)
+                                  : store(cc, addr, op->pcAddress, &evict_addr);
+        countResult(cc, res1);
         if (res1 == 1) {
             // just miss
             DPRINTF("miss, enqueued %lX\n", addr);
-            enqueuePendingRequest(memReq, addr, op->op == MEM_LOAD, PERM, MISS);
+            unsigned long readyAt = outerMiss(cc, memReq, addr, op->pcAddress);
+            enqueuePendingRequest(memReq, addr, op->op == MEM_LOAD, PERM, MISS)
+                ->readyAt = readyAt;
+            missBypassed(cc, memReq, addr);
         } else if (res1 == 2) {
             // miss and evict
             DPRINTF("miss, enqueued %lX, evicting %lX\n", addr, evict_addr);
 
-            enqueuePendingRequest(memReq, evict_addr, op->op == MEM_LOAD, INV, MISS_EVICT);
-            enqueuePendingRequest(memReq, addr, op->op == MEM_LOAD, PERM, MISS_EVICT);
+            unsigned long readyAt = outerMiss(cc, memReq, addr, op->pcAddress);
+            l1Evicted(cc, memReq, evict_addr);
+            enqueuePendingRequest(memReq, addr, op->op == MEM_LOAD, PERM, MISS_EVICT)
+                ->readyAt = readyAt;
         } else if (res1 == 0) {
             DPRINTF("hit, enqueued %lX\n", addr);
             enqueuePendingRequest(memReq, addr, op->op == MEM_LOAD, PERM, HIT);
         } else {
             assert(false);
         }
+        if (writeThrough && op->op == MEM_STORE) {
+            enqueuePendingRequest(memReq, addr, false, WRITE, HIT);
+        }
+
+        if (cc->prefetcher != NULL) {
+            bool miss = prefetchUsed(cc, addr, res1);
+            cc->prefetcher->ops->train(cc->prefetcher, op->memAddress,
+                                       op->pcAddress, miss);
+        }
 
         // check if access crosses line boundary
         if (op->memAddress % B + op->size > B) {
             // access spans two lines, load the next address as well
             uint64_t next_addr = (op->memAddress + B) & ~(B - 1);
+            demandAccess(cc, next_addr);
             // if s==0, just send perm request, but don't do anything in the cache because yes...
             if (s == 0) {
                 DPRINTF("second req, enqueued %lX\n", next_addr);
                 enqueuePendingRequest(memReq, next_addr, op->op == MEM_LOAD, PERM, NA);
+                if (writeThrough && op->op == MEM_STORE) {
+                    enqueuePendingRequest(memReq, next_addr, false, WRITE, HIT);
+                }
                 break;
             }
             
-            res2 = op->op == MEM_LOAD ? load(next_addr, &evict_addr)
-                                      : store(next_addr, &evict_addr);
+            res2 = op->op == MEM_LOAD
+                       ? load(cc, next_addr, op->pcAddress, &evict_addr)
+                       : store(cc, next_addr, op->pcAddress, &evict_addr);
+            countResult(cc, res2);
             if (res2 == 1) {
                 // just miss
                 DPRINTF("second miss, enqueued %lX\n", next_addr);
-                enqueuePendingRequest(memReq, next_addr, op->op == MEM_LOAD, PERM, MISS);
+                unsigned long readyAt =
+                    outerMiss(cc, memReq, next_addr, op->pcAddress);
+                enqueuePendingRequest(memReq, next_addr, op->op == MEM_LOAD, PERM, MISS)
+                    ->readyAt = readyAt;
+                missBypassed(cc, memReq, next_addr);
             } else if (res2 == 2) {
                 // miss and evict
                 DPRINTF("second miss, enqueued %lX, evicting %lX\n", next_addr, evict_addr);
 
-                enqueuePendingRequest(memReq, evict_addr, op->op == MEM_LOAD, INV, MISS_EVICT);
-                enqueuePendingRequest(memReq, next_addr, op->op == MEM_LOAD, PERM, MISS_EVICT);
+                unsigned long readyAt =
+                    outerMiss(cc, memReq, next_addr, op->pcAddress);
+                l1Evicted(cc, memReq, evict_addr);
+                enqueuePendingRequest(memReq, next_addr, op->op == MEM_LOAD, PERM, MISS_EVICT)
+                    ->readyAt = readyAt;
             } else if (res2 == 0) {
                 DPRINTF("second hit, enqueued %lX\n", next_addr);
                 enqueuePendingRequest(memReq, next_addr, op->op == MEM_LOAD, PERM, HIT);
             } else {
                 assert(false);
             }
+            if (writeThrough && op->op == MEM_STORE) {
+                enqueuePendingRequest(memReq, next_addr, false, WRITE, HIT);
+            }
+            if (cc->prefetcher != NULL) {
+                prefetchUsed(cc, next_addr, res2);
+            }
         }
         break;
     case NONE:
@@ -612,24 +2308,36 @@ void memoryRequest(trace_op *op, int processorNum, int64_t tag,
         assert(false);
         break;
     }
+
+    // hold back an MSHR for the request's misses, if it has any
+    if (mshrCount > 0) {
+        for (pendingRequest *p = memReq->head; p != NULL; p = p->next) {
+            if (p->cacheResult != HIT) {
+                memReq->reserved = true;
+                cc->mshrsReserved++;
+                break;
+            }
+        }
+    }
 }
 
-void advanceQueue() {
-    memRequest *q = memReqQueue.head;
+void advanceQueue(core_cache *cc) {
+    memRequest *q = cc->memReqQueue.head;
     if (q == NULL) {
         return;
     }
     // if queue is empty, see if callback is necessary
     if (q->head == NULL) {
+        // requests only giving up lines for the levels past L1 have none
         if (q->memCallback != NULL) {
             // printf("cache called mem callback\n");
-            q->memCallback(procNum, q->requestTag);
-            memReqQueue.head = q->next; // moves on to the next memory request
-            free(q);
+            q->memCallback(cc->procNum, q->requestTag);
         }
+        cc->memReqQueue.head = q->next; // moves on to the next memory request
+        pool_free(&memRequestPool, q);
     }
-    else if (!q->head->isStarted) {
-        q->head->requestType == INV ? handleInvReq() : handlePermReq();
+    else {
+        startNextAccess(cc);
     }
 }
 
@@ -640,21 +2348,244 @@ int tick() {
     // Advance ticks in the coherence component.
     coherComp->si.tick();
 
-    advanceQueue();
+    for (int i = 0; i < processorCount; i++) {
+        core_cache *cc = &caches[i];
+        if (wbufCount > 0) {
+            wbufDrain(cc);
+            cc->wbufWaiting = false;
+        }
+        if (mshrCount > 0) {
+            advanceQueueNonBlocking(cc);
+        } else {
+            advanceQueue(cc);
+        }
+        if (cc->wbufWaiting) {
+            cc->wbufStallTicks++;
+        }
+        if (prefetchReady(cc)) {
+            issuePrefetch(cc);
+        }
+    }
 
     return 1;
 }
 
-int finish(int outFd) { return 0; }
+// ticks until q's next access can start, or INT64_MAX if it waits on
+// something other than time
+int64_t requestNextTick(core_cache *cc, memRequest *q) {
+    if (q->head == NULL) {
+        return 1;
+    }
+    if (q->head->isStarted) {
+        return INT64_MAX;
+    }
+    if (q->head->readyAt > iteration) {
+        return q->head->readyAt - iteration;
+    }
+    if (mshrCount == 0) {
+        return wbufCount > 0 && wbufBlocks(cc, q->head) ? INT64_MAX : 1;
+    }
+    return accessReady(cc, q) ? 1 : INT64_MAX;
+}
+
+// Without MSHRs only the head request is ever worked on; once its pending
+// access has been started, nothing happens here until coherence calls back.
+int64_t coreNextTick(core_cache *cc) {
+    if (prefetchReady(cc)) {
+        return 1;
+    }
+    memRequest *q = cc->memReqQueue.head;
+    int64_t next = wbufCount > 0 ? wbufNextTick(cc) : INT64_MAX;
+    if (mshrCount == 0) {
+        int64_t n = q == NULL ? INT64_MAX : requestNextTick(cc, q);
+        return n < next ? n : next;
+    }
+
+    for (; q != NULL; q = q->next) {
+        int64_t n = requestNextTick(cc, q);
+        if (n < next) next = n;
+    }
+    return next;
+}
+
+int64_t nextTick(void) {
+    int64_t next = INT64_MAX;
+    for (int i = 0; i < processorCount; i++) {
+        int64_t n = coreNextTick(&caches[i]);
+        if (n < next) next = n;
+    }
+    return next;
+}
+
+void skipTicks(int64_t ticks) {
+    iteration += ticks;
+    for (int i = 0; i < processorCount; i++) {
+        core_cache *cc = &caches[i];
+        if (mshrCount > 0 && cc->mshrsInUse >= mshrCount) {
+            cc->mshrFullTicks += ticks;
+        }
+        if (cc->wbufWaiting) {
+            cc->wbufStallTicks += ticks;
+        }
+    }
+}
+
+static double percent(uint64_t part, uint64_t whole) {
+    return whole == 0 ? 0.0 : 100.0 * part / whole;
+}
+
+static void printSets(const char *name, const set_store *st) {
+    printf("    -   %s: %lu of %lu chunks allocated, %zu bytes\n", name,
+           st->chunks_used, st->chunk_count, set_store_bytes(st));
+}
+
+int finish(int outFd) {
+    printf("Cache Summary:\n");
+    for (int i = 0; i < processorCount; i++) {
+        core_cache *cc = &caches[i];
+        printf("    -   Core %d: %lu hits, %lu misses, %lu evictions\n", i,
+               cc->hits, cc->misses, cc->evictions);
+        if (cc->l2 != NULL) {
+            printf("    -   Core %d L2: %lu hits, %lu misses\n", i,
+                   cc->l2->hits, cc->l2->misses);
+        }
+    }
+    if (llc != NULL) {
+        printf("    -   LLC: %lu hits, %lu misses\n", llc->hits, llc->misses);
+    }
+    if (inclusionPolicy == INCLUSIVE) {
+        printf("    -   Back-invalidations: %lu\n", backInvalidations);
+    }
+
+    if (mshrCount > 0) {
+        printf("MSHR Summary:\n");
+        for (int i = 0; i < processorCount; i++) {
+            core_cache *cc = &caches[i];
+            printf("    -   Core %d: %lu allocated, %lu merged, "
+                   "%lu ticks with all in use\n",
+                   i, cc->mshrAllocs, cc->mshrMerges, cc->mshrFullTicks);
+        }
+    }
+
+    if (writePolicySet) {
+        printf("Write Summary:\n");
+        for (int i = 0; i < processorCount; i++) {
+            core_cache *cc = &caches[i];
+            printf("    -   Core %d: %lu releases, %lu written back, "
+                   "%lu ticks writing back\n",
+                   i, cc->releases, cc->flushes, cc->flushTicks);
+            if (wbufCount > 0) {
+                printf("    -   Core %d buffer: %lu writes through "
+                       "(%lu coalesced), %lu of %lu entries at peak, "
+                       "%lu ticks stalled\n",
+                       i, cc->writesThrough, cc->writesCoalesced,
+                       cc->wbufPeak, wbufCount, cc->wbufStallTicks);
+            }
+        }
+    }
+
+    if (caches[0].deadblock != NULL) {
+        printf("Dead Block Summary:\n");
+        for (int i = 0; i < processorCount; i++) {
+            deadblock *db = caches[i].deadblock;
+            printf("    -   Core %d: %lu fills predicted dead, %lu live "
+                   "(%.1f%% and %.1f%% of those resolved correct)\n",
+                   i, db->dead, db->live,
+                   percent(db->deadRight, db->deadRight + db->deadWrong),
+                   percent(db->liveRight, db->liveRight + db->liveWrong));
+        }
+    }
+
+    if (caches[0].mrc != NULL) {
+        printf("Miss Ratio Curves:\n");
+        for (int i = 0; i < processorCount; i++) {
+            mrc *m = caches[i].mrc;
+            printf("    -   Core %d: %lu of %lu accesses sampled, "
+                   "at rate %.6f\n",
+                   i, m->sampled, m->accesses, mrc_rate(m));
+            unsigned int n = mrc_capacities(m);
+            for (unsigned int k = 0; k < n; k++) {
+                double error;
+                double ratio = mrc_miss_ratio(m, k, &error);
+                printf("    -   Core %d: %lu bytes, %.2f%% misses "
+                       "(+/- %.2f%%)\n",
+                       i, (1UL << k) << b, 100.0 * ratio, 100.0 * error);
+            }
+        }
+    }
+
+    if (caches[0].future != NULL) {
+        printf("OPT Summary:\n");
+        for (int i = 0; i < processorCount; i++) {
+            future *f = caches[i].future;
+            printf("    -   Core %d: %lu of %lu recorded accesses made, "
+                   "%lu differing\n",
+                   i, f->cursor, f->count, f->mismatches);
+        }
+    }
+
+    if (caches[0].main_cache->dense == NULL) {
+        printf("Sparse Set Summary:\n");
+        char name[32];
+        for (int i = 0; i < processorCount; i++) {
+            core_cache *cc = &caches[i];
+            snprintf(name, sizeof(name), "Core %d", i);
+            printSets(name, cc->main_cache);
+            if (cc->l2 != NULL) {
+                snprintf(name, sizeof(name), "Core %d L2", i);
+                printSets(name, cc->l2->lines);
+            }
+        }
+        if (llc != NULL) {
+            printSets("LLC", llc->lines);
+        }
+    }
+
+    if (caches[0].prefetcher != NULL) {
+        printf("Prefetch Summary:\n");
+        for (int i = 0; i < processorCount; i++) {
+            core_cache *cc = &caches[i];
+            uint64_t useful = cc->prefetchHits;
+            uint64_t timely = useful - cc->latePrefetches;
+            printf("    -   Core %d: %lu issued, %lu useful, %lu late "
+                   "(%.1f%% accuracy, %.1f%% coverage, %.1f%% timely)\n",
+                   i, cc->prefetches, useful, cc->latePrefetches,
+                   percent(useful, cc->prefetches),
+                   percent(useful, useful + cc->misses),
+                   percent(timely, useful));
+        }
+    }
+    return 0;
+}
 
 int destroy(void) {
     // free any internally allocated memory here
-    // free main cache
-    for (unsigned long i = 0; i < S; i++) {
-        free(main_cache[i]);
+    for (int i = 0; i < processorCount; i++) {
+        core_cache *cc = &caches[i];
+        // free main cache
+        set_store_destroy(cc->main_cache);
+        free(cc->victim_cache);
+        replacement_destroy(cc->policy);
+        destroyLevel(cc->l2);
+        prefetcher_destroy(cc->prefetcher);
+        mrc_destroy(cc->mrc);
+        deadblock_destroy(cc->deadblock);
+        future_destroy(cc->future);
+        free(cc->mshrs);
+        free(cc->wbuf);
+    }
+    free(caches);
+    destroyLevel(llc);
+    DPRINTF("request pools peaked at %lu and %lu nodes\n",
+            memRequestPool.peak, pendingRequestPool.peak);
+    pool_destroy(&memRequestPool);
+    pool_destroy(&pendingRequestPool);
+    if (recordFile != NULL) {
+        fclose(recordFile);
+    }
+    if (missFile != NULL) {
+        fclose(missFile);
     }
-    free(main_cache);
-    free(victim_cache);
 
     return 0;
 }
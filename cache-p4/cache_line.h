@@ -0,0 +1,42 @@
+#ifndef CACHE_LINE_H
+#define CACHE_LINE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Packed into 16 bytes, so four lines share a host cache line.  The LRU
+// timestamp keeps the low 48 bits of iteration, and RRPV limits -R to
+// RRPV_BITS bits.  prefetched marks lines a prefetch brought in that have
+// not been hit yet.
+#define RRPV_BITS 13
+
+typedef struct {
+    unsigned long tag;
+    uint64_t LRU_counter : 48;
+    uint64_t RRPV : RRPV_BITS;
+    uint64_t valid_bit : 1;
+    uint64_t dirty_bit : 1;
+    uint64_t prefetched : 1;
+} cache_line;
+
+// Searches over the n lines of a set.  Each returns the first line that
+// qualifies, or n if none does.
+typedef struct {
+    const char *name;
+    // valid line holding tag
+    unsigned long (*find_tag)(const cache_line *lines, unsigned long n,
+                              unsigned long tag);
+    // line that is not valid
+    unsigned long (*find_invalid)(const cache_line *lines, unsigned long n);
+    // line with the smallest LRU_counter
+    unsigned long (*find_oldest)(const cache_line *lines, unsigned long n);
+    // line with the largest RRPV
+    unsigned long (*find_distant)(const cache_line *lines, unsigned long n);
+} lookup_impl;
+
+// Returns the named implementation ("scalar", "sse2" or "avx2"), or the
+// fastest one this host supports if name is NULL.  Returns NULL if the
+// named one is not supported.
+const lookup_impl *select_lookup(const char *name);
+
+#endif
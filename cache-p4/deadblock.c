@@ -0,0 +1,117 @@
+#include "deadblock.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// signatures index a table of saturating counters, predicting dead at 0
+#define DEADBLOCK_SIGNATURE_BITS 14
+#define DEADBLOCK_COUNTER_MAX 3
+
+// line state
+#define DEADBLOCK_TRACKED 1
+#define DEADBLOCK_DEAD 2 // predicted dead
+#define DEADBLOCK_REUSED 4
+
+deadblock *deadblock_create(const char *name, unsigned long lines,
+                            unsigned long region_bits) {
+    bool by_region = strcmp(name, "region") == 0;
+    if (!by_region && strcmp(name, "pc") != 0) {
+        fprintf(stderr, "Unknown dead block predictor %s\n", name);
+        return NULL;
+    }
+
+    deadblock *db = calloc(1, sizeof(deadblock));
+    if (db == NULL) return NULL;
+    db->by_region = by_region;
+    db->region_bits = region_bits;
+    db->lines = lines;
+    db->signature = calloc(lines, sizeof(uint16_t));
+    db->state = calloc(lines, sizeof(uint8_t));
+    db->counters = malloc(1UL << DEADBLOCK_SIGNATURE_BITS);
+    db->shadow = calloc(lines, sizeof(uint64_t));
+    db->shadow_signature = calloc(lines, sizeof(uint16_t));
+    if (db->signature == NULL || db->state == NULL || db->counters == NULL ||
+        db->shadow == NULL || db->shadow_signature == NULL) {
+        deadblock_destroy(db);
+        return NULL;
+    }
+    // start out weakly predicting reuse
+    memset(db->counters, 1, 1UL << DEADBLOCK_SIGNATURE_BITS);
+    return db;
+}
+
+void deadblock_destroy(deadblock *db) {
+    if (db == NULL) return;
+    free(db->signature);
+    free(db->state);
+    free(db->counters);
+    free(db->shadow);
+    free(db->shadow_signature);
+    free(db);
+}
+
+uint16_t deadblock_signature(const deadblock *db, unsigned long addr,
+                             unsigned long pc) {
+    unsigned long key = db->by_region ? addr >> db->region_bits : pc;
+    key ^= key >> DEADBLOCK_SIGNATURE_BITS;
+    key ^= key >> (2 * DEADBLOCK_SIGNATURE_BITS);
+    return key & ((1UL << DEADBLOCK_SIGNATURE_BITS) - 1);
+}
+
+static void train(deadblock *db, uint16_t signature, bool reused) {
+    uint8_t *counter = &db->counters[signature];
+    if (reused && *counter < DEADBLOCK_COUNTER_MAX) (*counter)++;
+    if (!reused && *counter > 0) (*counter)--;
+}
+
+bool deadblock_predict(deadblock *db, uint64_t block, uint16_t signature) {
+    unsigned long slot = block % db->lines;
+    if (db->shadow[slot] == block + 1) {
+        // bypassed, and wanted again
+        db->deadWrong++;
+        train(db, db->shadow_signature[slot], true);
+        db->shadow[slot] = 0;
+    }
+    return db->counters[signature] == 0;
+}
+
+void deadblock_bypass(deadblock *db, uint64_t block, uint16_t signature) {
+    unsigned long slot = block % db->lines;
+    if (db->shadow[slot] != 0) {
+        // the block it held was never missed on again
+        db->deadRight++;
+    }
+    db->shadow[slot] = block + 1;
+    db->shadow_signature[slot] = signature;
+    db->dead++;
+}
+
+void deadblock_fill(deadblock *db, unsigned long line, uint16_t signature,
+                    bool dead, bool tracked) {
+    db->signature[line] = signature;
+    db->state[line] = 0;
+    if (!tracked) return;
+    db->state[line] = DEADBLOCK_TRACKED | (dead ? DEADBLOCK_DEAD : 0);
+    dead ? db->dead++ : db->live++;
+}
+
+void deadblock_hit(deadblock *db, unsigned long line) {
+    uint8_t *state = &db->state[line];
+    if ((*state & DEADBLOCK_TRACKED) == 0 || (*state & DEADBLOCK_REUSED)) {
+        return;
+    }
+    *state |= DEADBLOCK_REUSED;
+    train(db, db->signature[line], true);
+    (*state & DEADBLOCK_DEAD) ? db->deadWrong++ : db->liveRight++;
+}
+
+void deadblock_evict(deadblock *db, unsigned long line) {
+    uint8_t state = db->state[line];
+    db->state[line] = 0;
+    if ((state & DEADBLOCK_TRACKED) == 0 || (state & DEADBLOCK_REUSED)) {
+        return;
+    }
+    train(db, db->signature[line], false);
+    (state & DEADBLOCK_DEAD) ? db->deadRight++ : db->liveWrong++;
+}
@@ -0,0 +1,62 @@
+#ifndef DEADBLOCK_H
+#define DEADBLOCK_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Dead-block prediction for a core's L1.  Each demand fill gets a
+// signature, from the op's pc or the block's address region, and a table
+// of saturating counters predicts from it whether the line will be hit
+// before it is evicted.  Lines predicted dead bypass L1 or are inserted at
+// the distant end of the replacement order, as the cache chooses.
+//
+//   A signature's counter goes up when one of its lines is first hit, and
+// down when one is evicted without having been hit.  Bypassed blocks never
+// reach a line, so the last one to map to each slot of a shadow table, as
+// many as the cache has lines, is remembered along with its signature; a
+// miss on it while it is still there means the bypass was wrong, and trains
+// the signature back up.
+//
+//   A prediction is resolved once its line is hit or evicted, or its
+// shadow entry is missed on or taken by another bypass.
+typedef struct _deadblock {
+    bool by_region;           // signatures from address regions, else pcs
+    unsigned long region_bits; // log2 of the region size in bytes
+    unsigned long lines;      // sets x ways of the cache
+
+    uint16_t *signature;      // per line
+    uint8_t *state;           // per line, DEADBLOCK_* bits
+    uint8_t *counters;        // per signature
+    uint64_t *shadow;         // bypassed block + 1 per slot, 0 if none
+    uint16_t *shadow_signature;
+
+    // statistics
+    uint64_t dead, deadRight, deadWrong;
+    uint64_t live, liveRight, liveWrong;
+} deadblock;
+
+// Creates a predictor indexed by "pc" or "region" for a cache of lines
+// lines.  Returns NULL if the name is unknown.
+deadblock *deadblock_create(const char *name, unsigned long lines,
+                            unsigned long region_bits);
+void deadblock_destroy(deadblock *db);
+
+uint16_t deadblock_signature(const deadblock *db, unsigned long addr,
+                             unsigned long pc);
+
+// Whether a demand fill of block, with signature, is predicted dead.
+// First resolves block's shadow entry, if the miss is on a bypassed block.
+bool deadblock_predict(deadblock *db, uint64_t block, uint16_t signature);
+
+// block was predicted dead and kept out of the cache
+void deadblock_bypass(deadblock *db, uint64_t block, uint16_t signature);
+
+// line was filled, by a demand access predicted dead or live, or by a
+// prefetch, which is not tracked
+void deadblock_fill(deadblock *db, unsigned long line, uint16_t signature,
+                    bool dead, bool tracked);
+void deadblock_hit(deadblock *db, unsigned long line);
+// line is about to be replaced
+void deadblock_evict(deadblock *db, unsigned long line);
+
+#endif
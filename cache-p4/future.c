@@ -0,0 +1,168 @@
+#include "future.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+//
+// Future accesses for OPT
+//
+//   A backward pass over each core's accesses finds every access's next
+// use, leaving the table holding each block's first access.  Moving forward,
+// the table follows each block's last access, so a block's next use is
+// either that access's next one or, for a block not used yet, its first.
+// Blocks a run fills without the core asking for them, such as prefetches,
+// are looked up the same way.
+//
+
+#define FUTURE_MAGIC "CADSSFUT"
+
+struct future_header {
+    char magic[8];
+    uint32_t block_bits;
+    uint32_t cores;
+};
+
+struct future_entry {
+    uint32_t core;
+    uint32_t unused;
+    uint64_t block;
+};
+
+FILE *future_record_open(const char *path, unsigned long b, int cores) {
+    FILE *fp = fopen(path, "wb");
+    if (fp == NULL) {
+        return NULL;
+    }
+    struct future_header h = {FUTURE_MAGIC, b, cores};
+    if (fwrite(&h, sizeof(h), 1, fp) != 1) {
+        fclose(fp);
+        return NULL;
+    }
+    return fp;
+}
+
+void future_record(FILE *fp, int core, uint64_t block) {
+    struct future_entry e = {core, 0, block};
+    fwrite(&e, sizeof(e), 1, fp);
+}
+
+static unsigned long slot(const future *f, uint64_t block) {
+    unsigned long mask = (1UL << f->table_bits) - 1;
+    unsigned long i = (block * 0x9E3779B97F4A7C15UL) >> (64 - f->table_bits);
+    while (f->values[i] != 0 && f->keys[i] != block) i = (i + 1) & mask;
+    return i;
+}
+
+// finds each access's next use, from the end
+static int index_future(future *f) {
+    f->table_bits = 4;
+    while ((1UL << f->table_bits) < 2 * f->count) f->table_bits++;
+    f->keys = calloc(1UL << f->table_bits, sizeof(uint64_t));
+    f->values = calloc(1UL << f->table_bits, sizeof(uint64_t));
+    f->next = malloc((f->count + 1) * sizeof(uint64_t));
+    if (f->keys == NULL || f->values == NULL || f->next == NULL) {
+        return -1;
+    }
+    for (uint64_t i = f->count; i-- > 0;) {
+        unsigned long j = slot(f, f->blocks[i]);
+        f->next[i] = f->values[j] != 0 ? f->values[j] - 1 : FUTURE_NEVER;
+        f->keys[j] = f->blocks[i];
+        f->values[j] = i + 1;
+    }
+    return 0;
+}
+
+int future_load(const char *path, unsigned long b, int cores,
+                uint64_t window, future **futures) {
+    FILE *fp = fopen(path, "rb");
+    if (fp == NULL) {
+        fprintf(stderr, "Cannot open recorded accesses %s\n", path);
+        return -1;
+    }
+    struct future_header h;
+    if (fread(&h, sizeof(h), 1, fp) != 1 ||
+        memcmp(h.magic, FUTURE_MAGIC, sizeof(h.magic)) != 0) {
+        fprintf(stderr, "%s does not hold recorded accesses\n", path);
+        fclose(fp);
+        return -1;
+    }
+    if (h.block_bits != b || h.cores != (uint32_t)cores) {
+        fprintf(stderr, "%s was recorded with %u block bits and %u cores\n",
+                path, h.block_bits, h.cores);
+        fclose(fp);
+        return -1;
+    }
+
+    // accesses each core's blocks array has room for
+    uint64_t *room = calloc(cores, sizeof(uint64_t));
+    bool ok = room != NULL;
+    for (int i = 0; ok && i < cores; i++) {
+        futures[i] = calloc(1, sizeof(future));
+        ok = futures[i] != NULL;
+        if (ok) futures[i]->window = window;
+    }
+
+    struct future_entry e;
+    while (ok && fread(&e, sizeof(e), 1, fp) == 1) {
+        if (e.core >= (uint32_t)cores) {
+            ok = false;
+            break;
+        }
+        future *f = futures[e.core];
+        if (f->count == room[e.core]) {
+            room[e.core] = room[e.core] ? 2 * room[e.core] : 1024;
+            uint64_t *blocks = realloc(f->blocks, room[e.core] * sizeof(uint64_t));
+            if (blocks == NULL) {
+                ok = false;
+                break;
+            }
+            f->blocks = blocks;
+        }
+        f->blocks[f->count++] = e.block;
+    }
+    free(room);
+    fclose(fp);
+
+    for (int i = 0; ok && i < cores; i++) {
+        ok = index_future(futures[i]) == 0;
+    }
+    if (!ok) {
+        fprintf(stderr, "Cannot read recorded accesses %s\n", path);
+        return -1;
+    }
+    return 0;
+}
+
+void future_destroy(future *f) {
+    if (f == NULL) return;
+    free(f->blocks);
+    free(f->next);
+    free(f->keys);
+    free(f->values);
+    free(f);
+}
+
+void future_advance(future *f, uint64_t block) {
+    if (f->cursor == f->count) {
+        // past the end of the recording
+        f->mismatches++;
+        return;
+    }
+    uint64_t recorded = f->blocks[f->cursor];
+    if (recorded != block) f->mismatches++;
+    f->values[slot(f, recorded)] = ++f->cursor;
+}
+
+uint64_t future_next_use(const future *f, uint64_t block) {
+    unsigned long i = slot(f, block);
+    if (f->values[i] == 0) return FUTURE_NEVER;
+
+    uint64_t at = f->values[i] - 1;
+    uint64_t next = at < f->cursor ? f->next[at] : at;
+    // the latest access was at cursor - 1
+    if (next == FUTURE_NEVER || next - f->cursor >= f->window) {
+        return FUTURE_NEVER;
+    }
+    return next;
+}
@@ -0,0 +1,46 @@
+#ifndef FUTURE_H
+#define FUTURE_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#define FUTURE_NEVER UINT64_MAX
+
+// One core's demand accesses, recorded by an earlier run (-A), for OPT to
+// look ahead in.  The run being simulated moves through them as the core
+// makes its own, so next uses are as of the core's latest access.
+typedef struct _future {
+    uint64_t *blocks; // recorded accesses, as addr >> b
+    uint64_t *next;   // position of each one's block's next use
+    uint64_t count;
+    uint64_t cursor;  // accesses made so far
+    uint64_t window;  // next uses further ahead than this are not seen
+
+    // block -> position + 1 of its last access before cursor, or of its
+    // first if it has none yet, by open addressing
+    uint64_t *keys, *values;
+    unsigned int table_bits;
+
+    // accesses the run made that were not the recorded one
+    uint64_t mismatches;
+} future;
+
+// Recording.  The file holds a header with the block size and core count,
+// then one (core, block) record per demand access, as cores made them.
+FILE *future_record_open(const char *path, unsigned long b, int cores);
+void future_record(FILE *fp, int core, uint64_t block);
+
+// Reads a file written with the same block size and core count, giving
+// each core its future.  Returns 0, or -1 on errors.
+int future_load(const char *path, unsigned long b, int cores,
+                uint64_t window, future **futures);
+void future_destroy(future *f);
+
+// Moves past the core's next access, which was to block.
+void future_advance(future *f, uint64_t block);
+
+// Position of block's next use after the latest access, or FUTURE_NEVER if
+// there is none within the window.
+uint64_t future_next_use(const future *f, uint64_t block);
+
+#endif
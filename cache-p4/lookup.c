@@ -0,0 +1,287 @@
+#include "cache_line.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+//
+// Set lookups
+//
+//   The scalar versions work on the fields directly.  The vector versions
+// compare several lines per instruction, reading each line as two words:
+// the tag, then the state word holding the bitfields.  On x86-64 the ABI
+// allocates bitfields from the low bit up, which select_lookup checks
+// before handing out a vector version.
+//
+
+#define STATE_LRU_MASK ((1UL << 48) - 1)
+#define STATE_RRPV_SHIFT 48
+#define STATE_RRPV_MASK ((1UL << RRPV_BITS) - 1)
+#define STATE_VALID_BIT (48 + RRPV_BITS)
+#define STATE_VALID (1UL << STATE_VALID_BIT)
+
+static unsigned long scalar_find_tag(const cache_line *lines, unsigned long n,
+                                     unsigned long tag) {
+    for (unsigned long i = 0; i < n; i++) {
+        if (lines[i].tag == tag && lines[i].valid_bit) return i;
+    }
+    return n;
+}
+
+static unsigned long scalar_find_invalid(const cache_line *lines,
+                                         unsigned long n) {
+    for (unsigned long i = 0; i < n; i++) {
+        if (!lines[i].valid_bit) return i;
+    }
+    return n;
+}
+
+static unsigned long scalar_find_oldest(const cache_line *lines,
+                                        unsigned long n) {
+    unsigned long oldest = 0;
+    for (unsigned long i = 1; i < n; i++) {
+        if (lines[i].LRU_counter < lines[oldest].LRU_counter) oldest = i;
+    }
+    return oldest;
+}
+
+static unsigned long scalar_find_distant(const cache_line *lines,
+                                         unsigned long n) {
+    unsigned long distant = 0;
+    for (unsigned long i = 1; i < n; i++) {
+        if (lines[i].RRPV > lines[distant].RRPV) distant = i;
+    }
+    return distant;
+}
+
+static const lookup_impl scalar_lookup = {
+    "scalar", scalar_find_tag, scalar_find_invalid, scalar_find_oldest,
+    scalar_find_distant};
+
+#if defined(__x86_64__)
+
+static inline uint64_t line_state(const cache_line *line) {
+    uint64_t state;
+    memcpy(&state, (const char *)line + sizeof(unsigned long), sizeof(state));
+    return state;
+}
+
+// The vector searches compare a whole chunk of lines, collecting one bit
+//   per compared word, before branching on the result.  This keeps the loop
+//   free of hard to predict exits.  Lines whose tag word matches are then
+//   checked for valid_bit one by one, as a valid match is at most one line.
+
+// First valid line among the candidates, each bit standing for a line's
+//   tag word.  Bits are stride apart, starting from line base.
+static inline unsigned long first_valid(const cache_line *lines,
+                                        unsigned long base, uint64_t found,
+                                        int stride) {
+    while (found) {
+        unsigned long i = base + __builtin_ctzll(found) / stride;
+        if (lines[i].valid_bit) return i;
+        found &= found - 1;
+    }
+    return ~0UL;
+}
+
+//
+// SSE2 - one line per step, as four 32-bit compares.  SSE2 has no 64-bit
+// compares, so a tag matches when both of its halves do, and the victim
+// searches stay scalar.
+//
+#define SSE2_CHUNK 16
+
+static unsigned long sse2_find_tag(const cache_line *lines, unsigned long n,
+                                   unsigned long tag) {
+    const __m128i t = _mm_set1_epi64x(tag);
+    for (unsigned long base = 0; base < n; base += SSE2_CHUNK) {
+        unsigned long end = base + SSE2_CHUNK < n ? base + SSE2_CHUNK : n;
+        uint64_t found = 0;
+        for (unsigned long i = base; i < end; i++) {
+            __m128i v = _mm_loadu_si128((const __m128i *)&lines[i]);
+            found |= (uint64_t)_mm_movemask_ps(
+                         _mm_castsi128_ps(_mm_cmpeq_epi32(v, t)))
+                     << (4 * (i - base));
+        }
+        found &= (found >> 1) & 0x1111111111111111UL;
+        unsigned long i = first_valid(lines, base, found, 4);
+        if (i != ~0UL) return i;
+    }
+    return n;
+}
+
+static unsigned long sse2_find_invalid(const cache_line *lines,
+                                       unsigned long n) {
+    for (unsigned long base = 0; base < n; base += SSE2_CHUNK) {
+        unsigned long end = base + SSE2_CHUNK < n ? base + SSE2_CHUNK : n;
+        uint64_t valid = 0;
+        for (unsigned long i = base; i < end; i++) {
+            // moves valid_bit up to the sign of the state word's high half
+            __m128i v = _mm_loadu_si128((const __m128i *)&lines[i]);
+            valid |= (uint64_t)_mm_movemask_ps(_mm_castsi128_ps(
+                         _mm_slli_epi32(v, 63 - STATE_VALID_BIT)))
+                     << (4 * (i - base));
+        }
+        uint64_t present = 0x8888888888888888UL;
+        if (end - base < SSE2_CHUNK) present &= (1UL << (4 * (end - base))) - 1;
+        uint64_t invalid = ~valid & present;
+        if (invalid) return base + __builtin_ctzll(invalid) / 4;
+    }
+    return n;
+}
+
+static const lookup_impl sse2_lookup = {
+    "sse2", sse2_find_tag, sse2_find_invalid, scalar_find_oldest,
+    scalar_find_distant};
+
+//
+// AVX2 - two lines per step, as four 64-bit compares.
+//
+#define AVX2_CHUNK 32
+
+__attribute__((target("avx2"))) static unsigned long
+avx2_find_tag(const cache_line *lines, unsigned long n, unsigned long tag) {
+    const __m256i t = _mm256_set1_epi64x(tag);
+    unsigned long vector_end = n & ~1UL;
+    for (unsigned long base = 0; base < vector_end; base += AVX2_CHUNK) {
+        unsigned long end = base + AVX2_CHUNK < vector_end ? base + AVX2_CHUNK
+                                                           : vector_end;
+        uint64_t found = 0;
+        for (unsigned long i = base; i < end; i += 2) {
+            __m256i v = _mm256_loadu_si256((const __m256i *)&lines[i]);
+            found |= (uint64_t)_mm256_movemask_pd(
+                         _mm256_castsi256_pd(_mm256_cmpeq_epi64(v, t)))
+                     << (2 * (i - base));
+        }
+        found &= 0x5555555555555555UL;
+        unsigned long i = first_valid(lines, base, found, 2);
+        if (i != ~0UL) return i;
+    }
+    return vector_end + scalar_find_tag(lines + vector_end, n - vector_end, tag);
+}
+
+__attribute__((target("avx2"))) static unsigned long
+avx2_find_invalid(const cache_line *lines, unsigned long n) {
+    unsigned long vector_end = n & ~1UL;
+    for (unsigned long base = 0; base < vector_end; base += AVX2_CHUNK) {
+        unsigned long end = base + AVX2_CHUNK < vector_end ? base + AVX2_CHUNK
+                                                           : vector_end;
+        uint64_t valid = 0;
+        for (unsigned long i = base; i < end; i += 2) {
+            // moves valid_bit up to the sign of the state word
+            __m256i v = _mm256_loadu_si256((const __m256i *)&lines[i]);
+            valid |= (uint64_t)_mm256_movemask_pd(_mm256_castsi256_pd(
+                         _mm256_slli_epi64(v, 63 - STATE_VALID_BIT)))
+                     << (2 * (i - base));
+        }
+        uint64_t present = 0xAAAAAAAAAAAAAAAAUL;
+        if (end - base < AVX2_CHUNK) present &= (1UL << (2 * (end - base))) - 1;
+        uint64_t invalid = ~valid & present;
+        if (invalid) return base + __builtin_ctzll(invalid) / 2;
+    }
+    return vector_end +
+           scalar_find_invalid(lines + vector_end, n - vector_end);
+}
+
+// The search key of lines i and i + 1, in the state word lanes, with the
+//   tag word lanes set to a key no line can have.
+__attribute__((target("avx2"))) static inline __m256i
+avx2_keys(const cache_line *lines, unsigned long i, int shift, __m256i mask,
+          bool invert) {
+    __m256i v = _mm256_loadu_si256((const __m256i *)&lines[i]);
+    __m256i keys = _mm256_and_si256(_mm256_srli_epi64(v, shift), mask);
+    if (invert) keys = _mm256_sub_epi64(mask, keys);
+    return _mm256_blend_epi32(keys, _mm256_set1_epi64x(INT64_MAX), 0x33);
+}
+
+//
+// avx2_find_min
+//
+//   First line with the smallest key, where a line's key is its state
+// shifted right by shift and masked, or mask minus that if invert is set.
+// One pass finds the smallest key, a second finds the first line with it.
+// Keys fit in 48 bits, so the signed compares are safe.
+//
+__attribute__((target("avx2"))) static inline unsigned long
+avx2_find_min(const cache_line *lines, unsigned long n, int shift,
+              uint64_t mask, bool invert) {
+    const __m256i m = _mm256_set1_epi64x(mask);
+    unsigned long vector_end = n & ~1UL;
+    __m256i min = _mm256_set1_epi64x(INT64_MAX);
+    for (unsigned long i = 0; i < vector_end; i += 2) {
+        __m256i keys = avx2_keys(lines, i, shift, m, invert);
+        min = _mm256_blendv_epi8(min, keys, _mm256_cmpgt_epi64(min, keys));
+    }
+
+    uint64_t mins[4];
+    _mm256_storeu_si256((__m256i *)mins, min);
+    uint64_t best = mins[1] < mins[3] ? mins[1] : mins[3];
+    if (vector_end < n) {
+        uint64_t key = (line_state(&lines[vector_end]) >> shift) & mask;
+        if (invert) key = mask - key;
+        if (key < best) return vector_end;
+    }
+
+    const __m256i b = _mm256_set1_epi64x(best);
+    for (unsigned long i = 0;; i += 2) {
+        __m256i keys = avx2_keys(lines, i, shift, m, invert);
+        int found = _mm256_movemask_pd(
+            _mm256_castsi256_pd(_mm256_cmpeq_epi64(keys, b)));
+        if (found) return i + __builtin_ctz(found) / 2;
+    }
+}
+
+// Below this many lines, the two passes cost more than they save.
+#define AVX2_MIN_LINES 32
+
+__attribute__((target("avx2"))) static unsigned long
+avx2_find_oldest(const cache_line *lines, unsigned long n) {
+    if (n < AVX2_MIN_LINES) return scalar_find_oldest(lines, n);
+    return avx2_find_min(lines, n, 0, STATE_LRU_MASK, false);
+}
+
+__attribute__((target("avx2"))) static unsigned long
+avx2_find_distant(const cache_line *lines, unsigned long n) {
+    if (n < AVX2_MIN_LINES) return scalar_find_distant(lines, n);
+    return avx2_find_min(lines, n, STATE_RRPV_SHIFT, STATE_RRPV_MASK, true);
+}
+
+static const lookup_impl avx2_lookup = {
+    "avx2", avx2_find_tag, avx2_find_invalid, avx2_find_oldest,
+    avx2_find_distant};
+
+// Whether the bitfields sit where the vector versions read them.
+static bool state_layout_ok(void) {
+    cache_line line = {0};
+    line.LRU_counter = 0x123456789AUL;
+    line.RRPV = 5;
+    line.valid_bit = 1;
+    return line_state(&line) ==
+           (0x123456789AUL | (5UL << STATE_RRPV_SHIFT) | STATE_VALID);
+}
+
+#endif
+
+const lookup_impl *select_lookup(const char *name) {
+    const lookup_impl *best = &scalar_lookup;
+#if defined(__x86_64__)
+    if (state_layout_ok()) {
+        best = __builtin_cpu_supports("avx2") ? &avx2_lookup : &sse2_lookup;
+    }
+#endif
+
+    if (name == NULL) return best;
+    if (strcmp(name, scalar_lookup.name) == 0) return &scalar_lookup;
+#if defined(__x86_64__)
+    if (best != &scalar_lookup && strcmp(name, sse2_lookup.name) == 0) {
+        return &sse2_lookup;
+    }
+    if (best == &avx2_lookup && strcmp(name, avx2_lookup.name) == 0) {
+        return &avx2_lookup;
+    }
+#endif
+    return NULL;
+}
@@ -0,0 +1,77 @@
+#include "missstream.h"
+
+#include <string.h>
+
+#define MISSSTREAM_MAGIC "CADSSMIS"
+
+struct missstream_header {
+    char magic[8];
+    uint32_t block_bits;
+    uint32_t cores;
+};
+
+// the tick, core and type share a word, from the high bits down
+struct missstream_record {
+    uint64_t block;
+    uint64_t packed;
+};
+
+#define TICK_SHIFT 16
+#define CORE_SHIFT 2
+#define TYPE_MASK 3
+
+FILE *missstream_create(const char *path, unsigned long b, int cores) {
+    if (cores > MISSSTREAM_MAX_CORES) {
+        fprintf(stderr, "Miss streams hold at most %d cores\n",
+                MISSSTREAM_MAX_CORES);
+        return NULL;
+    }
+    FILE *fp = fopen(path, "wb");
+    if (fp == NULL) {
+        return NULL;
+    }
+    struct missstream_header h = {MISSSTREAM_MAGIC, b, cores};
+    if (fwrite(&h, sizeof(h), 1, fp) != 1) {
+        fclose(fp);
+        return NULL;
+    }
+    return fp;
+}
+
+void missstream_write(FILE *fp, const miss_entry *e) {
+    struct missstream_record r = {
+        e->block, (e->tick << TICK_SHIFT) | ((uint64_t)e->core << CORE_SHIFT) |
+                      (uint64_t)e->type};
+    fwrite(&r, sizeof(r), 1, fp);
+}
+
+FILE *missstream_open(const char *path, unsigned long *b, int *cores) {
+    FILE *fp = fopen(path, "rb");
+    if (fp == NULL) {
+        fprintf(stderr, "Cannot open miss stream %s\n", path);
+        return NULL;
+    }
+    struct missstream_header h;
+    if (fread(&h, sizeof(h), 1, fp) != 1 ||
+        memcmp(h.magic, MISSSTREAM_MAGIC, sizeof(h.magic)) != 0 ||
+        h.cores == 0 || h.cores > MISSSTREAM_MAX_CORES || h.block_bits >= 64) {
+        fprintf(stderr, "%s does not hold a miss stream\n", path);
+        fclose(fp);
+        return NULL;
+    }
+    *b = h.block_bits;
+    *cores = h.cores;
+    return fp;
+}
+
+bool missstream_read(FILE *fp, miss_entry *e) {
+    struct missstream_record r;
+    if (fread(&r, sizeof(r), 1, fp) != 1) {
+        return false;
+    }
+    e->block = r.block;
+    e->tick = r.packed >> TICK_SHIFT;
+    e->core = (r.packed >> CORE_SHIFT) & (MISSSTREAM_MAX_CORES - 1);
+    e->type = r.packed & TYPE_MASK;
+    return true;
+}
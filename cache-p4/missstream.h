@@ -0,0 +1,33 @@
+#ifndef MISSSTREAM_H
+#define MISSSTREAM_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// The blocks each core's L1 missed on or wrote back, and those coherence
+// invalidated, as recorded by a run with -m, for cadss-replay to feed into
+// outer levels without rerunning the cores.  The file holds a header with
+// the block size and core count, then a 16 byte record for each, in the
+// order they happened.
+enum MISS_TYPE { MISS_LOAD , MISS_STORE , MISS_WRITEBACK , MISS_INVALIDATE };
+
+#define MISSSTREAM_MAX_CORES (1 << 14)
+
+typedef struct {
+    uint64_t block; // addr >> b
+    uint64_t tick;  // low 48 bits
+    int core;
+    int type;       // MISS_TYPE
+} miss_entry;
+
+FILE *missstream_create(const char *path, unsigned long b, int cores);
+void missstream_write(FILE *fp, const miss_entry *e);
+
+// Opens a recorded stream, setting the block bits and core count it was
+// recorded with.  Returns NULL on errors.
+FILE *missstream_open(const char *path, unsigned long *b, int *cores);
+// Returns false at the end of the stream.
+bool missstream_read(FILE *fp, miss_entry *e);
+
+#endif
@@ -0,0 +1,248 @@
+#include "mrc.h"
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+//
+// SHARDS
+//
+//   Reuse distances among the tracked blocks come from a Fenwick tree over
+// time: a block's distance is the number of tracked blocks used since its
+// own last use.  The tree holds at most max_blocks + 1 live times, and is
+// renumbered from 0 whenever its clock runs out.
+//
+//   Miss ratios are taken over the scaled sample rather than over every
+// access: once the rate has dropped, the accesses sampled at the old rate
+// are weighted for it, and the two only agree on average.  The error bound
+// treats sampled accesses as independent, which they are not quite, as a
+// block's accesses are sampled together.
+//
+
+#define NONE (~0UL)
+#define TWO_64 18446744073709551616.0
+
+static uint64_t mix(uint64_t x) {
+    x ^= x >> 30;
+    x *= 0xBF58476D1CE4E5B9UL;
+    x ^= x >> 27;
+    x *= 0x94D049BB133111EBUL;
+    x ^= x >> 31;
+    return x;
+}
+
+static void fenwick_add(long *tree, unsigned long cap, unsigned long i,
+                        long delta) {
+    for (i++; i <= cap; i += i & -i) tree[i - 1] += delta;
+}
+
+// sum of the first i entries
+static long fenwick_sum(const long *tree, unsigned long i) {
+    long sum = 0;
+    for (; i > 0; i -= i & -i) sum += tree[i - 1];
+    return sum;
+}
+
+// Tracked hashes are all below the threshold, so the table slot comes from
+// mixing the hash again rather than from its top bits.
+static unsigned long home(const mrc *m, unsigned long n) {
+    return (m->hash[n] * 0x9E3779B97F4A7C15UL) >> (64 - m->table_bits);
+}
+
+// number of block, or NONE with slot set to where it would go
+static unsigned long find(const mrc *m, uint64_t block, uint64_t hash,
+                          unsigned long *slot) {
+    unsigned long mask = (1UL << m->table_bits) - 1;
+    unsigned long i = (hash * 0x9E3779B97F4A7C15UL) >> (64 - m->table_bits);
+    for (; m->table[i] != 0; i = (i + 1) & mask) {
+        if (m->block[m->table[i] - 1] == block) return m->table[i] - 1;
+    }
+    *slot = i;
+    return NONE;
+}
+
+// empties a slot, moving later entries of its probe run back into the gap
+static void table_remove(mrc *m, unsigned long n) {
+    unsigned long mask = (1UL << m->table_bits) - 1;
+    unsigned long i = home(m, n);
+    while (m->table[i] != n + 1) i = (i + 1) & mask;
+
+    m->table[i] = 0;
+    for (unsigned long j = (i + 1) & mask; m->table[j] != 0;
+         j = (j + 1) & mask) {
+        unsigned long k = home(m, m->table[j] - 1);
+        // the entry at j stays if its home is cyclically in (i, j]
+        bool stays = i <= j ? (i < k && k <= j) : (i < k || k <= j);
+        if (!stays) {
+            m->table[i] = m->table[j];
+            m->table[j] = 0;
+            i = j;
+        }
+    }
+}
+
+static void heap_push(mrc *m, unsigned long n) {
+    unsigned long i = m->heap_count++;
+    while (i > 0 && m->hash[m->heap[(i - 1) / 2]] < m->hash[n]) {
+        m->heap[i] = m->heap[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    m->heap[i] = n;
+}
+
+static unsigned long heap_pop(mrc *m) {
+    unsigned long top = m->heap[0];
+    unsigned long n = m->heap[--m->heap_count];
+    unsigned long i = 0;
+    for (;;) {
+        unsigned long c = 2 * i + 1;
+        if (c >= m->heap_count) break;
+        if (c + 1 < m->heap_count && m->hash[m->heap[c + 1]] > m->hash[m->heap[c]])
+            c++;
+        if (m->hash[m->heap[c]] <= m->hash[n]) break;
+        m->heap[i] = m->heap[c];
+        i = c;
+    }
+    m->heap[i] = n;
+    return top;
+}
+
+static void compact(mrc *m) {
+    unsigned long time = 0;
+    for (unsigned long i = 0; i < m->clock; i++) {
+        m->tree[i] = 0;
+        if (m->owner[i] == NONE) continue;
+        m->owner[time] = m->owner[i];
+        m->last[m->owner[time]] = time;
+        time++;
+    }
+    for (unsigned long i = m->clock; i < m->cap; i++) m->tree[i] = 0;
+    for (unsigned long i = 0; i < time; i++) fenwick_add(m->tree, m->cap, i, 1);
+    for (unsigned long i = time; i < m->cap; i++) m->owner[i] = NONE;
+    m->clock = time;
+}
+
+static void forget_use(mrc *m, unsigned long n) {
+    fenwick_add(m->tree, m->cap, m->last[n], -1);
+    m->owner[m->last[n]] = NONE;
+    m->live--;
+}
+
+mrc *mrc_create(unsigned long max_blocks, double rate) {
+    mrc *m = calloc(1, sizeof(mrc));
+    if (m == NULL) return NULL;
+    m->max_blocks = max_blocks;
+    m->threshold = rate >= 1.0 ? UINT64_MAX : (uint64_t)(rate * TWO_64);
+
+    // one more than max_blocks is tracked until the heap gives it up
+    unsigned long n = max_blocks + 1;
+    m->table_bits = 1;
+    while ((1UL << m->table_bits) < 2 * n) m->table_bits++;
+    m->cap = 2 * n;
+
+    m->block = calloc(n, sizeof(uint64_t));
+    m->hash = calloc(n, sizeof(uint64_t));
+    m->last = calloc(n, sizeof(unsigned long));
+    m->free_list = calloc(n, sizeof(unsigned long));
+    m->heap = calloc(n, sizeof(unsigned long));
+    m->table = calloc(1UL << m->table_bits, sizeof(unsigned long));
+    m->tree = calloc(m->cap, sizeof(long));
+    m->owner = malloc(m->cap * sizeof(unsigned long));
+    if (m->block == NULL || m->hash == NULL || m->last == NULL ||
+        m->free_list == NULL || m->heap == NULL || m->table == NULL ||
+        m->tree == NULL || m->owner == NULL) {
+        mrc_destroy(m);
+        return NULL;
+    }
+    for (unsigned long i = 0; i < m->cap; i++) m->owner[i] = NONE;
+    return m;
+}
+
+void mrc_destroy(mrc *m) {
+    if (m == NULL) return;
+    free(m->block);
+    free(m->hash);
+    free(m->last);
+    free(m->free_list);
+    free(m->heap);
+    free(m->table);
+    free(m->tree);
+    free(m->owner);
+    free(m);
+}
+
+double mrc_rate(const mrc *m) {
+    return m->threshold / TWO_64;
+}
+
+static unsigned int bucket(double distance) {
+    if (distance < 1.0) return 0;
+    int k = ilogb(distance) + 1;
+    return k < MRC_BUCKETS ? k : MRC_BUCKETS - 1;
+}
+
+void mrc_access(mrc *m, uint64_t block) {
+    m->accesses++;
+    uint64_t hash = mix(block);
+    if (hash >= m->threshold) return;
+    m->sampled++;
+    double scale = 1.0 / mrc_rate(m);
+
+    unsigned long slot;
+    unsigned long n = find(m, block, hash, &slot);
+    if (n != NONE) {
+        unsigned long distance =
+            m->live - fenwick_sum(m->tree, m->last[n] + 1);
+        m->hist[bucket(distance * scale)] += scale;
+        forget_use(m, n);
+    } else {
+        m->cold += scale;
+        n = m->free_count > 0 ? m->free_list[--m->free_count] : m->numbered++;
+        m->block[n] = block;
+        m->hash[n] = hash;
+        m->table[slot] = n + 1;
+        heap_push(m, n);
+    }
+
+    if (m->clock == m->cap) compact(m);
+    m->owner[m->clock] = n;
+    fenwick_add(m->tree, m->cap, m->clock, 1);
+    m->last[n] = m->clock++;
+    m->live++;
+
+    // over budget, so sample less: untrack the highest hash, and only track
+    // blocks below it from now on
+    while (m->heap_count > m->max_blocks) {
+        unsigned long top = heap_pop(m);
+        m->threshold = m->hash[top];
+        forget_use(m, top);
+        table_remove(m, top);
+        m->free_list[m->free_count++] = top;
+    }
+}
+
+unsigned int mrc_capacities(const mrc *m) {
+    unsigned int n = 1;
+    for (unsigned int k = 1; k < MRC_BUCKETS; k++) {
+        if (m->hist[k] > 0) n = k;
+    }
+    return n + 1 < MRC_BUCKETS ? n + 1 : MRC_BUCKETS - 1;
+}
+
+double mrc_miss_ratio(const mrc *m, unsigned int k, double *error) {
+    if (m->sampled == 0) {
+        // nothing to go on
+        *error = m->accesses > 0 ? 1.0 : 0.0;
+        return 0;
+    }
+    // reuses at distance 2^k or more miss
+    double misses = m->cold;
+    for (unsigned int j = k + 1; j < MRC_BUCKETS; j++) misses += m->hist[j];
+    double total = m->cold;
+    for (unsigned int j = 0; j < MRC_BUCKETS; j++) total += m->hist[j];
+    double ratio = misses / total;
+    if (ratio > 1.0) ratio = 1.0;
+
+    *error = 1.96 * sqrt(ratio * (1.0 - ratio) / m->sampled);
+    return ratio;
+}
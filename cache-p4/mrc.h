@@ -0,0 +1,59 @@
+#ifndef MRC_H
+#define MRC_H
+
+#include <stdint.h>
+
+// reuse distances are kept in power of two buckets, up to 2^(MRC_BUCKETS-2)
+#define MRC_BUCKETS 48
+
+// Approximate miss ratio curve of a fully associative LRU cache, from a
+// spatially hashed sample of the blocks accessed (SHARDS).  Blocks hashing
+// below a threshold are tracked, and each access to one stands for 1/rate
+// accesses at 1/rate times its reuse distance among tracked blocks.  When
+// more than max_blocks are tracked, the threshold drops to untrack the
+// highest hashes, so memory stays fixed however long the trace.
+typedef struct _mrc {
+    unsigned long max_blocks;
+    uint64_t threshold;
+
+    // tracked blocks, by number, found through an open addressing table
+    // holding number + 1
+    uint64_t *block;
+    uint64_t *hash;
+    unsigned long *last;     // time of last use
+    unsigned long *free_list;
+    unsigned long free_count, numbered;
+    unsigned long *table;
+    unsigned int table_bits;
+    // tracked block numbers, as a max-heap on hash
+    unsigned long *heap;
+    unsigned long heap_count;
+
+    // Fenwick tree over time, 1 at each tracked block's last use
+    long *tree;
+    unsigned long *owner;    // block last used at each time, or none
+    unsigned long cap, clock, live;
+
+    double hist[MRC_BUCKETS];
+    double cold;
+    uint64_t accesses, sampled;
+} mrc;
+
+mrc *mrc_create(unsigned long max_blocks, double rate);
+void mrc_destroy(mrc *m);
+
+// Records an access to block (an address shifted right by the block bits).
+void mrc_access(mrc *m, uint64_t block);
+
+// Current sampling rate.
+double mrc_rate(const mrc *m);
+
+// Capacities with a result, 2^0 .. 2^(n-1) blocks.  Larger ones only miss
+// on first use.
+unsigned int mrc_capacities(const mrc *m);
+
+// Miss ratio of a cache of 2^k blocks, setting error to the half width of
+// its 95% confidence interval.
+double mrc_miss_ratio(const mrc *m, unsigned int k, double *error);
+
+#endif
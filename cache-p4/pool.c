@@ -0,0 +1,53 @@
+#include "pool.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+void pool_init(pool *p, size_t node_size, unsigned long slab_nodes) {
+    // free nodes hold a pointer, and every node stays aligned for one
+    if (node_size < sizeof(void *)) node_size = sizeof(void *);
+    node_size = (node_size + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+    p->node_size = node_size;
+    p->slab_nodes = slab_nodes > 0 ? slab_nodes : 1;
+    p->free_list = NULL;
+    p->slabs = NULL;
+    p->slab_count = p->slab_room = 0;
+    p->nodes = p->in_use = p->peak = 0;
+}
+
+void pool_destroy(pool *p) {
+    for (unsigned long i = 0; i < p->slab_count; i++) free(p->slabs[i]);
+    free(p->slabs);
+    p->slabs = NULL;
+    p->slab_count = p->slab_room = 0;
+    p->free_list = NULL;
+}
+
+// requests cannot be dropped, and nothing can go on without them
+static void out_of_memory(void) {
+    fprintf(stderr, "Out of host memory for cache requests\n");
+    abort();
+}
+
+void pool_grow(pool *p) {
+    if (p->slab_count == p->slab_room) {
+        unsigned long room = p->slab_room ? 2 * p->slab_room : 8;
+        void **slabs = realloc(p->slabs, room * sizeof(void *));
+        if (slabs == NULL) out_of_memory();
+        p->slabs = slabs;
+        p->slab_room = room;
+    }
+    char *slab = malloc(p->slab_nodes * p->node_size);
+    if (slab == NULL) out_of_memory();
+    p->slabs[p->slab_count++] = slab;
+
+    // thread the nodes onto the free list in address order
+    for (unsigned long i = p->slab_nodes; i-- > 0;) {
+        void *node = slab + i * p->node_size;
+        *(void **)node = p->free_list;
+        p->free_list = node;
+    }
+    p->nodes += p->slab_nodes;
+    // slabs double, so a pool grows in few steps however far it has to
+    p->slab_nodes = p->nodes;
+}
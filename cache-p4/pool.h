@@ -0,0 +1,44 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <stddef.h>
+
+// Nodes of one size, handed out from slabs and kept on a free list when
+// given back, so that once a pool has grown to the most nodes ever in use
+// at once, taking and giving back nodes never reaches malloc.  Slabs are
+// only freed with the pool.
+typedef struct _pool {
+    size_t node_size;
+    unsigned long slab_nodes; // nodes in the next slab
+    void *free_list;          // each free node starts with the next one
+
+    void **slabs;
+    unsigned long slab_count, slab_room;
+
+    // statistics
+    unsigned long nodes, in_use, peak;
+} pool;
+
+// Sets up p for nodes of node_size bytes, starting with a slab of
+// slab_nodes of them once the first is taken.
+void pool_init(pool *p, size_t node_size, unsigned long slab_nodes);
+void pool_destroy(pool *p);
+
+// adds a slab's nodes to the free list
+void pool_grow(pool *p);
+
+static inline void *pool_alloc(pool *p) {
+    if (p->free_list == NULL) pool_grow(p);
+    void *node = p->free_list;
+    p->free_list = *(void **)node;
+    if (++p->in_use > p->peak) p->peak = p->in_use;
+    return node;
+}
+
+static inline void pool_free(pool *p, void *node) {
+    *(void **)node = p->free_list;
+    p->free_list = node;
+    p->in_use--;
+}
+
+#endif
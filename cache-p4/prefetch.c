@@ -0,0 +1,215 @@
+#include "prefetch.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+//
+// Prefetchers
+//
+//   Each one turns the accesses it is trained on into candidate blocks,
+// degree of them per trigger, the first distance blocks past the trigger.
+// The cache drops candidates it already holds.
+//
+
+#define PREFETCH_QUEUE 32
+
+// stream - tracked streams, and how far (in blocks) a miss can be from a
+// stream's last one and still continue it
+#define STREAMS 16
+#define STREAM_WINDOW 16
+#define STREAM_TRAINED 2
+#define STREAM_CONFIDENCE_MAX 3
+
+// stride - reference prediction table, indexed by the op's pc
+#define STRIDE_ENTRIES 256
+#define STRIDE_TRAINED 2
+#define STRIDE_CONFIDENCE_MAX 3
+
+struct stream_entry {
+    bool valid;
+    unsigned long last; // block number
+    long dir;           // +1 or -1 once known, 0 before
+    unsigned int confidence;
+    uint64_t stamp;
+};
+
+struct stride_entry {
+    unsigned long pc;
+    unsigned long last;
+    long stride;
+    unsigned int confidence;
+};
+
+static void push(prefetcher *pf, unsigned long block) {
+    unsigned long addr = block << pf->b;
+    for (unsigned long i = 0; i < pf->queue_count; i++) {
+        if (pf->queue[(pf->queue_head + i) % PREFETCH_QUEUE] == addr) return;
+    }
+    if (pf->queue_count == PREFETCH_QUEUE) {
+        pf->queue_head = (pf->queue_head + 1) % PREFETCH_QUEUE;
+        pf->queue_count--;
+    }
+    pf->queue[(pf->queue_head + pf->queue_count) % PREFETCH_QUEUE] = addr;
+    pf->queue_count++;
+}
+
+// the degree blocks starting distance blocks from block, in direction dir
+static void push_run(prefetcher *pf, unsigned long block, long dir) {
+    for (unsigned long i = 0; i < pf->degree; i++) {
+        unsigned long n = pf->distance + i;
+        if (dir < 0 && n > block) return;
+        push(pf, dir < 0 ? block - n : block + n);
+    }
+}
+
+//
+// Next-line - every miss prefetches the blocks right after it.
+//
+static void nextline_train(prefetcher *pf, unsigned long addr, unsigned long pc,
+                           bool miss) {
+    if (miss) push_run(pf, addr >> pf->b, 1);
+}
+
+//
+// Stream - misses close to a tracked stream's last one continue it.  Once a
+// stream has gone the same way a few times, each of its misses prefetches
+// further along that way.  Misses near no stream start a new one in place of
+// the least recently used.
+//
+static int stream_init(prefetcher *pf) {
+    pf->streams = calloc(STREAMS, sizeof(struct stream_entry));
+    return pf->streams == NULL ? -1 : 0;
+}
+
+static void stream_train(prefetcher *pf, unsigned long addr, unsigned long pc,
+                         bool miss) {
+    if (!miss) return;
+    unsigned long block = addr >> pf->b;
+    pf->stamp++;
+
+    struct stream_entry *oldest = &pf->streams[0];
+    for (int i = 0; i < STREAMS; i++) {
+        struct stream_entry *st = &pf->streams[i];
+        if (!st->valid) {
+            if (oldest->valid) oldest = st;
+            continue;
+        }
+        long d = (long)(block - st->last);
+        if (d == 0 || d > STREAM_WINDOW || d < -STREAM_WINDOW) {
+            if (oldest->valid && st->stamp < oldest->stamp) oldest = st;
+            continue;
+        }
+
+        long dir = d > 0 ? 1 : -1;
+        if (dir == st->dir) {
+            if (st->confidence < STREAM_CONFIDENCE_MAX) st->confidence++;
+        } else {
+            st->dir = dir;
+            st->confidence = 1;
+        }
+        st->last = block;
+        st->stamp = pf->stamp;
+        if (st->confidence >= STREAM_TRAINED) push_run(pf, block, dir);
+        return;
+    }
+
+    oldest->valid = true;
+    oldest->last = block;
+    oldest->dir = 0;
+    oldest->confidence = 0;
+    oldest->stamp = pf->stamp;
+}
+
+//
+// Stride - each op remembers the address it last accessed and the stride
+// between its last two.  An op that keeps repeating its stride prefetches
+// the blocks that many strides ahead.  Trained on every access, since an op
+// walking within a block hits as often as it misses.
+//
+static int stride_init(prefetcher *pf) {
+    pf->strides = calloc(STRIDE_ENTRIES, sizeof(struct stride_entry));
+    return pf->strides == NULL ? -1 : 0;
+}
+
+static void stride_train(prefetcher *pf, unsigned long addr, unsigned long pc,
+                         bool miss) {
+    // no pc, nothing to tell ops apart by
+    if (pc == 0) return;
+
+    struct stride_entry *e = &pf->strides[(pc ^ (pc >> 8)) % STRIDE_ENTRIES];
+    if (e->pc != pc) {
+        e->pc = pc;
+        e->last = addr;
+        e->stride = 0;
+        e->confidence = 0;
+        return;
+    }
+
+    long stride = (long)(addr - e->last);
+    if (stride == e->stride) {
+        if (e->confidence < STRIDE_CONFIDENCE_MAX) e->confidence++;
+    } else if (e->confidence > 0) {
+        e->confidence--;
+    } else {
+        e->stride = stride;
+    }
+    e->last = addr;
+    if (e->confidence < STRIDE_TRAINED || e->stride == 0) return;
+
+    unsigned long block = addr >> pf->b;
+    for (unsigned long i = 0; i < pf->degree; i++) {
+        long ahead = e->stride * (long)(pf->distance + i);
+        if (ahead < 0 && (unsigned long)-ahead > addr) return;
+        unsigned long target = (addr + ahead) >> pf->b;
+        if (target != block) push(pf, target);
+    }
+}
+
+static const prefetcher_ops prefetchers[] = {
+    {"nextline", NULL, nextline_train},
+    {"stream", stream_init, stream_train},
+    {"stride", stride_init, stride_train},
+};
+
+prefetcher *prefetcher_create(const char *name, unsigned long b,
+                              unsigned long degree, unsigned long distance) {
+    const prefetcher_ops *ops = NULL;
+    for (size_t i = 0; i < sizeof(prefetchers) / sizeof(prefetchers[0]); i++) {
+        if (strcmp(name, prefetchers[i].name) == 0) ops = &prefetchers[i];
+    }
+    if (ops == NULL) {
+        fprintf(stderr, "Unknown prefetcher %s\n", name);
+        return NULL;
+    }
+
+    prefetcher *pf = calloc(1, sizeof(prefetcher));
+    if (pf == NULL) return NULL;
+    pf->ops = ops;
+    pf->b = b;
+    pf->degree = degree;
+    pf->distance = distance;
+    pf->queue = calloc(PREFETCH_QUEUE, sizeof(unsigned long));
+
+    if (pf->queue == NULL || (ops->init != NULL && ops->init(pf) != 0)) {
+        prefetcher_destroy(pf);
+        return NULL;
+    }
+    return pf;
+}
+
+void prefetcher_destroy(prefetcher *pf) {
+    if (pf == NULL) return;
+    free(pf->queue);
+    free(pf->streams);
+    free(pf->strides);
+    free(pf);
+}
+
+bool prefetcher_next(prefetcher *pf, unsigned long *addr) {
+    if (pf->queue_count == 0) return false;
+    *addr = pf->queue[pf->queue_head];
+    pf->queue_head = (pf->queue_head + 1) % PREFETCH_QUEUE;
+    pf->queue_count--;
+    return true;
+}
@@ -0,0 +1,49 @@
+#ifndef PREFETCH_H
+#define PREFETCH_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+struct _prefetcher;
+
+// A prefetcher is trained on a core's demand accesses, and answers with the
+// blocks it expects the core to want next.  addr and pc are those of the op
+// making the access.  miss is set for L1 misses, and for the first hit on a
+// block a prefetch brought in, so that prefetching keeps ahead of a pattern
+// it has started covering.
+typedef struct {
+    const char *name;
+    int (*init)(struct _prefetcher *pf);
+    void (*train)(struct _prefetcher *pf, unsigned long addr, unsigned long pc,
+                  bool miss);
+} prefetcher_ops;
+
+struct stream_entry;
+struct stride_entry;
+
+// Prefetcher state for one core.  Candidates wait in a small FIFO until the
+// cache has room to issue them, and the oldest are dropped once it is full.
+typedef struct _prefetcher {
+    const prefetcher_ops *ops;
+    unsigned long b;        // block size in bits
+    unsigned long degree;   // blocks prefetched per trigger
+    unsigned long distance; // blocks between the trigger and the first of them
+
+    unsigned long *queue;   // block addresses
+    unsigned long queue_head, queue_count;
+
+    struct stream_entry *streams; // stream
+    uint64_t stamp;               // stream - LRU among the streams
+    struct stride_entry *strides; // stride
+} prefetcher;
+
+// Creates the named prefetcher ("nextline", "stream" or "stride") for blocks
+// of 2^b bytes.  Returns NULL if the name is unknown.
+prefetcher *prefetcher_create(const char *name, unsigned long b,
+                              unsigned long degree, unsigned long distance);
+void prefetcher_destroy(prefetcher *pf);
+
+// Takes the oldest candidate, returning false if there is none.
+bool prefetcher_next(prefetcher *pf, unsigned long *addr);
+
+#endif
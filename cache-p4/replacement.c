@@ -0,0 +1,351 @@
+#include "replacement.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+//
+// Replacement policies
+//
+//   LRU and the RRIP family keep their state in the lines themselves
+// (LRU_counter, which cache.c stamps on every access, and RRPV), so their
+// victims come from the set lookups.  PLRU and SHiP keep theirs in arrays
+// here, indexed by set_index * ways + way.
+//
+
+// BRRIP inserts at "long" rather than "distant" once every this many fills.
+#define BRRIP_LONG_ODDS 32
+
+// DRRIP dueling - at most 2^DUEL_MAX_BITS leader sets per policy, and a
+// PSEL_BITS counter choosing for the rest.
+#define DUEL_MAX_BITS 5
+#define PSEL_BITS 10
+#define PSEL_MAX ((1U << PSEL_BITS) - 1)
+
+// SHiP - signatures index a table of saturating counters.
+#define SHIP_SIGNATURE_BITS 14
+#define SHIP_COUNTER_MAX 7
+
+static uint64_t next_random(uint64_t *state) {
+    uint64_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    *state = x;
+    return x;
+}
+
+//
+// LRU - the line with the oldest access stamp.
+//
+static void lru_touch(replacement *r, cache_line *set, unsigned long set_index,
+                      unsigned long way, unsigned long pc) {}
+
+static unsigned long lru_victim(replacement *r, cache_line *set,
+                                unsigned long set_index) {
+    return r->lookup->find_oldest(set, r->ways);
+}
+
+//
+// PLRU - a binary tree per set, node i's bit pointing to the half holding
+// the victim.  Nodes are numbered from 1 as in a heap, so the leaves are
+// ways + way.
+//
+static int plru_init(replacement *r) {
+    if (r->ways & (r->ways - 1)) {
+        fprintf(stderr, "PLRU needs a power of two number of ways\n");
+        return -1;
+    }
+    r->plru_words = (r->ways + 63) / 64;
+    r->plru = calloc(r->sets * r->plru_words, sizeof(uint64_t));
+    return r->plru == NULL ? -1 : 0;
+}
+
+static void plru_touch(replacement *r, cache_line *set,
+                       unsigned long set_index, unsigned long way,
+                       unsigned long pc) {
+    uint64_t *bits = &r->plru[set_index * r->plru_words];
+    // walk from the leaf up, pointing each node away from where we came from
+    for (unsigned long node = r->ways + way; node > 1; node /= 2) {
+        unsigned long parent = node / 2;
+        if (node & 1)
+            bits[parent / 64] &= ~(1UL << (parent % 64));
+        else
+            bits[parent / 64] |= 1UL << (parent % 64);
+    }
+}
+
+static unsigned long plru_victim(replacement *r, cache_line *set,
+                                 unsigned long set_index) {
+    const uint64_t *bits = &r->plru[set_index * r->plru_words];
+    unsigned long node = 1;
+    while (node < r->ways) {
+        node = 2 * node + ((bits[node / 64] >> (node % 64)) & 1);
+    }
+    return node - r->ways;
+}
+
+//
+// RRIP - hits are predicted to come back soon (RRPV 0).  The victim is the
+// first line predicted to come back in the distant future (RRPV max), after
+// aging the whole set until one is.
+//
+static int rrip_init(replacement *r) {
+    r->rng = 0x9E3779B97F4A7C15UL;
+    return 0;
+}
+
+static void rrip_hit(replacement *r, cache_line *set, unsigned long set_index,
+                     unsigned long way, unsigned long pc) {
+    set[way].RRPV = 0;
+}
+
+static unsigned long rrip_victim(replacement *r, cache_line *set,
+                                 unsigned long set_index) {
+    unsigned long way = r->lookup->find_distant(set, r->ways);
+    assert(set[way].RRPV <= r->rrpv_max);
+    unsigned long age = r->rrpv_max - set[way].RRPV;
+    if (age > 0) {
+        for (unsigned long i = 0; i < r->ways; i++) {
+            set[i].RRPV += age;
+        }
+    }
+    return way;
+}
+
+// SRRIP inserts at "long", one short of distant.
+static void srrip_fill(replacement *r, cache_line *set,
+                       unsigned long set_index, unsigned long way,
+                       unsigned long pc) {
+    set[way].RRPV = r->rrpv_max - 1;
+}
+
+// BRRIP mostly inserts at distant, so lines that are not reused soon leave
+// first and a working set larger than the cache keeps part of itself.
+static void brrip_fill(replacement *r, cache_line *set,
+                       unsigned long set_index, unsigned long way,
+                       unsigned long pc) {
+    bool is_long = next_random(&r->rng) % BRRIP_LONG_ODDS == 0;
+    set[way].RRPV = is_long ? r->rrpv_max - 1 : r->rrpv_max;
+}
+
+//
+// DRRIP - a few leader sets always use SRRIP or BRRIP, and their misses
+// move PSEL towards the other.  The remaining sets follow whichever PSEL
+// favours.  Leaders are picked by comparing the top and bottom duel_bits of
+// the set index, so they are spread over the cache.
+//
+static int drrip_init(replacement *r) {
+    unsigned long s = 0;
+    while ((1UL << s) < r->sets) s++;
+    r->duel_bits = s / 2 < DUEL_MAX_BITS ? s / 2 : DUEL_MAX_BITS;
+    r->duel_shift = s - r->duel_bits;
+    r->psel = (PSEL_MAX + 1) / 2;
+    return rrip_init(r);
+}
+
+static void drrip_fill(replacement *r, cache_line *set,
+                       unsigned long set_index, unsigned long way,
+                       unsigned long pc) {
+    unsigned long mask = (1UL << r->duel_bits) - 1;
+    unsigned long low = set_index & mask;
+    unsigned long high = (set_index >> r->duel_shift) & mask;
+
+    bool use_brrip;
+    if (high == low) {
+        // SRRIP leader
+        if (r->psel < PSEL_MAX) r->psel++;
+        use_brrip = false;
+    } else if (high == (~low & mask)) {
+        // BRRIP leader
+        if (r->psel > 0) r->psel--;
+        use_brrip = true;
+    } else {
+        use_brrip = r->psel > PSEL_MAX / 2;
+    }
+
+    if (use_brrip)
+        brrip_fill(r, set, set_index, way, pc);
+    else
+        srrip_fill(r, set, set_index, way, pc);
+}
+
+//
+// SHiP - SRRIP, except that lines are inserted at distant when the op that
+// brought them in has a history of bringing in lines that were never hit.
+// Each line remembers its op's signature and whether it has been hit, and
+// trains the signature's counter when it is hit or evicted.
+//
+static int ship_init(replacement *r) {
+    r->signature = calloc(r->sets * r->ways, sizeof(uint16_t));
+    r->reused = calloc(r->sets * r->ways, sizeof(uint8_t));
+    r->shct = malloc(1UL << SHIP_SIGNATURE_BITS);
+    if (r->signature == NULL || r->reused == NULL || r->shct == NULL) {
+        return -1;
+    }
+    // start out weakly predicting reuse
+    memset(r->shct, 1, 1UL << SHIP_SIGNATURE_BITS);
+    return 0;
+}
+
+static inline uint16_t ship_signature(unsigned long pc) {
+    pc ^= pc >> SHIP_SIGNATURE_BITS;
+    pc ^= pc >> (2 * SHIP_SIGNATURE_BITS);
+    return pc & ((1UL << SHIP_SIGNATURE_BITS) - 1);
+}
+
+static void ship_hit(replacement *r, cache_line *set, unsigned long set_index,
+                     unsigned long way, unsigned long pc) {
+    unsigned long line = set_index * r->ways + way;
+    uint8_t *counter = &r->shct[r->signature[line]];
+    if (*counter < SHIP_COUNTER_MAX) (*counter)++;
+    r->reused[line] = 1;
+    set[way].RRPV = 0;
+}
+
+static void ship_fill(replacement *r, cache_line *set, unsigned long set_index,
+                      unsigned long way, unsigned long pc) {
+    unsigned long line = set_index * r->ways + way;
+    uint16_t signature = ship_signature(pc);
+    r->signature[line] = signature;
+    r->reused[line] = 0;
+    set[way].RRPV = r->shct[signature] == 0 ? r->rrpv_max : r->rrpv_max - 1;
+}
+
+static unsigned long ship_victim(replacement *r, cache_line *set,
+                                 unsigned long set_index) {
+    unsigned long way = rrip_victim(r, set, set_index);
+    unsigned long line = set_index * r->ways + way;
+    uint8_t *counter = &r->shct[r->signature[line]];
+    if (!r->reused[line] && *counter > 0) (*counter)--;
+    return way;
+}
+
+//
+// OPT - Belady's, evicting the line whose block is next used furthest
+// ahead, going by a future the cache sets.  Lines are stamped with their
+// next use whenever they are accessed, and each set keeps its ways in a
+// max-heap on it, so the victim is the root.  Lines with no next use in
+// sight tie, and go in LRU order.
+//
+static int opt_init(replacement *r) {
+    while ((1UL << r->set_bits) < r->sets) r->set_bits++;
+    r->next_use = malloc(r->sets * r->ways * sizeof(uint64_t));
+    r->heap = malloc(r->sets * r->ways * sizeof(uint32_t));
+    r->heap_pos = malloc(r->sets * r->ways * sizeof(uint32_t));
+    if (r->next_use == NULL || r->heap == NULL || r->heap_pos == NULL) {
+        return -1;
+    }
+    for (unsigned long i = 0; i < r->sets * r->ways; i++) {
+        r->next_use[i] = FUTURE_NEVER;
+        r->heap[i] = i % r->ways;
+        r->heap_pos[i] = i % r->ways;
+    }
+    return 0;
+}
+
+// whether way a goes before way b
+static inline bool opt_before(const replacement *r, const cache_line *set,
+                              unsigned long base, uint32_t a, uint32_t b) {
+    uint64_t na = r->next_use[base + a], nb = r->next_use[base + b];
+    if (na != nb) return na > nb;
+    return set[a].LRU_counter < set[b].LRU_counter;
+}
+
+static inline void opt_place(replacement *r, unsigned long base,
+                             unsigned long i, uint32_t way) {
+    r->heap[base + i] = way;
+    r->heap_pos[base + way] = i;
+}
+
+static void opt_touch(replacement *r, cache_line *set, unsigned long set_index,
+                      unsigned long way, unsigned long pc) {
+    unsigned long base = set_index * r->ways;
+    uint64_t block = (set[way].tag << r->set_bits) | set_index;
+    r->next_use[base + way] =
+        r->future != NULL ? future_next_use(r->future, block) : FUTURE_NEVER;
+
+    // the line's key and stamp both changed, so it may go either way
+    unsigned long i = r->heap_pos[base + way];
+    while (i > 0) {
+        uint32_t parent = r->heap[base + (i - 1) / 2];
+        if (!opt_before(r, set, base, way, parent)) break;
+        opt_place(r, base, i, parent);
+        i = (i - 1) / 2;
+    }
+    for (;;) {
+        unsigned long c = 2 * i + 1;
+        if (c >= r->ways) break;
+        if (c + 1 < r->ways &&
+            opt_before(r, set, base, r->heap[base + c + 1], r->heap[base + c]))
+            c++;
+        if (!opt_before(r, set, base, r->heap[base + c], way)) break;
+        opt_place(r, base, i, r->heap[base + c]);
+        i = c;
+    }
+    opt_place(r, base, i, way);
+}
+
+static unsigned long opt_victim(replacement *r, cache_line *set,
+                                unsigned long set_index) {
+    return r->heap[set_index * r->ways];
+}
+
+static const replacement_ops policies[] = {
+    {"lru", false, NULL, lru_touch, lru_touch, lru_victim},
+    {"plru", false, plru_init, plru_touch, plru_touch, plru_victim},
+    {"srrip", true, rrip_init, rrip_hit, srrip_fill, rrip_victim},
+    {"brrip", true, rrip_init, rrip_hit, brrip_fill, rrip_victim},
+    {"drrip", true, drrip_init, rrip_hit, drrip_fill, rrip_victim},
+    {"ship", true, ship_init, ship_hit, ship_fill, ship_victim},
+    {"opt", false, opt_init, opt_touch, opt_touch, opt_victim},
+};
+
+static const replacement_ops *find_policy(const char *name) {
+    for (size_t i = 0; i < sizeof(policies) / sizeof(policies[0]); i++) {
+        if (strcmp(name, policies[i].name) == 0) return &policies[i];
+    }
+    return NULL;
+}
+
+bool replacement_uses_rrpv(const char *name) {
+    const replacement_ops *ops = find_policy(name);
+    return ops != NULL && ops->uses_rrpv;
+}
+
+replacement *replacement_create(const char *name, unsigned long sets,
+                                unsigned long ways, unsigned long rrpv_max,
+                                const lookup_impl *lookup) {
+    const replacement_ops *ops = find_policy(name);
+    if (ops == NULL) {
+        fprintf(stderr, "Unknown replacement policy %s\n", name);
+        return NULL;
+    }
+
+    replacement *r = calloc(1, sizeof(replacement));
+    if (r == NULL) return NULL;
+    r->ops = ops;
+    r->lookup = lookup;
+    r->sets = sets;
+    r->ways = ways;
+    r->rrpv_max = rrpv_max;
+
+    if (ops->init != NULL && ops->init(r) != 0) {
+        replacement_destroy(r);
+        return NULL;
+    }
+    return r;
+}
+
+void replacement_destroy(replacement *r) {
+    if (r == NULL) return;
+    free(r->plru);
+    free(r->signature);
+    free(r->reused);
+    free(r->shct);
+    free(r->next_use);
+    free(r->heap);
+    free(r->heap_pos);
+    free(r);
+}
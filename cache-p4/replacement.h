@@ -0,0 +1,62 @@
+#ifndef REPLACEMENT_H
+#define REPLACEMENT_H
+
+#include "cache_line.h"
+#include "future.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+struct _replacement;
+
+// A replacement policy is told about every hit and every fill of a set's
+// way, and picks the way to evict once the set is full.  pc is the address
+// of the op making the access.
+typedef struct {
+    const char *name;
+    bool uses_rrpv; // takes its RRPV width from -R
+    int (*init)(struct _replacement *r);
+    void (*hit)(struct _replacement *r, cache_line *set,
+                unsigned long set_index, unsigned long way, unsigned long pc);
+    void (*fill)(struct _replacement *r, cache_line *set,
+                 unsigned long set_index, unsigned long way, unsigned long pc);
+    unsigned long (*victim)(struct _replacement *r, cache_line *set,
+                            unsigned long set_index);
+} replacement_ops;
+
+// Policy state for one cache.  Fields past rrpv_max are only used by the
+// policies that need them.
+typedef struct _replacement {
+    const replacement_ops *ops;
+    const lookup_impl *lookup;
+    unsigned long sets, ways;
+    unsigned long rrpv_max;
+
+    uint64_t *plru;          // PLRU - tree bits, plru_words per set
+    unsigned long plru_words;
+    uint64_t rng;            // BRRIP, DRRIP - bimodal insertion
+    unsigned int psel;       // DRRIP - set dueling counter
+    unsigned long duel_bits, duel_shift;
+    uint16_t *signature;     // SHiP - per line
+    uint8_t *reused;         // SHiP - per line
+    uint8_t *shct;           // SHiP - signature history counters
+    future *future;          // OPT - set by the cache, LRU while NULL
+    unsigned int set_bits;   // OPT - to rebuild blocks from tags
+    uint64_t *next_use;      // OPT - per line
+    uint32_t *heap;          // OPT - ways per set, furthest next use first
+    uint32_t *heap_pos;      // OPT - per line, its place in heap
+} replacement;
+
+// Creates the named policy ("lru", "plru", "srrip", "brrip", "drrip",
+// "ship" or "opt") for a cache of sets x ways lines, whose RRIP policies count to
+// rrpv_max.  Returns NULL if the name is unknown or the policy does not
+// support this shape.
+replacement *replacement_create(const char *name, unsigned long sets,
+                                unsigned long ways, unsigned long rrpv_max,
+                                const lookup_impl *lookup);
+void replacement_destroy(replacement *r);
+
+// Whether the named policy takes its RRPV width from -R.
+bool replacement_uses_rrpv(const char *name);
+
+#endif
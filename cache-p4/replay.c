@@ -0,0 +1,368 @@
+#include "cache_line.h"
+#include "missstream.h"
+#include "replacement.h"
+#include "sets.h"
+
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+//
+// cadss-replay
+//
+//   Replays the misses and writebacks a cache-p4 run recorded with -m into
+// a private L2 per core and a shared LLC, without the cores, L1 or
+// coherence.  Levels are non-inclusive non-exclusive, as cache-p4's are by
+// default: a read fills every level it missed in, dirty victims are
+// written to the next level out, allocating there, and an invalidation
+// takes the block out of the core's L2.
+//
+//   With these levels L1's stream does not depend on the ones past it, so
+// one recording serves any number of replays.  cache-p4's own outer levels
+// are not written to on writebacks; with -n they are dropped here too, and
+// the counts match a full run with the same levels, as long as their
+// latency does not change how the cores interleave.  Records carry no pc,
+// so SHiP sees every access as coming from the same op.
+//
+
+typedef struct _level {
+    const char *name;
+    unsigned long s, S, E;
+    set_store *lines;
+    replacement *policy;
+
+    // statistics
+    uint64_t hits, misses;
+    uint64_t writebacks, writebackMisses;
+    uint64_t invalidations;
+} level;
+
+const lookup_impl *lookup = NULL;
+// timestamp used for LRU, one per record
+unsigned long now = 0;
+uint64_t memoryReads = 0, memoryWrites = 0;
+
+void printHelp(char *prog) {
+    printf("%s [-2 <level>] [-3 <level>] [options] <miss stream>\n", prog);
+    printf("  -h            \t Help message\n");
+    printf("  -2 <level>    \t Private L2 per core, as s=<set bits>,E=<lines "
+           "per set>\n");
+    printf("  -3 <level>    \t Shared LLC, as s=<set bits>,E=<lines per set>\n");
+    printf("  -P <policy>   \t Replacement: lru, plru, srrip, brrip, drrip "
+           "or ship\n");
+    printf("  -R <bits>     \t RRPV bits of the RRIP policies (default 2)\n");
+    printf("  -B <backing>  \t Host memory for sets: dense or sparse\n");
+    printf("  -L <lookup>   \t Set search: scalar, sse2 or avx2\n");
+    printf("  -n            \t Drop writebacks, as cache-p4's levels do\n");
+}
+
+static char *const levelTokens[] = {"s", "E", NULL};
+
+enum LEVEL_TOKEN { T_SETS , T_WAYS };
+
+// parses "s=<set bits>,E=<lines per set>"
+int parseLevel(char *spec, unsigned long b, unsigned long *s,
+               unsigned long *E) {
+    char *value;
+    while (*spec != '\0') {
+        int token = getsubopt(&spec, levelTokens, &value);
+        if (token == -1 || value == NULL) {
+            fprintf(stderr, "Unknown cache level setting - %s\n", value);
+            return -1;
+        }
+        unsigned long v = strtoul(value, NULL, 10);
+        switch (token) {
+        case T_SETS: *s = v; break;
+        case T_WAYS: *E = v; break;
+        }
+    }
+    if (*E == 0 || *s + b >= 64) {
+        fprintf(stderr, "Cache level settings are out of range\n");
+        return -1;
+    }
+    return 0;
+}
+
+level *createLevel(const char *name, char *spec, unsigned long b,
+                   const char *policy_name, unsigned long rrpv_max,
+                   bool sparse) {
+    unsigned long s = 0, E = 1;
+    if (parseLevel(spec, b, &s, &E) != 0) {
+        return NULL;
+    }
+    level *lv = calloc(1, sizeof(level));
+    if (lv == NULL) {
+        return NULL;
+    }
+    lv->name = name;
+    lv->s = s;
+    lv->S = 1UL << s;
+    lv->E = E;
+    lv->lines = set_store_create(lv->S, E * sizeof(cache_line), sparse);
+    lv->policy = replacement_create(policy_name, lv->S, E, rrpv_max, lookup);
+    if (lv->lines == NULL || lv->policy == NULL) {
+        return NULL;
+    }
+    return lv;
+}
+
+void destroyLevel(level *lv) {
+    if (lv == NULL) return;
+    set_store_destroy(lv->lines);
+    replacement_destroy(lv->policy);
+    free(lv);
+}
+
+// the line holding block in lv, updating it as an access would
+cache_line *levelAccess(level *lv, uint64_t block) {
+    unsigned long set_index = block & (lv->S - 1);
+    cache_line *set = set_store_find(lv->lines, set_index);
+    unsigned long way = lookup->find_tag(set, lv->E, block >> lv->s);
+    if (way == lv->E) {
+        return NULL;
+    }
+    set[way].LRU_counter = now;
+    lv->policy->ops->hit(lv->policy, set, set_index, way, 0);
+    return &set[way];
+}
+
+// Puts block in lv.  Returns whether another line had to make room,
+// setting its block and whether it was dirty.
+bool levelInsert(level *lv, uint64_t block, bool dirty, uint64_t *evict_block,
+                 bool *evict_dirty) {
+    unsigned long set_index = block & (lv->S - 1);
+    cache_line *set = set_store_get(lv->lines, set_index);
+    unsigned long way = lookup->find_invalid(set, lv->E);
+    bool evicted = way == lv->E;
+    if (evicted) {
+        way = lv->policy->ops->victim(lv->policy, set, set_index);
+        *evict_block = (set[way].tag << lv->s) | set_index;
+        *evict_dirty = set[way].dirty_bit;
+    }
+
+    set[way].valid_bit = true;
+    set[way].dirty_bit = dirty;
+    set[way].tag = block >> lv->s;
+    set[way].LRU_counter = now;
+    lv->policy->ops->fill(lv->policy, set, set_index, way, 0);
+    return evicted;
+}
+
+// writes the dirty block back to levels[i], or memory past the last level
+void writeBack(level **levels, int n, int i, uint64_t block) {
+    if (i == n) {
+        memoryWrites++;
+        return;
+    }
+    level *lv = levels[i];
+    lv->writebacks++;
+    cache_line *line = levelAccess(lv, block);
+    if (line != NULL) {
+        line->dirty_bit = true;
+        return;
+    }
+    lv->writebackMisses++;
+    uint64_t evict_block;
+    bool evict_dirty;
+    if (levelInsert(lv, block, true, &evict_block, &evict_dirty) &&
+        evict_dirty) {
+        writeBack(levels, n, i + 1, evict_block);
+    }
+}
+
+// takes block out of lv, dropping its data
+void levelInvalidate(level *lv, uint64_t block) {
+    unsigned long set_index = block & (lv->S - 1);
+    cache_line *set = set_store_find(lv->lines, set_index);
+    unsigned long way = lookup->find_tag(set, lv->E, block >> lv->s);
+    if (way < lv->E) {
+        set[way].valid_bit = false;
+        lv->invalidations++;
+    }
+}
+
+// reads block through levels, filling the ones it missed in
+void readBlock(level **levels, int n, uint64_t block) {
+    int hit = n;
+    for (int i = 0; i < n; i++) {
+        if (levelAccess(levels[i], block) != NULL) {
+            levels[i]->hits++;
+            hit = i;
+            break;
+        }
+        levels[i]->misses++;
+    }
+    if (hit == n) {
+        memoryReads++;
+    }
+    for (int i = 0; i < hit; i++) {
+        uint64_t evict_block;
+        bool evict_dirty;
+        if (levelInsert(levels[i], block, false, &evict_block, &evict_dirty) &&
+            evict_dirty) {
+            writeBack(levels, n, i + 1, evict_block);
+        }
+    }
+}
+
+void printLevel(const char *prefix, const level *lv) {
+    printf("    -   %s%s: %lu hits, %lu misses, %lu writebacks "
+           "(%lu allocating), %lu invalidations\n",
+           prefix, lv->name, lv->hits, lv->misses, lv->writebacks,
+           lv->writebackMisses, lv->invalidations);
+}
+
+int main(int argc, char **argv) {
+    int op;
+    char *l2_spec = NULL;
+    char *llc_spec = NULL;
+    char *policy_name = NULL;
+    char *lookup_name = NULL;
+    char *backing_name = NULL;
+    unsigned long k = 0;
+    bool dropWritebacks = false;
+
+    while ((op = getopt(argc, argv, "h2:3:P:R:B:L:n")) != -1) {
+        switch (op) {
+        case 'h':
+            printHelp(argv[0]);
+            return 0;
+        case '2':
+            l2_spec = optarg;
+            break;
+        case '3':
+            llc_spec = optarg;
+            break;
+        case 'P':
+            policy_name = optarg;
+            break;
+        case 'R':
+            k = strtoul(optarg, NULL, 10);
+            if (k > RRPV_BITS) {
+                fprintf(stderr, "RRIP supports at most %d bits\n", RRPV_BITS);
+                return 1;
+            }
+            break;
+        case 'B':
+            backing_name = optarg;
+            break;
+        case 'L':
+            lookup_name = optarg;
+            break;
+        case 'n':
+            dropWritebacks = true;
+            break;
+        default:
+            printHelp(argv[0]);
+            return 1;
+        }
+    }
+    if (optind != argc - 1 || (l2_spec == NULL && llc_spec == NULL)) {
+        printHelp(argv[0]);
+        return 1;
+    }
+
+    lookup = select_lookup(lookup_name);
+    if (lookup == NULL) {
+        fprintf(stderr, "Set lookup %s is not supported here\n", lookup_name);
+        return 1;
+    }
+    if (policy_name == NULL) {
+        policy_name = k != 0 ? "srrip" : "lru";
+    }
+    if (strcmp(policy_name, "opt") == 0) {
+        fprintf(stderr, "OPT is not supported in outer levels\n");
+        return 1;
+    }
+    unsigned long rrpv_max = 0;
+    if (replacement_uses_rrpv(policy_name)) {
+        if (k == 0) k = 2;
+        rrpv_max = (1UL << k) - 1;
+    }
+    bool sparse = backing_name != NULL && strcmp(backing_name, "sparse") == 0;
+    if (backing_name != NULL && !sparse && strcmp(backing_name, "dense") != 0) {
+        fprintf(stderr, "Unknown set backing %s\n", backing_name);
+        return 1;
+    }
+
+    unsigned long b;
+    int cores;
+    FILE *in = missstream_open(argv[optind], &b, &cores);
+    if (in == NULL) {
+        return 1;
+    }
+
+    level **l2s = calloc(cores, sizeof(level *));
+    level *llc = NULL;
+    if (l2s == NULL) {
+        return 1;
+    }
+    for (int i = 0; l2_spec != NULL && i < cores; i++) {
+        // each parse cuts the spec up, so parse a copy
+        char *spec = strdup(l2_spec);
+        l2s[i] = createLevel("L2", spec, b, policy_name, rrpv_max, sparse);
+        free(spec);
+        if (l2s[i] == NULL) {
+            return 1;
+        }
+    }
+    if (llc_spec != NULL) {
+        llc = createLevel("LLC", llc_spec, b, policy_name, rrpv_max, sparse);
+        if (llc == NULL) {
+            return 1;
+        }
+    }
+
+    uint64_t records = 0, lastTick = 0;
+    miss_entry e;
+    while (missstream_read(in, &e)) {
+        if (e.core >= cores) {
+            fprintf(stderr, "%s is corrupt at record %lu\n", argv[optind],
+                    records);
+            return 1;
+        }
+        level *levels[2];
+        int n = 0;
+        if (l2s[e.core] != NULL) levels[n++] = l2s[e.core];
+        if (llc != NULL) levels[n++] = llc;
+
+        now++;
+        switch (e.type) {
+        case MISS_LOAD:
+        case MISS_STORE:
+            readBlock(levels, n, e.block);
+            break;
+        case MISS_WRITEBACK:
+            if (!dropWritebacks) writeBack(levels, n, 0, e.block);
+            break;
+        case MISS_INVALIDATE:
+            if (l2s[e.core] != NULL) levelInvalidate(l2s[e.core], e.block);
+            break;
+        }
+        records++;
+        lastTick = e.tick;
+    }
+    fclose(in);
+
+    printf("Replay Summary:\n");
+    printf("    -   %lu records over %lu ticks\n", records, lastTick);
+    for (int i = 0; l2s[0] != NULL && i < cores; i++) {
+        char prefix[32];
+        snprintf(prefix, sizeof(prefix), "Core %d ", i);
+        printLevel(prefix, l2s[i]);
+    }
+    if (llc != NULL) {
+        printLevel("", llc);
+    }
+    printf("    -   Memory: %lu reads, %lu writes\n", memoryReads,
+           memoryWrites);
+
+    for (int i = 0; i < cores; i++) {
+        destroyLevel(l2s[i]);
+    }
+    free(l2s);
+    destroyLevel(llc);
+    return 0;
+}
@@ -0,0 +1,81 @@
+#include "sets.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Chunks are sized to fit a host page, and rounded up to host cache lines
+// so that small sets do not straddle them.
+#define CHUNK_TARGET 4096
+#define ALIGN 64
+
+static size_t aligned_size(size_t bytes) {
+    return (bytes + ALIGN - 1) & ~(size_t)(ALIGN - 1);
+}
+
+// zeroed, aligned memory
+static char *zeroed(size_t bytes) {
+    bytes = aligned_size(bytes);
+    char *p = aligned_alloc(ALIGN, bytes);
+    if (p != NULL) memset(p, 0, bytes);
+    return p;
+}
+
+set_store *set_store_create(unsigned long sets, size_t set_bytes, bool sparse) {
+    set_store *st = calloc(1, sizeof(set_store));
+    if (st == NULL) return NULL;
+    st->sets = sets;
+    st->set_bytes = set_bytes;
+
+    if (!sparse) {
+        st->dense = zeroed(sets * set_bytes);
+        if (st->dense == NULL) {
+            set_store_destroy(st);
+            return NULL;
+        }
+        return st;
+    }
+
+    // sets is a power of two, so chunks divide it evenly
+    while ((1UL << (st->chunk_bits + 1)) <= sets &&
+           (set_bytes << (st->chunk_bits + 1)) <= CHUNK_TARGET) {
+        st->chunk_bits++;
+    }
+    st->chunk_count = sets >> st->chunk_bits;
+    st->chunks = calloc(st->chunk_count, sizeof(char *));
+    st->empty = zeroed(set_bytes);
+    if (st->chunks == NULL || st->empty == NULL) {
+        set_store_destroy(st);
+        return NULL;
+    }
+    return st;
+}
+
+void set_store_destroy(set_store *st) {
+    if (st == NULL) return;
+    free(st->dense);
+    if (st->chunks != NULL) {
+        for (unsigned long i = 0; i < st->chunk_count; i++) free(st->chunks[i]);
+        free(st->chunks);
+    }
+    free(st->empty);
+    free(st);
+}
+
+char *set_store_fill(set_store *st, unsigned long i) {
+    char *chunk = zeroed(st->set_bytes << st->chunk_bits);
+    if (chunk == NULL) {
+        // nowhere to put the line, and no way to go on without it
+        fprintf(stderr, "Out of host memory for cache sets\n");
+        abort();
+    }
+    st->chunks[i >> st->chunk_bits] = chunk;
+    st->chunks_used++;
+    return chunk;
+}
+
+size_t set_store_bytes(const set_store *st) {
+    if (st->dense != NULL) return aligned_size(st->sets * st->set_bytes);
+    return st->chunks_used * aligned_size(st->set_bytes << st->chunk_bits) +
+           st->chunk_count * sizeof(char *) + aligned_size(st->set_bytes);
+}
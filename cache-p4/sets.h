@@ -0,0 +1,50 @@
+#ifndef SETS_H
+#define SETS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Host memory for a cache's sets, each set_bytes long and zeroed before
+// first use.  Dense stores allocate every set up front.  Sparse stores
+// split the sets into chunks of about a host page and allocate a chunk the
+// first time one of its sets is written, so sets a run never uses cost a
+// pointer per chunk.
+typedef struct _set_store {
+    unsigned long sets;
+    size_t set_bytes;
+    char *dense;          // NULL if sparse
+
+    char **chunks;        // sparse - chunk i holds sets i << chunk_bits on
+    unsigned int chunk_bits;
+    unsigned long chunk_count, chunks_used;
+    char *empty;          // sparse - one zeroed set, for sets not yet used
+} set_store;
+
+set_store *set_store_create(unsigned long sets, size_t set_bytes, bool sparse);
+void set_store_destroy(set_store *st);
+
+// allocates the chunk holding set i
+char *set_store_fill(set_store *st, unsigned long i);
+
+// Set i, for writing.
+static inline void *set_store_get(set_store *st, unsigned long i) {
+    if (st->dense != NULL) return st->dense + i * st->set_bytes;
+    char *chunk = st->chunks[i >> st->chunk_bits];
+    if (chunk == NULL) chunk = set_store_fill(st, i);
+    return chunk + (i & ((1UL << st->chunk_bits) - 1)) * st->set_bytes;
+}
+
+// Set i, for looking in.  A set not yet used reads as empty without being
+// allocated, so only lines found valid may be written through it.
+static inline void *set_store_find(const set_store *st, unsigned long i) {
+    if (st->dense != NULL) return st->dense + i * st->set_bytes;
+    char *chunk = st->chunks[i >> st->chunk_bits];
+    if (chunk == NULL) return st->empty;
+    return chunk + (i & ((1UL << st->chunk_bits) - 1)) * st->set_bytes;
+}
+
+// Bytes of host memory holding sets.
+size_t set_store_bytes(const set_store *st);
+
+#endif
@@ -248,6 +248,11 @@ uint8_t invlReq(uint64_t addr, int processorNum) {
 
 int tick() { return inter_sim->si.tick(); }
 
+// Coherence state only changes in response to other components.
+int64_t nextTick(void) { return INT64_MAX; }
+
+void skipTicks(int64_t ticks) {}
+
 int finish(int outFd) { return inter_sim->si.finish(outFd); }
 
 int destroy(void) {
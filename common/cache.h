@@ -18,4 +18,14 @@ typedef struct _cache {
     debug_env_vars dbgEnv;
 } cache;
 
+// Caches that can have several requests in flight may also define the
+//   following, looked up by name like nextTick.  It returns 1 if the cache
+//   can take op from processorNum now, 0 if it cannot because op misses and
+//   all of the MSHRs are in use, and MEM_ONE_AT_A_TIME if it cannot because
+//   it is taking one request per core at a time and processorNum has one in
+//   flight.  The processor holds the op until it can.  Without it,
+//   processors send one request per core at a time.
+#define MEM_ONE_AT_A_TIME -1
+int memoryRequestReady(trace_op* op, int processorNum);
+
 #endif
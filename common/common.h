@@ -12,6 +12,18 @@ int tick();
 int finish(int);
 int destroy(void);
 
+// Components may also define the following to support idle-cycle
+//   fast-forward (engine "-x").  nextTick returns how many ticks from now
+//   the component next does something other than count down, where 1 is
+//   the very next tick and INT64_MAX means it is only waiting on another
+//   component.  skipTicks(n) then advances its countdowns and statistics
+//   exactly as n of those idle ticks would have.
+//
+//   These are looked up by name rather than added to sim_interface, so that
+//   components built against an older header keep the same layout.
+int64_t nextTick(void);
+void skipTicks(int64_t);
+
 // Every componet also needs to define an init that returns
 //   a pointer specific to that type of component
 
@@ -12,6 +12,8 @@ typedef struct _processor_sim_args {
     branch* branch_sim;
     int arg_count;
     char** arg_list;
+    // The cache's memoryRequestReady, or NULL if it has none.
+    int (*memoryRequestReady)(trace_op*, int);
 } processor_sim_args;
 
 typedef struct _processor {
@@ -42,6 +42,11 @@ typedef struct _trace_sim_args {
 typedef struct _trace_reader {
     sim_interface si;
     trace_op* (*getNextOp)(int);
+
+    // Copies up to n of a processor's next ops into buf and returns how
+    //   many were copied, without allocating.  Returns 0 wherever getNextOp
+    //   would have returned NULL.
+    int (*getNextOps)(int processorNum, trace_op* buf, int n);
 } trace_reader;
 
 #endif
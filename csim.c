@@ -18,14 +18,27 @@
  *      - dirty bytes in cache after the trace
  *      - dirty bytes evicted in the trace's lifetime
  *
+ * With -O, the simulator replaces with Belady's OPT instead of LRU.
+ * With -H, sets are picked by a hash of the address rather than by its
+ * index bits, or each way of a skewed-associative cache has its own hash.
+ * With -j, sets are split among worker threads, with the same results.
+ * With -c or -C, the trace is read into memory once and any number of caches
+ * are simulated over it, one per thread, printing a summary line for each.
+ *
+ * In stack-distance mode (-m), one pass over the trace instead reports the
+ * hits, misses and evictions of every LRU cache with block size 2**b, up to
+ * 2**s sets and up to E lines per set.
+ *
  * The cache simulator was implemented using a 2D array of cache_line structs,
  * implemented as S cache_line* pointers that point to E contiguous cache_line
- * structs in memory. Each cache_line consists of a valid bit which is 1
- * when the cache line represents a valid line, a dirty bit that represents
- * whether data has been written to the address with a store address but hasn't
- * been evicted, and a tag which is a 64-(s+b) bit long identifier for a range
- * of addresses. Finally the LRU_counter acts as a "timestamp" for the last time
- * the cache memory has been read from/written to
+ * structs in memory. A set's lines are only allocated when the trace first
+ * uses the set, so sets it never uses cost just their pointer. Each
+ * cache_line consists of a valid bit which is 1 when the cache line
+ * represents a valid line, a dirty bit that represents whether data has been
+ * written to the address with a store address but hasn't been evicted, and
+ * a tag which is a 64-(s+b) bit long identifier for a range of addresses.
+ * Finally the LRU_counter acts as a "timestamp" for the last time the cache
+ * memory has been read from/written to
  *
  *
  * @author Jessica Li <jgli@andrew.cmu.edu>
@@ -34,14 +47,21 @@
 #include "cachelab.h"
 #include <errno.h>
 #include <getopt.h>
+#include <limits.h>
 #include <math.h>
+#include <pthread.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 // Maximum length of line - 20 characters, then include '\n'
 #define LINELEN 21
+// With -j, accesses handed to a worker at a time, and batches each worker
+// may have waiting
+#define BATCH_LEN 4096
+#define QUEUE_DEPTH 8
 
 typedef struct {
     bool valid_bit;
@@ -50,23 +70,60 @@ typedef struct {
     size_t LRU_counter;
 } cache_line;
 
+// How an address picks its set (-H).  bits takes the s bits above the
+// block offset, xor folds every s bits of the tag into them, and prime
+// takes the block number modulo the largest prime up to 2**s, leaving the
+// sets past it unused.  skew gives each way its own hash of the block
+// number, so a block's candidate lines lie in a different set per way.
+typedef enum { INDEX_BITS, INDEX_XOR, INDEX_PRIME, INDEX_SKEW } index_fn;
+
+// A simulated cache: its shape, and 2**s sets of E lines, NULL until used.
+// Tags are what is left of the address once the set is known: the block
+// number divided by P under prime, and the whole block number under skew.
+typedef struct {
+    unsigned long s, b, E, B;
+    index_fn index;
+    unsigned long P; // prime - sets in use
+    cache_line **sets;
+} cache_t;
+
 // Global variables for the input options + statistics of cache simulation
 bool verbose = false;
+bool stack_distance = false;
 unsigned long s, b, E, B = 0;
-csim_stats_t *stats;
+unsigned long threads = 1;
+index_fn indexing = INDEX_BITS;
 
 // Help string for csim
 const char helpstr[] =
-    "Usage: ./csim-ref [-v] -s <s> -b <b> -E <E> -t <trace>\n\
+    "Usage: ./csim-ref [-v] [-m] [-O [-w <n>]] [-j <n>] [-H <index>] -s <s> -b <b> -E <E> -t <trace>\n\
+    ./csim-ref [-v] [-j <n>] [-H <index>] -c <s,b,E> [-c ...] [-C <file>] -t <trace>\n\
     ./csim-ref -h\n\n\
     -h\tPrint this help message and exit\n\
     -v\tVerbose mode: report effects of each memory operation\n\
+    -m\tStack-distance mode: report every cache with up to 2**s sets\n\
+      \tand up to E lines per set, from one pass over the trace\n\
+    -O\tReplace with Belady's OPT, evicting the line used furthest\n\
+      \tin the future, rather than LRU\n\
+    -w <n>\tWith -O, look at most n accesses ahead\n\
+    -H <index>\tSet index function: bits (default), xor, prime or skew\n\
+      \t(skew ignores -j, and only bits works with -m)\n\
+    -j <n>\tSimulate on n threads, each owning a range of the sets\n\
+      \t(ignored with -v, -m and -O), or with -c and -C, n caches at once\n\
+    -c <s,b,E>\tSimulate this cache too; may be given more than once\n\
+    -C <file>\tSimulate the caches listed in file, as s,b,E each\n\
+    -r <rate>\tWith -m, track only this fraction of the blocks (caches\n\
+      \twith fewer than 1/rate lines per set are reported as biased)\n\
+    -k <blocks>\tWith -m, track at most this many blocks, sampling less\n\
+      \tas needed\n\
     -s <s>\tNumber of set index bits (there are 2**s sets)\n\
     -b <b>\tNumber of block bits (there are 2**b blocks)\n\
     -E <E>\tNumber of lines per set (associativity)\n\
     -t <trace>\tFile name of the memory trace to process\n\
 \n\
-The -s, -b, -E, and -t options must be supplied for all simulations.\n";
+The -s, -b, -E, and -t options must be supplied for all simulations, except\n\
+that -c or -C may stand in for -s, -b and -E.  The trace is then read once\n\
+and a line is printed per cache.\n";
 
 // Credit code and description from 15-122!!
 /* xcalloc(nobj, size) returns a non-NULL pointer to
@@ -83,6 +140,15 @@ static inline void *xcalloc(size_t nobj, size_t size) {
     return p;
 }
 
+static inline void *xrealloc(void *p, size_t nobj, size_t size) {
+    p = realloc(p, nobj * size);
+    if (p == NULL) {
+        fprintf(stderr, "allocation failed\n");
+        abort();
+    }
+    return p;
+}
+
 /**
  * @brief Checks if s, b, and E are valid input parameters to csim
  *
@@ -103,26 +169,186 @@ void check_valid(unsigned long s, unsigned long b, unsigned long E) {
     }
 }
 
+/**
+ * @brief Allocates an empty cache
+ *
+ * @param[in]     s    Number of sets = 2 ** s
+ * @param[in]     b    Number of bytes in a block = 2 ** b
+ * @param[in]     E    Number of lines in a set
+ */
+cache_t *cache_create(unsigned long s, unsigned long b, unsigned long E) {
+    cache_t *cache = xcalloc(1, sizeof(cache_t));
+    cache->s = s;
+    cache->b = b;
+    cache->E = E;
+    cache->B = 1UL << b;
+    unsigned long S = 1UL << s;
+    cache->index = indexing;
+    cache->P = S;
+    if (indexing == INDEX_PRIME) {
+        // largest prime up to S, or 1
+        while (cache->P > 2) {
+            bool prime = true;
+            for (unsigned long d = 2; d * d <= cache->P && prime; d++)
+                prime = cache->P % d != 0;
+            if (prime)
+                break;
+            cache->P--;
+        }
+    }
+    // equivalent to cache[S][E], filled in by cache_set
+    cache->sets = (cache_line **)xcalloc(S, sizeof(cache_line *));
+    return cache;
+}
+
+/**
+ * @brief Returns a set's lines, allocating them on the set's first use
+ *
+ * @param[in]     cache        Cache holding the set
+ * @param[in]     set_index    Index of the set
+ */
+static inline cache_line *cache_set(cache_t *cache, unsigned long set_index) {
+    cache_line *set = cache->sets[set_index];
+    if (set == NULL) {
+        set = (cache_line *)xcalloc(cache->E, sizeof(cache_line));
+        cache->sets[set_index] = set;
+    }
+    return set;
+}
+
+void cache_free(cache_t *cache) {
+    for (unsigned long i = 0; i < (1UL << cache->s); i++)
+        free(cache->sets[i]);
+    free(cache->sets);
+    free(cache);
+}
+
+/**
+ * @brief Finds the set an address maps to, and its tag there
+ *
+ * @param[in]     cache    Cache the address is looked up in (not skewed)
+ * @param[in]     addr     Address to look up
+ * @param[out]    tag      Tag of the address in its set
+ */
+static inline unsigned long cache_index(const cache_t *cache,
+                                        unsigned long addr,
+                                        unsigned long *tag) {
+    unsigned long s = cache->s, b = cache->b;
+    if (s == 0) {
+        *tag = addr >> b;
+        return 0;
+    }
+    switch (cache->index) {
+    case INDEX_XOR: {
+        *tag = addr >> (s + b);
+        unsigned long folded = addr >> b;
+        for (unsigned long rest = *tag; rest != 0; rest >>= s)
+            folded ^= rest;
+        return folded & ((1UL << s) - 1);
+    }
+    case INDEX_PRIME:
+        *tag = (addr >> b) / cache->P;
+        return (addr >> b) % cache->P;
+    default:
+        *tag = addr >> (s + b);
+        return (addr << (64UL - (s + b))) >> (64UL - s);
+    }
+}
+
+/**
+ * @brief Finds the set a block may go in for one way of a skewed cache
+ *
+ * @param[in]     cache    Skewed cache
+ * @param[in]     block    Block number, addr >> b
+ * @param[in]     way      Way of the set
+ */
+static inline unsigned long skew_index(const cache_t *cache,
+                                       unsigned long block,
+                                       unsigned long way) {
+    if (cache->s == 0)
+        return 0;
+    return ((block ^ (way * 0xD6E8FEB86659FD93UL)) * 0x9E3779B97F4A7C15UL) >>
+           (64 - cache->s);
+}
+
+/**
+ * @brief Simulates a load or store into a skewed cache
+ *
+ * @param[in]     cache        Skewed cache to simulate
+ * @param[in]     stats        Statistics to update
+ * @param[in]     addr         Address we are accessing
+ * @param[in]     iteration    "Timestamp" of the operation
+ * @param[in]     is_store     Whether the operation is a store
+ *
+ * Like load and store, but way i of the line holding a block is in set
+ * skew_index(block, i), so the LRU line is found among one line per way.
+ */
+void access_skewed(cache_t *cache, csim_stats_t *stats, unsigned long addr,
+                   unsigned long iteration, bool is_store) {
+    unsigned long E = cache->E, B = cache->B;
+    unsigned long block = addr >> cache->b;
+    cache_line *victim = NULL;
+    for (unsigned long way = 0; way < E; way++) {
+        cache_line *line = &cache_set(cache, skew_index(cache, block, way))[way];
+        if (line->valid_bit && line->tag == block) {
+            if (verbose)
+                fprintf(stderr, "HIT\n");
+            line->LRU_counter = iteration;
+            if (is_store && !line->dirty_bit) {
+                stats->dirty_bytes += B;
+                line->dirty_bit = true;
+            }
+            stats->hits++;
+            return;
+        }
+        // an invalid line beats any valid one, then the least recently used
+        if (victim == NULL ||
+            (victim->valid_bit &&
+             (!line->valid_bit || line->LRU_counter < victim->LRU_counter)))
+            victim = line;
+    }
+
+    stats->misses++;
+    if (victim->valid_bit) {
+        if (verbose)
+            fprintf(stderr, "MISS, but evict!\n");
+        if (victim->dirty_bit) {
+            stats->dirty_bytes -= B;
+            stats->dirty_evictions += B;
+        }
+        stats->evictions++;
+    } else if (verbose) {
+        fprintf(stderr, "MISS, but no evict\n");
+    }
+    if (is_store)
+        stats->dirty_bytes += B;
+    victim->valid_bit = true;
+    victim->dirty_bit = is_store;
+    victim->tag = block;
+    victim->LRU_counter = iteration;
+}
+
 /**
  * @brief Simulates a load into the cache
  * Very similar to store, but the two functions kept separate for clarity
  *
- * @param[in]     cache        2D array of cache lines
+ * @param[in]     cache        Cache to simulate
+ * @param[in]     stats        Statistics to update
  * @param[in]     addr         Address we are reading from
  * @param[in]     iteration    "Timestamp" of load operation
  *
  * Updates cache with result of load operation using a given address
  */
-void load(cache_line **cache, unsigned long addr, unsigned long iteration) {
-    unsigned long addr_set_index, addr_tag;
-    if (s == 0) {
-        addr_set_index = 0;
-        addr_tag = addr >> b;
-    } else {
-        addr_set_index = (addr << (64UL - (s + b))) >> (64UL - s);
-        addr_tag = addr >> (s + b);
+void load(cache_t *cache, csim_stats_t *stats, unsigned long addr,
+          unsigned long iteration) {
+    if (cache->index == INDEX_SKEW) {
+        access_skewed(cache, stats, addr, iteration, false);
+        return;
     }
-    cache_line *curr_set = cache[addr_set_index];
+    unsigned long E = cache->E, B = cache->B;
+    unsigned long addr_tag;
+    unsigned long addr_set_index = cache_index(cache, addr, &addr_tag);
+    cache_line *curr_set = cache_set(cache, addr_set_index);
 
     if (verbose)
         fprintf(stderr, "set index: %lu\n", addr_set_index);
@@ -196,22 +422,23 @@ void load(cache_line **cache, unsigned long addr, unsigned long iteration) {
 /**
  * @brief Simulates a store into the cache
  *
- * @param[in]     cache        2D array of cache lines
+ * @param[in]     cache        Cache to simulate
+ * @param[in]     stats        Statistics to update
  * @param[in]     addr         Address we are reading from
  * @param[in]     iteration    "Timestamp" of load operation
  *
  * Updates cache with result of store operation using a given address
  */
-void store(cache_line **cache, unsigned long addr, unsigned long iteration) {
-    unsigned long addr_set_index, addr_tag;
-    if (s == 0) {
-        addr_set_index = 0;
-        addr_tag = addr >> b;
-    } else {
-        addr_set_index = (addr << (64UL - (s + b))) >> (64UL - s);
-        addr_tag = addr >> (s + b);
+void store(cache_t *cache, csim_stats_t *stats, unsigned long addr,
+           unsigned long iteration) {
+    if (cache->index == INDEX_SKEW) {
+        access_skewed(cache, stats, addr, iteration, true);
+        return;
     }
-    cache_line *curr_set = cache[addr_set_index];
+    unsigned long E = cache->E, B = cache->B;
+    unsigned long addr_tag;
+    unsigned long addr_set_index = cache_index(cache, addr, &addr_tag);
+    cache_line *curr_set = cache_set(cache, addr_set_index);
 
     if (verbose)
         fprintf(stderr, "set index: %lu\n", addr_set_index);
@@ -289,47 +516,1051 @@ void store(cache_line **cache, unsigned long addr, unsigned long iteration) {
     stats->evictions++;
 }
 
+/*
+ * Stack-distance mode
+ *
+ * Under LRU, an access hits in a set of E lines exactly when fewer than E
+ * other blocks of its set were used since the block was last used (its
+ * stack distance).  Recording every access's stack distance, for each set
+ * count 2**0 .. 2**s, therefore gives the misses of every cache with those
+ * set counts and any number of lines per set.
+ *
+ * Each set keeps a Fenwick tree over its own clock, holding a 1 at the time
+ * each of its blocks was last used, so a block's distance is the number of
+ * 1s after its previous use.  When a set's clock runs out, its live times
+ * are renumbered from 0, keeping the tree within twice the set's blocks.
+ *
+ * With sampling (-r, -k), only blocks whose hash is below a threshold are
+ * tracked (SHARDS).  Each of their accesses stands for 1/rate accesses,
+ * and results are scaled back up to the whole trace.  With -k, once more
+ * blocks than that are tracked the threshold drops to untrack the highest
+ * hashes, so memory stays fixed however long the trace.
+ *
+ * Each sampled reuse stands for one at 1/rate times its distance among
+ * tracked blocks, so below about 1/rate lines per set only reuses with no
+ * tracked block in between are told apart, and all of them count as hits.
+ * Small caches come out with too many hits unless the rate is high, so
+ * their error is reported as biased rather than given a width.
+ */
+#define SD_NONE ULONG_MAX
+#define SD_MIN_CAP 8
+#define TWO_64 18446744073709551616.0
+
+typedef struct {
+    long *tree;           // Fenwick tree over the set's clock
+    unsigned long *owner; // block last used at each time, or SD_NONE
+    unsigned long cap, clock, live;
+} sd_set;
+
+typedef struct {
+    sd_set *sets; // 2**level of them
+    double *hist; // reuses at each distance below E
+    double far;   // reuses at distance E or more
+} sd_level;
+
+sd_level *sd_levels;
+unsigned long sd_level_count;
+// accesses in the trace, sampled accesses, and their weight
+unsigned long sd_accesses, sd_sampled;
+double sd_weight, sd_cold;
+
+// tracked blocks hash at or below this; -k, 0 for no limit
+uint64_t sd_threshold = UINT64_MAX;
+unsigned long sd_max_blocks = 0;
+
+// Tracked blocks, numbered in order of first use and found through an open
+// addressing table holding number + 1.  Numbers of untracked blocks are
+// reused.
+unsigned long *sd_blocks;
+uint64_t *sd_hashes;
+unsigned long *sd_times; // sd_level_count per block, the last use in each
+unsigned long sd_block_count, sd_block_room, sd_tracked;
+unsigned long *sd_free, sd_free_count;
+unsigned long *sd_table;
+unsigned long sd_table_bits;
+// -k only, tracked block numbers as a max-heap on hash
+unsigned long *sd_heap, sd_heap_count;
+
+static void fenwick_add(long *tree, unsigned long cap, unsigned long i,
+                        long delta) {
+    for (i++; i <= cap; i += i & -i)
+        tree[i - 1] += delta;
+}
+
+// sum of the first i entries
+static long fenwick_sum(const long *tree, unsigned long i) {
+    long sum = 0;
+    for (; i > 0; i -= i & -i)
+        sum += tree[i - 1];
+    return sum;
+}
+
+static inline uint64_t sd_hash(unsigned long block) {
+    uint64_t x = block;
+    x ^= x >> 30;
+    x *= 0xBF58476D1CE4E5B9UL;
+    x ^= x >> 27;
+    x *= 0x94D049BB133111EBUL;
+    x ^= x >> 31;
+    return x;
+}
+
+static inline double sd_rate(void) {
+    return (sd_threshold + 1.0) / TWO_64;
+}
+
+// tracked hashes are all at or below the threshold, so their top bits are
+// mixed again before picking a slot
+static inline unsigned long sd_slot(uint64_t hash) {
+    return (hash * 0x9E3779B97F4A7C15UL) >> (64 - sd_table_bits);
+}
+
+static void sd_insert_slot(unsigned long n) {
+    unsigned long mask = (1UL << sd_table_bits) - 1;
+    unsigned long i = sd_slot(sd_hashes[n]);
+    while (sd_table[i] != 0)
+        i = (i + 1) & mask;
+    sd_table[i] = n + 1;
+}
+
+// empties block n's slot, moving later entries of its probe run back
+static void sd_remove_slot(unsigned long n) {
+    unsigned long mask = (1UL << sd_table_bits) - 1;
+    unsigned long i = sd_slot(sd_hashes[n]);
+    while (sd_table[i] != n + 1)
+        i = (i + 1) & mask;
+    sd_table[i] = 0;
+    for (unsigned long j = (i + 1) & mask; sd_table[j] != 0;
+         j = (j + 1) & mask) {
+        unsigned long k = sd_slot(sd_hashes[sd_table[j] - 1]);
+        // the entry at j stays if its home is cyclically in (i, j]
+        if (i <= j ? (i < k && k <= j) : (i < k || k <= j))
+            continue;
+        sd_table[i] = sd_table[j];
+        sd_table[j] = 0;
+        i = j;
+    }
+}
+
+static void sd_heap_push(unsigned long n) {
+    unsigned long i = sd_heap_count++;
+    while (i > 0 && sd_hashes[sd_heap[(i - 1) / 2]] < sd_hashes[n]) {
+        sd_heap[i] = sd_heap[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    sd_heap[i] = n;
+}
+
+static unsigned long sd_heap_pop(void) {
+    unsigned long top = sd_heap[0];
+    unsigned long n = sd_heap[--sd_heap_count];
+    unsigned long i = 0;
+    for (unsigned long c = 1; c < sd_heap_count; c = 2 * i + 1) {
+        if (c + 1 < sd_heap_count &&
+            sd_hashes[sd_heap[c + 1]] > sd_hashes[sd_heap[c]])
+            c++;
+        if (sd_hashes[sd_heap[c]] <= sd_hashes[n])
+            break;
+        sd_heap[i] = sd_heap[c];
+        i = c;
+    }
+    sd_heap[i] = n;
+    return top;
+}
+
+/**
+ * @brief Finds a tracked block's number, numbering it if it is new
+ *
+ * @param[in]     block        Block address (addr >> b)
+ * @param[in]     hash         sd_hash(block)
+ * @param[out]    is_new       Whether this is the block's first use
+ */
+unsigned long sd_find(unsigned long block, uint64_t hash, bool *is_new) {
+    unsigned long mask = (1UL << sd_table_bits) - 1;
+    for (unsigned long i = sd_slot(hash); sd_table[i] != 0;
+         i = (i + 1) & mask) {
+        if (sd_blocks[sd_table[i] - 1] == block) {
+            *is_new = false;
+            return sd_table[i] - 1;
+        }
+    }
+
+    *is_new = true;
+    unsigned long n;
+    if (sd_free_count > 0) {
+        n = sd_free[--sd_free_count];
+    } else {
+        n = sd_block_count++;
+        if (n == sd_block_room) {
+            sd_block_room *= 2;
+            sd_blocks =
+                xrealloc(sd_blocks, sd_block_room, sizeof(unsigned long));
+            sd_hashes = xrealloc(sd_hashes, sd_block_room, sizeof(uint64_t));
+            sd_times = xrealloc(sd_times, sd_block_room * sd_level_count,
+                                sizeof(unsigned long));
+            sd_free = xrealloc(sd_free, sd_block_room, sizeof(unsigned long));
+            if (sd_max_blocks > 0)
+                sd_heap =
+                    xrealloc(sd_heap, sd_block_room, sizeof(unsigned long));
+        }
+    }
+    sd_blocks[n] = block;
+    sd_hashes[n] = hash;
+    for (unsigned long l = 0; l < sd_level_count; l++)
+        sd_times[n * sd_level_count + l] = SD_NONE;
+    if (sd_max_blocks > 0)
+        sd_heap_push(n);
+
+    // keep the table at most half full
+    sd_tracked++;
+    if (2 * sd_tracked > (1UL << sd_table_bits)) {
+        free(sd_table);
+        sd_table_bits++;
+        sd_table = xcalloc(1UL << sd_table_bits, sizeof(unsigned long));
+        for (unsigned long i = 0; i < sd_block_count; i++) {
+            if (sd_times[i * sd_level_count] != SD_NONE)
+                sd_insert_slot(i);
+        }
+    }
+    sd_insert_slot(n);
+    return n;
+}
+
+/**
+ * @brief Renumbers a set's live times from 0, making room for as many again
+ *
+ * @param[in]     set          Set whose clock has run out
+ * @param[in]     level        Set count (2**level) the set belongs to
+ */
+void sd_compact(sd_set *set, unsigned long level) {
+    unsigned long cap = 2 * set->live > SD_MIN_CAP ? 2 * set->live : SD_MIN_CAP;
+    long *tree = xcalloc(cap, sizeof(long));
+    unsigned long *owner = xcalloc(cap, sizeof(unsigned long));
+    unsigned long time = 0;
+    for (unsigned long i = 0; i < set->clock; i++) {
+        if (set->owner[i] == SD_NONE)
+            continue;
+        owner[time] = set->owner[i];
+        sd_times[owner[time] * sd_level_count + level] = time;
+        fenwick_add(tree, cap, time, 1);
+        time++;
+    }
+    free(set->tree);
+    free(set->owner);
+    set->tree = tree;
+    set->owner = owner;
+    set->cap = cap;
+    set->clock = time;
+}
+
+static inline sd_set *sd_set_of(unsigned long level, unsigned long block) {
+    return &sd_levels[level].sets[block & ((1UL << level) - 1)];
+}
+
+// drops block n's last use from a set
+static void sd_forget(sd_set *set, unsigned long level, unsigned long n) {
+    unsigned long *last = &sd_times[n * sd_level_count + level];
+    fenwick_add(set->tree, set->cap, *last, -1);
+    set->owner[*last] = SD_NONE;
+    set->live--;
+    *last = SD_NONE;
+}
+
+/**
+ * @brief Uses a block in a set, returning its stack distance there
+ *
+ * @param[in]     set          Set the block maps to
+ * @param[in]     level        Set count (2**level) the set belongs to
+ * @param[in]     n            Block number
+ *
+ * Returns SD_NONE on the block's first use
+ */
+unsigned long sd_use(sd_set *set, unsigned long level, unsigned long n) {
+    unsigned long last = sd_times[n * sd_level_count + level];
+    unsigned long distance = SD_NONE;
+    if (last != SD_NONE) {
+        distance = set->live - fenwick_sum(set->tree, last + 1);
+        sd_forget(set, level, n);
+    }
+    if (set->clock == set->cap)
+        sd_compact(set, level);
+    set->owner[set->clock] = n;
+    fenwick_add(set->tree, set->cap, set->clock, 1);
+    sd_times[n * sd_level_count + level] = set->clock++;
+    set->live++;
+    return distance;
+}
+
+// untracks the block with the highest hash, and every block hashing as high
+static void sd_untrack_top(void) {
+    unsigned long n = sd_heap_pop();
+    sd_threshold = sd_hashes[n] - 1;
+    for (unsigned long l = 0; l < sd_level_count; l++)
+        sd_forget(sd_set_of(l, sd_blocks[n]), l, n);
+    sd_remove_slot(n);
+    sd_free[sd_free_count++] = n;
+    sd_tracked--;
+}
+
+void stack_distance_init(void) {
+    sd_level_count = s + 1;
+    sd_levels = xcalloc(sd_level_count, sizeof(sd_level));
+    for (unsigned long l = 0; l < sd_level_count; l++) {
+        sd_levels[l].sets = xcalloc(1UL << l, sizeof(sd_set));
+        sd_levels[l].hist = xcalloc(E, sizeof(double));
+    }
+    sd_block_room = 1024;
+    sd_blocks = xcalloc(sd_block_room, sizeof(unsigned long));
+    sd_hashes = xcalloc(sd_block_room, sizeof(uint64_t));
+    sd_times = xcalloc(sd_block_room * sd_level_count, sizeof(unsigned long));
+    sd_free = xcalloc(sd_block_room, sizeof(unsigned long));
+    if (sd_max_blocks > 0)
+        sd_heap = xcalloc(sd_block_room, sizeof(unsigned long));
+    sd_table_bits = 11;
+    sd_table = xcalloc(1UL << sd_table_bits, sizeof(unsigned long));
+}
+
+/**
+ * @brief Records the stack distance of an access at every set count
+ *
+ * @param[in]     addr         Address accessed
+ */
+void stack_distance_access(unsigned long addr) {
+    unsigned long block = addr >> b;
+    uint64_t hash = sd_hash(block);
+    sd_accesses++;
+    if (hash > sd_threshold)
+        return;
+
+    double scale = 1.0 / sd_rate();
+    sd_sampled++;
+    sd_weight += scale;
+    bool is_new;
+    unsigned long n = sd_find(block, hash, &is_new);
+    if (is_new)
+        sd_cold += scale;
+    for (unsigned long l = 0; l < sd_level_count; l++) {
+        sd_level *lv = &sd_levels[l];
+        unsigned long distance = sd_use(sd_set_of(l, block), l, n);
+        if (verbose)
+            fprintf(stderr, "s=%lu distance %ld\n", l, (long)distance);
+        if (distance == SD_NONE)
+            continue;
+        double scaled = distance * scale;
+        if (scaled < E)
+            lv->hist[(unsigned long)scaled] += scale;
+        else
+            lv->far += scale;
+    }
+
+    while (sd_max_blocks > 0 && sd_tracked > sd_max_blocks)
+        sd_untrack_top();
+}
+
+/**
+ * @brief Prints one line per cache shape covered by the histograms
+ *
+ * A cache with E' lines per set misses on first uses and on reuses at
+ * distance E' or more, and evicts on every miss except those filling one of
+ * the set's first E' lines.  When sampling, counts are scaled to the whole
+ * trace, and each line ends with the half width of a 95% confidence
+ * interval on its misses, or with error:biased if it has fewer than 1/rate
+ * lines per set, which sampling cannot resolve.
+ */
+void stack_distance_report(void) {
+    bool sampled = sd_sampled < sd_accesses;
+    double rate = sd_rate();
+    // a set with c tracked blocks holds about c / rate
+    unsigned long most = (unsigned long)ceil(E / rate);
+    double *misses = xcalloc(E + 1, sizeof(double));
+    unsigned long *occupancy = xcalloc(most + 1, sizeof(unsigned long));
+    double to_trace = sd_weight > 0 ? sd_accesses / sd_weight : 0;
+    if (sampled)
+        printf("sampled:%lu accesses:%lu rate:%.6f\n", sd_sampled,
+               sd_accesses, rate);
+
+    for (unsigned long l = 0; l < sd_level_count; l++) {
+        sd_level *lv = &sd_levels[l];
+        unsigned long sets = 1UL << l;
+
+        misses[E] = sd_cold + lv->far;
+        for (unsigned long e = E; e > 1; e--)
+            misses[e - 1] = misses[e] + lv->hist[e - 1];
+
+        // sets by the number of blocks tracked in them, up to most
+        memset(occupancy, 0, (most + 1) * sizeof(unsigned long));
+        for (unsigned long i = 0; i < sets; i++)
+            occupancy[lv->sets[i].live < most ? lv->sets[i].live : most]++;
+
+        for (unsigned long e = 1; e <= E; e++) {
+            double filled = 0;
+            for (unsigned long c = 0; c <= most; c++)
+                filled += fmin(c / rate, e) * occupancy[c];
+            unsigned long m = lround(misses[e] * to_trace);
+            unsigned long evictions = m > filled ? lround(m - filled) : 0;
+            printf("s:%lu E:%lu bytes:%lu hits:%lu misses:%lu evictions:%lu",
+                   l, e, (sets * e) << b, sd_accesses - m, m, evictions);
+            if (sampled && e * rate < 1) {
+                printf(" error:biased");
+            } else if (sampled) {
+                double p = (double)m / sd_accesses;
+                printf(" error:%lu",
+                       lround(1.96 * sqrt(p * (1 - p) / sd_sampled) *
+                              sd_accesses));
+            }
+            printf("\n");
+        }
+    }
+    free(misses);
+    free(occupancy);
+}
+
+void stack_distance_free(void) {
+    for (unsigned long l = 0; l < sd_level_count; l++) {
+        for (unsigned long i = 0; i < (1UL << l); i++) {
+            free(sd_levels[l].sets[i].tree);
+            free(sd_levels[l].sets[i].owner);
+        }
+        free(sd_levels[l].sets);
+        free(sd_levels[l].hist);
+    }
+    free(sd_levels);
+    free(sd_blocks);
+    free(sd_hashes);
+    free(sd_times);
+    free(sd_free);
+    free(sd_heap);
+    free(sd_table);
+}
+
+static inline int hex_digit(char c) {
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+/**
+ * @brief Parses the usual "op addr,size" line without sscanf
+ *
+ * @param[in]     line         Line, ending in '\n'
+ * @param[out]    op           Operation
+ * @param[out]    addr         Address accessed
+ * @param[out]    size         Bytes accessed
+ *
+ * Only takes lines that sscanf would read the same way: at most 16 hex
+ * digits, a decimal size with no leading zero, and nothing after it.
+ *
+ * @return true if the line was parsed
+ */
+static bool parse_simple(const char *line, char *op, unsigned long *addr,
+                         unsigned int *size) {
+    const char *p = line + 1;
+    while (*p == ' ')
+        p++;
+    unsigned long a = 0;
+    int digits = 0, d;
+    for (; (d = hex_digit(*p)) >= 0; p++, digits++)
+        a = a << 4 | (unsigned long)d;
+    if (digits == 0 || digits > 16 || *p++ != ',')
+        return false;
+    if (*p == '0' && p[1] != '\n')
+        return false;
+    unsigned int n = 0;
+    for (digits = 0; *p >= '0' && *p <= '9'; p++, digits++)
+        n = n * 10 + (unsigned int)(*p - '0');
+    if (digits == 0 || digits > 9 || *p != '\n')
+        return false;
+    *op = line[0];
+    *addr = a;
+    *size = n;
+    return true;
+}
+
+/**
+ * @brief Reads the next access from a trace file
+ *
+ * @param[in]     tfp          Trace file
+ * @param[out]    op           Operation
+ * @param[out]    addr         Address accessed
+ * @param[out]    size         Bytes accessed
+ *
+ * @return 1 if an access was read, 0 at the end of the trace, -1 on errors
+ */
+int read_access(FILE *tfp, char *op, unsigned long *addr, unsigned int *size) {
+    char linebuf[LINELEN]; // How big should LINELEN be?
+    if (!fgets(linebuf, LINELEN, tfp))
+        return 0;
+    // What do you do if the line is longer than LINELEN-1 chars?
+    size_t linebuflen = strlen(linebuf);
+    if (linebuf[linebuflen - 1] != '\n') {
+        fprintf(stderr, "AHHH 2 long\n");
+        return -1; // error, line is too long
+    }
+    if (parse_simple(linebuf, op, addr, size))
+        return 1;
+    // What do you do if the line is incorrect?
+    if (sscanf(linebuf, "%c %lx,%i", op, addr, size) != 3) {
+        fprintf(stderr, "AHHH incorrect\n");
+        return -1; // error, line does not parse properly
+    }
+    return 1;
+}
+
+/*
+ * Threaded simulation (-j)
+ *
+ * Under LRU, sets never affect one another, so each worker owns a range of
+ * them, with its own statistics.  The reading thread parses the trace and
+ * passes each access, stamped with its line number as the serial run would
+ * stamp it, to the worker owning its set; summing the workers' statistics
+ * at the end gives exactly the serial results.
+ */
+typedef struct {
+    unsigned long addr;
+    unsigned long iteration;
+    char op;
+} access_t;
+
+typedef struct {
+    access_t accesses[BATCH_LEN];
+    size_t len;
+} batch_t;
+
+typedef struct {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    batch_t *queue[QUEUE_DEPTH]; // a NULL batch ends the trace
+    size_t head, count;
+    batch_t *filling; // batch the reader is adding to
+    cache_t *cache;
+    csim_stats_t stats;
+} worker_t;
+
+/**
+ * @brief Queues a batch for a worker, waiting while its queue is full
+ *
+ * @param[in]     w            Worker
+ * @param[in]     batch        Batch, or NULL to end the trace
+ */
+void worker_send(worker_t *w, batch_t *batch) {
+    pthread_mutex_lock(&w->lock);
+    while (w->count == QUEUE_DEPTH)
+        pthread_cond_wait(&w->changed, &w->lock);
+    w->queue[(w->head + w->count) % QUEUE_DEPTH] = batch;
+    w->count++;
+    pthread_cond_signal(&w->changed);
+    pthread_mutex_unlock(&w->lock);
+}
+
+void *worker_main(void *arg) {
+    worker_t *w = arg;
+    for (;;) {
+        pthread_mutex_lock(&w->lock);
+        while (w->count == 0)
+            pthread_cond_wait(&w->changed, &w->lock);
+        batch_t *batch = w->queue[w->head];
+        w->head = (w->head + 1) % QUEUE_DEPTH;
+        w->count--;
+        pthread_cond_signal(&w->changed);
+        pthread_mutex_unlock(&w->lock);
+        if (batch == NULL)
+            return NULL;
+
+        for (size_t i = 0; i < batch->len; i++) {
+            access_t *a = &batch->accesses[i];
+            if (a->op == 'L')
+                load(w->cache, &w->stats, a->addr, a->iteration);
+            else
+                store(w->cache, &w->stats, a->addr, a->iteration);
+        }
+        free(batch);
+    }
+}
+
+/**
+ * @brief Simulates a trace file on worker threads
+ *
+ * @param[in]     tfp          Open trace file
+ * @param[in]     cache        Cache to simulate
+ * @param[in]     stats        Statistics to add the workers' to
+ *
+ * @return 0 if successful, 1 if there were errors
+ */
+int process_trace_threaded(FILE *tfp, cache_t *cache,
+                           csim_stats_t *stats) {
+    unsigned long S = 1UL << s;
+    unsigned long n = threads < S ? threads : S;
+    // sets per worker, rounded up
+    unsigned long per = (S + n - 1) / n;
+    n = (S + per - 1) / per;
+    worker_t *workers = xcalloc(n, sizeof(worker_t));
+    for (unsigned long i = 0; i < n; i++) {
+        worker_t *w = &workers[i];
+        pthread_mutex_init(&w->lock, NULL);
+        pthread_cond_init(&w->changed, NULL);
+        w->cache = cache;
+        w->filling = xcalloc(1, sizeof(batch_t));
+        if (pthread_create(&w->thread, NULL, worker_main, w) != 0) {
+            fprintf(stderr, "could not start worker thread\n");
+            exit(1);
+        }
+    }
+
+    int result;
+    unsigned long iteration = 0;
+    char op;
+    unsigned long addr;
+    unsigned int size;
+    while ((result = read_access(tfp, &op, &addr, &size)) == 1) {
+        if (op == 'L' || op == 'S') {
+            unsigned long tag;
+            worker_t *w = &workers[cache_index(cache, addr, &tag) / per];
+            w->filling->accesses[w->filling->len++] =
+                (access_t){addr, iteration, op};
+            if (w->filling->len == BATCH_LEN) {
+                worker_send(w, w->filling);
+                w->filling = xcalloc(1, sizeof(batch_t));
+            }
+        }
+        iteration++;
+    }
+
+    for (unsigned long i = 0; i < n; i++) {
+        worker_t *w = &workers[i];
+        if (result == 0 && w->filling->len > 0)
+            worker_send(w, w->filling);
+        else
+            free(w->filling);
+        worker_send(w, NULL);
+    }
+    for (unsigned long i = 0; i < n; i++) {
+        worker_t *w = &workers[i];
+        pthread_join(w->thread, NULL);
+        pthread_mutex_destroy(&w->lock);
+        pthread_cond_destroy(&w->changed);
+        stats->hits += w->stats.hits;
+        stats->misses += w->stats.misses;
+        stats->evictions += w->stats.evictions;
+        stats->dirty_bytes += w->stats.dirty_bytes;
+        stats->dirty_evictions += w->stats.dirty_evictions;
+    }
+    free(workers);
+    return result < 0;
+}
+
+/*
+ * Belady's OPT (-O)
+ *
+ * OPT evicts the line whose next use is furthest away.  Lines are stamped
+ * with ULONG_MAX minus the position of their block's next use rather than
+ * with their last use, so the line LRU picks is the line OPT picks.  Lines
+ * with no next use in sight are stamped with their own position instead,
+ * below every known next use, and go in LRU order among themselves.
+ *
+ * Next uses are found by reading ahead of the simulation: each access read
+ * becomes the next use of the last waiting access to its block.  With -w,
+ * only that many accesses wait, so next uses further out are not seen;
+ * without it, the whole trace is read before simulating.
+ */
+#define OPT_NEVER ULONG_MAX
+
+typedef struct {
+    unsigned long addr;
+    unsigned long next; // position of the next use, or OPT_NEVER
+    bool is_store;
+} opt_access;
+
+bool use_opt = false;
+unsigned long opt_window = ULONG_MAX;
+// accesses read but not yet simulated, at position & (opt_room - 1)
+opt_access *opt_ring;
+unsigned long opt_room, opt_first, opt_waiting;
+// block -> position + 1 of its last waiting access, open addressing
+unsigned long *opt_keys, *opt_values;
+unsigned long opt_map_bits, opt_map_used;
+
+static inline unsigned long opt_slot(unsigned long block) {
+    return (block * 0x9E3779B97F4A7C15UL) >> (64 - opt_map_bits);
+}
+
+// slot holding block, or the empty slot ending its probe run
+static unsigned long opt_find(unsigned long block) {
+    unsigned long mask = (1UL << opt_map_bits) - 1;
+    unsigned long i = opt_slot(block);
+    while (opt_values[i] != 0 && opt_keys[i] != block)
+        i = (i + 1) & mask;
+    return i;
+}
+
+// empties slot i, moving later entries of its probe run back
+static void opt_remove(unsigned long i) {
+    unsigned long mask = (1UL << opt_map_bits) - 1;
+    opt_values[i] = 0;
+    opt_map_used--;
+    for (unsigned long j = (i + 1) & mask; opt_values[j] != 0;
+         j = (j + 1) & mask) {
+        unsigned long k = opt_slot(opt_keys[j]);
+        // the entry at j stays if its home is cyclically in (i, j]
+        if (i <= j ? (i < k && k <= j) : (i < k || k <= j))
+            continue;
+        opt_keys[i] = opt_keys[j];
+        opt_values[i] = opt_values[j];
+        opt_values[j] = 0;
+        i = j;
+    }
+}
+
+static void opt_grow_map(void) {
+    unsigned long *keys = opt_keys, *values = opt_values;
+    unsigned long old = 1UL << opt_map_bits;
+    opt_map_bits++;
+    opt_keys = xcalloc(1UL << opt_map_bits, sizeof(unsigned long));
+    opt_values = xcalloc(1UL << opt_map_bits, sizeof(unsigned long));
+    for (unsigned long i = 0; i < old; i++) {
+        if (values[i] == 0)
+            continue;
+        unsigned long j = opt_find(keys[i]);
+        opt_keys[j] = keys[i];
+        opt_values[j] = values[i];
+    }
+    free(keys);
+    free(values);
+}
+
+static void opt_grow_ring(void) {
+    opt_access *ring = opt_ring;
+    unsigned long old = opt_room;
+    opt_room *= 2;
+    opt_ring = xcalloc(opt_room, sizeof(opt_access));
+    for (unsigned long p = opt_first; p < opt_first + opt_waiting; p++)
+        opt_ring[p & (opt_room - 1)] = ring[p & (old - 1)];
+    free(ring);
+}
+
+/**
+ * @brief Adds an access to those waiting, setting its block's last one's
+ * next use
+ *
+ * @param[in]     addr         Address accessed
+ * @param[in]     is_store     Whether the access is a store
+ */
+void opt_read(unsigned long addr, bool is_store) {
+    if (opt_waiting == opt_room)
+        opt_grow_ring();
+    unsigned long pos = opt_first + opt_waiting++;
+    opt_ring[pos & (opt_room - 1)] = (opt_access){addr, OPT_NEVER, is_store};
+
+    unsigned long i = opt_find(addr >> b);
+    if (opt_values[i] != 0) {
+        opt_ring[(opt_values[i] - 1) & (opt_room - 1)].next = pos;
+    } else {
+        opt_keys[i] = addr >> b;
+        opt_map_used++;
+    }
+    opt_values[i] = pos + 1;
+    if (2 * opt_map_used > (1UL << opt_map_bits))
+        opt_grow_map();
+}
+
+/**
+ * @brief Simulates the oldest waiting access
+ *
+ * @param[in]     cache        Cache to simulate
+ * @param[in]     stats        Statistics to update
+ */
+void opt_simulate(cache_t *cache, csim_stats_t *stats) {
+    unsigned long pos = opt_first++;
+    opt_access *a = &opt_ring[pos & (opt_room - 1)];
+    opt_waiting--;
+    unsigned long stamp = a->next == OPT_NEVER ? pos : ULONG_MAX - a->next;
+    if (verbose)
+        fprintf(stderr, "%c %lx ", a->is_store ? 'S' : 'L', a->addr);
+    if (a->is_store)
+        store(cache, stats, a->addr, stamp);
+    else
+        load(cache, stats, a->addr, stamp);
+
+    unsigned long i = opt_find(a->addr >> b);
+    if (opt_values[i] == pos + 1)
+        opt_remove(i);
+}
+
+/**
+ * @brief Simulates a trace file under OPT
+ *
+ * @param[in]     tfp          Open trace file
+ * @param[in]     cache        Cache to simulate
+ * @param[in]     stats        Statistics to update
+ *
+ * @return 0 if successful, 1 if there were errors
+ */
+int process_trace_opt(FILE *tfp, cache_t *cache, csim_stats_t *stats) {
+    opt_room = 1024;
+    opt_ring = xcalloc(opt_room, sizeof(opt_access));
+    opt_map_bits = 11;
+    opt_keys = xcalloc(1UL << opt_map_bits, sizeof(unsigned long));
+    opt_values = xcalloc(1UL << opt_map_bits, sizeof(unsigned long));
+
+    char op;
+    unsigned long addr;
+    unsigned int size;
+    int result;
+    while ((result = read_access(tfp, &op, &addr, &size)) == 1) {
+        if (op != 'L' && op != 'S')
+            continue;
+        opt_read(addr, op == 'S');
+        if (opt_waiting > opt_window)
+            opt_simulate(cache, stats);
+    }
+    while (result == 0 && opt_waiting > 0)
+        opt_simulate(cache, stats);
+
+    free(opt_ring);
+    free(opt_keys);
+    free(opt_values);
+    return result < 0;
+}
+
 /** Process a memory-access trace file.
  *
  * @param trace Name of the trace file to process .
  * @return 0 if successful , 1 if there were errors.
  */
-int process_trace_file(const char *trace, cache_line **cache) {
+int process_trace_file(const char *trace, cache_t *cache,
+                       csim_stats_t *stats) {
     FILE *tfp = fopen(trace, "rt");
     if (!tfp) {
         fprintf(stderr, "Error opening '%s': %s\n", trace, strerror(errno));
         return 1;
     }
+    if (use_opt) {
+        int result = process_trace_opt(tfp, cache, stats);
+        fclose(tfp);
+        return result;
+    }
+    if (threads > 1 && !verbose && !stack_distance &&
+        cache->index != INDEX_SKEW) {
+        int result = process_trace_threaded(tfp, cache, stats);
+        fclose(tfp);
+        return result;
+    }
     unsigned long iteration = 0;
-    char linebuf[LINELEN]; // How big should LINELEN be?
-    while (fgets(linebuf, LINELEN, tfp)) {
-        // What do you do if the line is longer than LINELEN-1 chars?
-        size_t linebuflen = strlen(linebuf);
-        if (linebuf[linebuflen - 1] != '\n') {
-            fprintf(stderr, "AHHH 2 long\n");
-            return 1; // error, line is too long
-        }
-        // Parse the line of text in 'linebuf'.
-        char op;
-        unsigned long addr;
-        unsigned int size;
-        // What do you do if the line is incorrect?
-        if (sscanf(linebuf, "%c %lx,%i", &op, &addr, &size) != 3) {
-            fprintf(stderr, "AHHH incorrect\n");
-            return 1; // error, line does not parse properly
-        }
+    char op;
+    unsigned long addr;
+    unsigned int size;
+    int result;
+    while ((result = read_access(tfp, &op, &addr, &size)) == 1) {
         if (verbose)
             fprintf(stderr, "%c %lx,%i ", op, addr, size);
-        if (op == 'L')
-            load(cache, addr, iteration);
-        if (op == 'S')
-            store(cache, addr, iteration);
+        if (stack_distance && (op == 'L' || op == 'S'))
+            stack_distance_access(addr);
+        else if (op == 'L')
+            load(cache, stats, addr, iteration);
+        else if (op == 'S')
+            store(cache, stats, addr, iteration);
         iteration++;
     }
+    if (result < 0)
+        return 1;
     fclose(tfp);
     return 0;
 }
 
+/*
+ * Batch mode (-c, -C)
+ *
+ * The trace is parsed once into an array of its loads and stores, and each
+ * cache is then simulated over the array on a pool of -j threads.  An
+ * access's index in the array stands in for its line number as the LRU
+ * stamp; only their order matters, so each cache gets the results of a
+ * separate run.
+ */
+typedef struct {
+    unsigned long s, b, E;
+    csim_stats_t stats;
+} config_t;
+
+typedef struct {
+    unsigned long *addrs;
+    uint64_t *stores; // bit i set if access i is a store
+    unsigned long len, room;
+} trace_t;
+
+typedef struct {
+    const trace_t *trace;
+    config_t *configs;
+    unsigned long count, next;
+    pthread_mutex_t lock;
+} pool_t;
+
+config_t *configs;
+unsigned long config_count, config_room;
+
+/**
+ * @brief Adds a cache to simulate in batch mode
+ *
+ * @param[in]     spec         Cache as "s,b,E"
+ */
+void add_config(const char *spec) {
+    unsigned long cs, cb, cE;
+    int end = 0;
+    if (sscanf(spec, "%lu,%lu,%lu%n", &cs, &cb, &cE, &end) != 3 ||
+        spec[end] != '\0') {
+        fprintf(stderr, "bad cache '%s', expected s,b,E\n", spec);
+        exit(1);
+    }
+    check_valid(cs, cb, cE);
+    if (config_count == config_room) {
+        config_room = config_room ? 2 * config_room : 16;
+        configs = xrealloc(configs, config_room, sizeof(config_t));
+    }
+    configs[config_count++] = (config_t){.s = cs, .b = cb, .E = cE};
+}
+
+/**
+ * @brief Adds the caches listed in a file, as s,b,E separated by
+ * whitespace, with '#' starting a comment
+ *
+ * @param[in]     path         File name
+ */
+void read_configs(const char *path) {
+    FILE *fp = fopen(path, "rt");
+    if (!fp) {
+        fprintf(stderr, "Error opening '%s': %s\n", path, strerror(errno));
+        exit(1);
+    }
+    char line[256];
+    while (fgets(line, sizeof(line), fp)) {
+        char *comment = strchr(line, '#');
+        if (comment)
+            *comment = '\0';
+        for (char *tok = strtok(line, " \t\r\n"); tok;
+             tok = strtok(NULL, " \t\r\n"))
+            add_config(tok);
+    }
+    fclose(fp);
+}
+
+/**
+ * @brief Reads a trace file's loads and stores into memory
+ *
+ * @param[in]     path         Trace file name
+ * @param[out]    trace        Accesses read
+ *
+ * @return 0 if successful, 1 if there were errors
+ */
+int load_trace(const char *path, trace_t *trace) {
+    FILE *tfp = fopen(path, "rt");
+    if (!tfp) {
+        fprintf(stderr, "Error opening '%s': %s\n", path, strerror(errno));
+        return 1;
+    }
+    trace->room = 1UL << 16;
+    trace->addrs = xcalloc(trace->room, sizeof(unsigned long));
+    trace->stores = xcalloc(trace->room / 64, sizeof(uint64_t));
+    char op;
+    unsigned long addr;
+    unsigned int size;
+    int result;
+    while ((result = read_access(tfp, &op, &addr, &size)) == 1) {
+        if (op != 'L' && op != 'S')
+            continue;
+        if (trace->len == trace->room) {
+            trace->room *= 2;
+            trace->addrs =
+                xrealloc(trace->addrs, trace->room, sizeof(unsigned long));
+            trace->stores =
+                xrealloc(trace->stores, trace->room / 64, sizeof(uint64_t));
+            memset(trace->stores + trace->len / 64, 0,
+                   (trace->room - trace->len) / 8);
+        }
+        trace->addrs[trace->len] = addr;
+        if (op == 'S')
+            trace->stores[trace->len / 64] |= 1UL << (trace->len % 64);
+        trace->len++;
+    }
+    fclose(tfp);
+    return result < 0;
+}
+
+/**
+ * @brief Simulates one cache over a trace read by load_trace
+ *
+ * @param[in]     trace        Accesses
+ * @param[in]     config       Cache to simulate, and its results
+ */
+void simulate_config(const trace_t *trace, config_t *config) {
+    cache_t *cache = cache_create(config->s, config->b, config->E);
+    for (unsigned long i = 0; i < trace->len; i++) {
+        bool is_store = (trace->stores[i / 64] >> (i % 64)) & 1;
+        if (verbose)
+            fprintf(stderr, "%c %lx ", is_store ? 'S' : 'L', trace->addrs[i]);
+        if (is_store)
+            store(cache, &config->stats, trace->addrs[i], i);
+        else
+            load(cache, &config->stats, trace->addrs[i], i);
+    }
+    cache_free(cache);
+}
+
+void *pool_main(void *arg) {
+    pool_t *pool = arg;
+    for (;;) {
+        pthread_mutex_lock(&pool->lock);
+        unsigned long i = pool->next++;
+        pthread_mutex_unlock(&pool->lock);
+        if (i >= pool->count)
+            return NULL;
+        simulate_config(pool->trace, &pool->configs[i]);
+    }
+}
+
+/**
+ * @brief Simulates every cache added by -c and -C over one trace, printing
+ * a summary line for each, in order
+ *
+ * @param[in]     path         Trace file name
+ *
+ * @return 0 if successful, 1 if there were errors
+ */
+int run_batch(const char *path) {
+    trace_t trace = {0};
+    if (load_trace(path, &trace))
+        return 1;
+
+    pool_t pool = {.trace = &trace, .configs = configs, .count = config_count};
+    pthread_mutex_init(&pool.lock, NULL);
+    // verbose output would interleave; the calling thread is one of the n
+    unsigned long n = verbose ? 1 : threads;
+    if (n > config_count)
+        n = config_count;
+    pthread_t *pool_threads = xcalloc(n, sizeof(pthread_t));
+    for (unsigned long i = 1; i < n; i++) {
+        if (pthread_create(&pool_threads[i], NULL, pool_main, &pool) != 0) {
+            fprintf(stderr, "could not start worker thread\n");
+            exit(1);
+        }
+    }
+    pool_main(&pool);
+    for (unsigned long i = 1; i < n; i++)
+        pthread_join(pool_threads[i], NULL);
+    pthread_mutex_destroy(&pool.lock);
+    free(pool_threads);
+
+    for (unsigned long i = 0; i < config_count; i++) {
+        printf("s:%lu b:%lu E:%lu ", configs[i].s, configs[i].b, configs[i].E);
+        printSummary(&configs[i].stats);
+    }
+    free(trace.addrs);
+    free(trace.stores);
+    return 0;
+}
+
 /**
  * @brief Parses command line arguments, initializes variables required
  * for the simulator and frees memory at the end
@@ -338,10 +1569,11 @@ int process_trace_file(const char *trace, cache_line **cache) {
  */
 int main(int argc, char **argv) {
     int opt;
-    bool s_flag, b_flag, E_flag, t_flag = false;
+    bool s_flag = false, b_flag = false, E_flag = false, t_flag = false;
+    bool sample_flag = false;
     char *t;
     // parse command line arguments
-    while ((opt = getopt(argc, argv, "s:b:E:t:vh")) != -1) {
+    while ((opt = getopt(argc, argv, "s:b:E:t:c:C:vmOw:H:j:r:k:h")) != -1) {
         switch (opt) {
         case 'h':
             fprintf(stderr, helpstr);
@@ -363,9 +1595,64 @@ int main(int argc, char **argv) {
             t_flag = true;
             t = optarg;
             break;
+        case 'c':
+            add_config(optarg);
+            break;
+        case 'C':
+            read_configs(optarg);
+            break;
         case 'v':
             verbose = true;
             break;
+        case 'm':
+            stack_distance = true;
+            break;
+        case 'O':
+            use_opt = true;
+            break;
+        case 'w':
+            opt_window = strtoul(optarg, NULL, 10);
+            if (opt_window == 0) {
+                fprintf(stderr, "-w must be positive\n");
+                exit(1);
+            }
+            break;
+        case 'H':
+            if (strcmp(optarg, "bits") == 0)
+                indexing = INDEX_BITS;
+            else if (strcmp(optarg, "xor") == 0)
+                indexing = INDEX_XOR;
+            else if (strcmp(optarg, "prime") == 0)
+                indexing = INDEX_PRIME;
+            else if (strcmp(optarg, "skew") == 0)
+                indexing = INDEX_SKEW;
+            else {
+                fprintf(stderr, "unknown index function %s\n", optarg);
+                exit(1);
+            }
+            break;
+        case 'j':
+            threads = strtoul(optarg, NULL, 10);
+            if (threads == 0) {
+                fprintf(stderr, "-j must be positive\n");
+                exit(1);
+            }
+            break;
+        case 'r': {
+            sample_flag = true;
+            double rate = strtod(optarg, NULL);
+            if (rate <= 0 || rate > 1) {
+                fprintf(stderr, "rate must be in (0, 1]\n");
+                exit(1);
+            }
+            if (rate < 1)
+                sd_threshold = (uint64_t)(rate * TWO_64) - 1;
+            break;
+        }
+        case 'k':
+            sample_flag = true;
+            sd_max_blocks = strtoul(optarg, NULL, 10);
+            break;
         case '?': /* '?', opt not included in options */
             fprintf(stderr, "error while parsing args.\n");
             fprintf(stderr, helpstr);
@@ -373,8 +1660,9 @@ int main(int argc, char **argv) {
             break;
         }
     }
+    bool batch = config_count > 0;
     // missing mandatory arguments
-    if (!(s_flag && b_flag && E_flag && t_flag)) {
+    if (!(t_flag && ((s_flag && b_flag && E_flag) || batch))) {
         fprintf(stderr, "missing mandatory args.\n");
         fprintf(stderr, helpstr);
         exit(1);
@@ -385,33 +1673,59 @@ int main(int argc, char **argv) {
         fprintf(stderr, helpstr);
         exit(1);
     }
+    if (sample_flag && !stack_distance) {
+        fprintf(stderr, "-r and -k only work with -m.\n");
+        exit(1);
+    }
+    if (stack_distance && indexing != INDEX_BITS) {
+        fprintf(stderr, "-m only works with -H bits.\n");
+        exit(1);
+    }
+    if (use_opt && (batch || stack_distance)) {
+        fprintf(stderr, "-O cannot be combined with -m, -c or -C.\n");
+        exit(1);
+    }
+    if (batch) {
+        if (stack_distance) {
+            fprintf(stderr, "-m cannot be combined with -c or -C.\n");
+            exit(1);
+        }
+        if (s_flag && b_flag && E_flag) {
+            char spec[64];
+            snprintf(spec, sizeof(spec), "%lu,%lu,%lu", s, b, E);
+            add_config(spec);
+        }
+        if (run_batch(t))
+            exit(1);
+        free(configs);
+        return 0;
+    }
     if (verbose)
         fprintf(stderr, "here are the args: %lu %lu %lu %s.\n", s, b, E, t);
     check_valid(s, b, E);
-    unsigned long S = 1UL << s;
     B = 1UL << b;
 
-    // create cache in memory
-    cache_line **cache = (cache_line **)xcalloc(
-        S, sizeof(cache_line *)); // equivalent to cache[S][E]
-
-    // clear the cache
-    for (unsigned long i = 0; i < S; i++) {
-        cache[i] = (cache_line *)xcalloc(E, sizeof(cache_line));
+    if (stack_distance) {
+        stack_distance_init();
+        if (process_trace_file(t, NULL, NULL))
+            exit(1);
+        stack_distance_report();
+        stack_distance_free();
+        return 0;
     }
 
-    stats = xcalloc(1, sizeof(csim_stats_t));
+    // create cache in memory
+    cache_t *cache = cache_create(s, b, E);
+
+    csim_stats_t *stats = xcalloc(1, sizeof(csim_stats_t));
 
     if (t != NULL) {
-        if (process_trace_file(t, cache))
+        if (process_trace_file(t, cache, stats))
             exit(1);
     }
 
     // free memory
-    for (unsigned long i = 0; i < S; i++) {
-        free(cache[i]);
-    }
-    free(cache);
+    cache_free(cache);
 
     printSummary(stats);
     free(stats);
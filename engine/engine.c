@@ -27,7 +27,17 @@ void printHelp(char* prog)
     printf("  -b <file>   \t Branch simulator\n");
     printf("  -m <file>   \t Memory simulator\n");
     printf("  -t <file>   \t Trace file / directory\n");
+    printf("  -T <file>   \t Trace reader, e.g. synth to generate the ops\n"
+           "              \t  described by -t instead (default trace)\n");
+    printf("  -r          \t Decode the trace ahead on a separate thread\n");
+    printf("  -F <ops>    \t Skip each processor's first <ops> trace ops\n"
+           "              \t  - seeks using the trace's index, if built\n"
+           "              \t    with cadss-trace -I\n");
+    printf("  -W <ops>    \t Simulate at most <ops> trace ops per processor\n");
     printf("  -s <file>   \t Setting / configuration file\n");
+    printf("  -x          \t Skip ticks where every component is idle\n"
+           "              \t  - needs nextTick / skipTicks in every\n"
+           "              \t    component, ignored while debugging\n");
     printf("  -d [<tick>] \t Enable debugging\n"
            "              \t  - drops into a debug REPL\n"
            "              \t  - if <tick> specified, waits for <tick>\n"
@@ -82,6 +92,10 @@ struct sim* loadSim(char* name, char* type)
     s->tick = dlsym(handle, "tick");
     s->finish = dlsym(handle, "finish");
     s->destroy = dlsym(handle, "destroy");
+
+    // Optional, only used for idle-cycle fast-forward.
+    s->nextTick = dlsym(handle, "nextTick");
+    s->skipTicks = dlsym(handle, "skipTicks");
     s->CADSS_VERBOSE = dlsym(handle, "CADSS_VERBOSE");
     if (s->CADSS_VERBOSE != NULL)
     {
@@ -105,6 +119,29 @@ struct sim* loadSim(char* name, char* type)
     return s;
 }
 
+//
+// idleTicks (sims, count)
+//    Returns how many upcoming ticks are idle in every component, which is
+//    one less than the nearest tick reported by any component's nextTick.
+//
+static int64_t idleTicks(struct sim** sims, int count)
+{
+    int64_t next = INT64_MAX;
+
+    for (int i = 0; i < count; i++)
+    {
+        int64_t n = sims[i]->nextTick();
+        if (n < next)
+            next = n;
+    }
+
+    // Nobody is counting down, so skipping would never reach an event.
+    if (next == INT64_MAX)
+        return 0;
+
+    return next - 1;
+}
+
 // Handle debug REPL prompts.
 static int debugRepl(int64_t tickCount)
 {
@@ -198,9 +235,11 @@ int main(int argc, char** argv)
     char* coherName = NULL;
     char* interName = NULL;
     char* memName = NULL;
+    char* traceName = "trace";
+    int fastForward = 0;
 
     // TODO - switch to getopt_long that accepts -- arguments
-    while ((opt = getopt(argc, argv, ":hvc:p:o:n:i:b:t:s:m:d:")) != -1)
+    while ((opt = getopt(argc, argv, ":hvxrc:p:o:n:i:b:t:s:m:d:F:W:T:")) != -1)
     {
         switch (opt)
         {
@@ -221,6 +260,14 @@ int main(int argc, char** argv)
             case 'v':
                 CADSS_VERBOSE = 1;
                 break;
+            case 'x':
+                fastForward = 1;
+                break;
+            case 'r':
+            case 'F':
+            case 'W':
+                // Handled by the trace reader.
+                break;
             case 'c':
                 cacheName = optarg;
                 break;
@@ -242,6 +289,9 @@ int main(int argc, char** argv)
             case 'm':
                 memName = optarg;
                 break;
+            case 'T':
+                traceName = optarg;
+                break;
             case ':':
                 if (optopt == 'd')
                 {
@@ -254,12 +304,21 @@ int main(int argc, char** argv)
     if (isProcTracedExt() && CADSS_DBG_ON)
         CADSS_DBG_EXT = 1;
 
-    trace = loadSim("trace", "trace");
+    trace = loadSim(traceName, "trace");
+    if (trace == NULL)
+    {
+        return 0;
+    }
     trace_sim_args tsa;
     tsa.arg_count = argc;
     tsa.arg_list = argv;
     optind = 1;
     trace_reader* tr = trace->init(&tsa);
+    if (tr == NULL)
+    {
+        fprintf(stderr, "Failed to initialize trace component\n");
+        return 0;
+    }
 
     if (settingFile == NULL)
     {
@@ -419,12 +478,36 @@ int main(int argc, char** argv)
     psa.tr = tr;
     psa.cache_sim = cache_sim;
     psa.branch_sim = branch_sim;
+    psa.memoryRequestReady = dlsym(csim->handle, "memoryRequestReady");
     if ((proc_sim = psim->init(&psa)) == NULL)
     {
         printf("Failed to initialize processor!\n");
         assert(0);
     }
 
+    // Fast-forward needs every component to report its next event,
+    //   and the debugger expects to see each tick.
+    struct sim* ffSims[] = {psim, bsim, csim, osim, isim, msim};
+    const int ffSimCount = sizeof(ffSims) / sizeof(ffSims[0]);
+    if (fastForward)
+    {
+        for (int i = 0; i < ffSimCount; i++)
+        {
+            if (ffSims[i]->nextTick == NULL || ffSims[i]->skipTicks == NULL)
+            {
+                fprintf(stderr, "Component does not support fast-forward, "
+                                "simulating every tick\n");
+                fastForward = 0;
+                break;
+            }
+        }
+    }
+    if (fastForward && (CADSS_DBG_ON || CADSS_DBG_TICK >= 0 || CADSS_DBG_EXT))
+    {
+        fprintf(stderr, "Fast-forward is disabled while debugging\n");
+        fastForward = 0;
+    }
+
     // Main sim loop
     int progress = 0;
     int dbgHalt;
@@ -463,6 +546,20 @@ int main(int argc, char** argv)
         debugCheckNotif(&(coher_sim->dbgEnv));
         debugCheckNotif(&(inter_sim->dbgEnv));
         debugCheckNotif(&(mem_sim->dbgEnv));
+
+        // Jump over ticks where every component is only counting down.
+        if (progress && fastForward)
+        {
+            int64_t skip = idleTicks(ffSims, ffSimCount);
+            if (skip > 0)
+            {
+                for (int i = 0; i < ffSimCount; i++)
+                {
+                    ffSims[i]->skipTicks(skip);
+                }
+                dbgTickCount += skip;
+            }
+        }
     } while (progress);
 
     psim->finish(STDOUT_FILENO);
@@ -34,6 +34,8 @@ struct sim {
     int (*tick)(void);
     int (*finish)(int);
     int (*destroy)(void);
+    int64_t (*nextTick)(void);
+    void (*skipTicks)(int64_t);
     int* CADSS_VERBOSE;
 };
 
@@ -191,9 +191,11 @@ void busReq(bus_req_type brt, uint64_t addr, int procNum)
         pendingRequest->shared = 1;
         return;
     }
-    else if (brt == DATA && pendingRequest->addr == addr)
+    else if (brt == DATA && pendingRequest->addr == addr
+             && pendingRequest->currentState == WAITING_MEMORY)
     {
-        assert(pendingRequest->currentState == WAITING_MEMORY);
+        // Only a snooped cache answers while the request waits on memory.
+        // Data sent at any other time is a flush, queued like any other.
         pendingRequest->data = 1;
         pendingRequest->currentState = TRANSFERING_CACHE;
         countDown = CACHE_TRANSFER;
@@ -309,6 +311,40 @@ int tick()
     return 0;
 }
 
+int64_t nextTick(void)
+{
+    if (countDown > 0)
+    {
+        // Memory has already answered, the transfer starts next tick.
+        if (pendingRequest->dataAvail)
+        {
+            return 1;
+        }
+
+        return countDown;
+    }
+
+    for (int i = 0; i < processorCount; i++)
+    {
+        if (queuedRequests[i] != NULL)
+        {
+            return 1;
+        }
+    }
+
+    return INT64_MAX;
+}
+
+void skipTicks(int64_t ticks)
+{
+    assert(countDown == 0 || ticks < countDown);
+
+    if (countDown > 0)
+    {
+        countDown -= ticks;
+    }
+}
+
 void printInterconnState(void)
 {
     if (!pendingRequest)
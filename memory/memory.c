@@ -92,6 +92,35 @@ done:
     return countDown;
 }
 
+int64_t nextTick(void)
+{
+    if (pendingRequest == NULL)
+    {
+        return INT64_MAX;
+    }
+
+    // A cache-to-cache transfer squelches the request on the next tick.
+    if (countDown == 0
+        || interComp->busReqCacheTransfer(pendingRequest->addr,
+                                          pendingRequest->procNum))
+    {
+        return 1;
+    }
+
+    // The callback fires on the tick that takes countDown to 0.
+    return countDown;
+}
+
+void skipTicks(int64_t ticks)
+{
+    assert(pendingRequest == NULL || ticks < countDown);
+
+    if (pendingRequest != NULL)
+    {
+        countDown -= ticks;
+    }
+}
+
 int finish(int outFd)
 {
     return 0;
@@ -36,23 +36,26 @@ typedef struct CDB_ {
 } CDB;
 
 typedef struct instr_ {
+    int core; // the queues are shared, so remember whose instruction it is
     bool is_long;
     int op_typ; // -1 = normal , 0 = memory , 1 = branch
-    trace_op *trace_op;
+    trace_op trace_op;
     bool fired;
     uint32_t FU;
     int dest;
     reg *src_arr[2];
     uint32_t tag;
+    bool mem_pending; // memory op waiting on the cache
+    int64_t mem_tag;
 } instr;
 
-instr *init_instr(bool is_long, int op_typ, trace_op *op, uint32_t dest,
-                  int srcs[]) {
+instr *init_instr(int core, bool is_long, int op_typ, trace_op *op,
+                  uint32_t dest, int srcs[]) {
     instr *I = calloc(1, sizeof(instr));
+    I->core = core;
     I->is_long = is_long;
     I->op_typ = op_typ;
-    I->trace_op = calloc(1, sizeof(trace_op));
-    memcpy(I->trace_op, op, sizeof(trace_op));
+    I->trace_op = *op;
     I->dest = dest;
     for (int i = 0; i < 2; i++) {
         if (srcs[i] != -1) {
@@ -107,11 +110,37 @@ processor *self = NULL;
 int processorCount = 1;
 int CADSS_VERBOSE = 0;
 
+// ops are pulled from the trace a batch at a time into a buffer per core
+#define FETCH_BATCH 64
+
+typedef struct fetch_buf_ {
+    trace_op ops[FETCH_BATCH];
+    int count;
+    int pos;
+} fetch_buf;
+
+fetch_buf *fetchBufs = NULL;
+
+trace_op *fetch_op(int procNum) {
+    fetch_buf *fb = &fetchBufs[procNum];
+    if (fb->pos == fb->count) {
+        fb->pos = 0;
+        fb->count = tr->getNextOps(procNum, fb->ops, FETCH_BATCH);
+        if (fb->count == 0) {
+            return NULL;
+        }
+    }
+    return &fb->ops[fb->pos++];
+}
+
 int *pendingBranch = NULL;
+// memory ops each core has waiting on the cache
 int *pendingMem = NULL;
-int64_t *memOpTag = NULL;
 int64_t globalTag = 1;
 
+// from the cache, NULL if it only takes one request per core at a time
+int (*memReady)(trace_op *, int) = NULL;
+
 bool queue_full(instr_queue *q) { return q->cnt == q->cap; }
 
 bool queue_empty(instr_queue *q) { return q->cnt == 0; }
@@ -303,7 +332,8 @@ processor *init(processor_sim_args *psa) {
 
     pendingBranch = calloc(processorCount, sizeof(int));
     pendingMem = calloc(processorCount, sizeof(int));
-    memOpTag = calloc(processorCount, sizeof(int64_t));
+    memReady = psa->memoryRequestReady;
+    fetchBufs = calloc(processorCount, sizeof(fetch_buf));
 
     self = calloc(1, sizeof(processor));
     return self;
@@ -323,6 +353,14 @@ int64_t dataInstrCount, dataStalls, dataStallTicks = 0;
 // cache miss metrics
 // int64_t memInstrCount, memReqTicks = 0;
 int64_t memStalls, memStallTicks = 0;
+// memory ops the cache refused for want of an MSHR (a structural hazard)
+int64_t mshrStalls, mshrStallTicks = 0;
+
+// idle-cycle fast-forward: a tick that changed no pipeline state repeats
+// itself until another component calls back, so remember what it added
+bool lastTickIdle = false;
+int64_t idleDataStalls, idleDataStallTicks, idleMemStalls, idleMemStallTicks,
+    idleMshrStalls, idleMshrStallTicks, idleBranchStalls = 0;
 
 int64_t makeTag(int procNum, int64_t baseTag) {
     return ((int64_t)procNum) | (baseTag << 8);
@@ -331,14 +369,27 @@ int64_t makeTag(int procNum, int64_t baseTag) {
 void memOpCallback(int procNum, int64_t tag) {
     DPRINTF("received memopcallback with tag %ld\n", tag);
 
-    // Is the completed memop one that is pending?
-    if (tag == memOpTag[procNum]) {
-        pendingMem[procNum] = 0;
-        memOpTag[procNum] = 0;
-    } else {
-        DPRINTF("memopTag: %ld != tag %ld\n", memOpTag[procNum], tag);
+    // Is the completed memop one that is pending?  Pending memops wait at
+    // the head of a fast pipeline.
+    for (int j = 0; j < J; j++) {
+        instr *I = FU_pipeline[j][0];
+        if (I != NULL && I->mem_pending && I->mem_tag == tag) {
+            I->mem_pending = false;
+            pendingMem[procNum]--;
+            return;
+        }
+    }
+    DPRINTF("memopTag: %ld matched no FU tags\n", tag);
+}
+
+// Whether core procNum can send the cache another memory op, as returned by
+// memoryRequestReady.  Caches that can have several in flight say so,
+// others get one per core.
+int mem_accepting(trace_op *op, int procNum) {
+    if (memReady != NULL) {
+        return memReady(op, procNum);
     }
-    // DPRINTF("memopTag: %ld matched no FU tags\n", tag);
+    return pendingMem[procNum] == 0 ? 1 : MEM_ONE_AT_A_TIME;
 }
 
 void print_stats() {
@@ -398,6 +449,7 @@ void print_stats() {
     //        percentBranchTick);
     printf("    -   Data dependency stall ticks: %ld\n", dataStallTicks);
     printf("    -   Cache miss stall ticks: %ld\n", memStallTicks);
+    printf("    -   MSHR full stall ticks: %ld\n", mshrStallTicks);
     printf("    -   Mispredicted branch stall ticks: %ld\n", branchStalls);
 }
 
@@ -416,6 +468,15 @@ int tick(void) {
     cs->si.tick();
     tickCount++;
 
+    int64_t startDataStalls = dataStalls;
+    int64_t startDataStallTicks = dataStallTicks;
+    int64_t startMemStalls = memStalls;
+    int64_t startMemStallTicks = memStallTicks;
+    int64_t startMshrStalls = mshrStalls;
+    int64_t startMshrStallTicks = mshrStallTicks;
+    int64_t startBranchStalls = branchStalls;
+    bool stateChanged = false;
+
     int progress = 0;
     for (int i = 0; i < processorCount; i++) {
         // if (pendingMem[i]) {
@@ -434,6 +495,7 @@ int tick(void) {
                 buses[j].busy = false;
                 DPRINTF("progress = 1 reg <- result bus\n");
                 progress = 1;
+                stateChanged = true;
             }
         }
 
@@ -461,6 +523,7 @@ int tick(void) {
             //                                           :
             //                                           I->trace_op->pcAddress);
             progress = 1;
+            stateChanged = true;
         }
 
         // — END: STATE UPDATE LATCH —
@@ -474,7 +537,7 @@ int tick(void) {
             if (j < J) {
                 to_queue = FU_pipeline[j][0];
                 if (to_queue != NULL && to_queue->op_typ == 0 &&
-                    pendingMem[i] != 0) {
+                    to_queue->mem_pending) {
                     DPRINTF(
                         "stalling ALU execution pipeline because pendingMem\n");
                     // stall pipeline if instr is pending memrequest
@@ -484,6 +547,9 @@ int tick(void) {
             }
             // long
             else {
+                if (FU_pipeline[j][0] != NULL || FU_pipeline[j][1] != NULL) {
+                    stateChanged = true;
+                }
                 to_queue = FU_pipeline[j][2];
                 FU_pipeline[j][2] = FU_pipeline[j][1];
                 FU_pipeline[j][1] = FU_pipeline[j][0];
@@ -500,6 +566,7 @@ int tick(void) {
                 priority_push(state_update_queue, to_queue);
                 DPRINTF("progress = 1 state update queue push\n");
                 progress = 1;
+                stateChanged = true;
             }
         }
         for (int j = 0; j < J + K; j++) {
@@ -519,6 +586,7 @@ int tick(void) {
 
         // schedule b: mark indep instructions in schedule queue to fire
         bool instr_exists[2] = {false, false};
+        bool mshrStalled = false;
         instr_queue *qs[2] = {long_schedule_queue, fast_schedule_queue};
         for (int k = 0; k < 2; k++) {
             instr_queue *q = qs[k];
@@ -535,10 +603,20 @@ int tick(void) {
                         if (RS->src_arr[j] != NULL && !RS->src_arr[j]->ready)
                             ready = false;
                     }
-                    if (RS->op_typ == 0 && pendingMem[i] != 0) {
+                    // an op with its operands that the cache cannot take for
+                    // want of an MSHR is a structural stall, while waiting on
+                    // the core's one request in flight counts as a data
+                    // hazard, as it always has
+                    int accepting =
+                        RS->op_typ == 0 ? mem_accepting(&RS->trace_op, RS->core)
+                                        : 1;
+                    if (accepting == MEM_ONE_AT_A_TIME) {
                         ready = false;
                     }
-                    if (ready) {
+                    if (ready && accepting == 0) {
+                        mshrStalls++;
+                        mshrStalled = true;
+                    } else if (ready) {
                         // find next possible FU
                         for (int j = 0; j < J + K; j++) {
                             if (j < J && RS->is_long)
@@ -550,25 +628,27 @@ int tick(void) {
                                 if (RS->op_typ == 0) {
                                     // call memory request when put into FU
                                     // pipeline
-                                    pendingMem[i] = 1;
-                                    memOpTag[i] = makeTag(i, globalTag);
-                                    cs->memoryRequest(RS->trace_op, i,
-                                                      makeTag(i, globalTag),
+                                    pendingMem[RS->core]++;
+                                    RS->mem_pending = true;
+                                    RS->mem_tag = makeTag(RS->core, globalTag);
+                                    cs->memoryRequest(&RS->trace_op, RS->core,
+                                                      RS->mem_tag,
                                                       memOpCallback);
                                     DPRINTF(
                                         "called memoryRequest with tag %ld\n",
-                                        makeTag(i, globalTag));
+                                        RS->mem_tag);
                                     globalTag++;
                                 }
                                 RS->FU = j;
                                 RS->fired = true;
                                 DPRINTF("progress = 1 scheduling b\n");
                                 progress = 1;
+                                stateChanged = true;
                                 break;
                             }
                         }
                         if (RS->op_typ == -1 && !RS->is_long && !RS->fired &&
-                            pendingMem[i] == 1) {
+                            pendingMem[RS->core] != 0) {
                             memStalls++;
                             memStalled = true;
                         }
@@ -584,6 +664,9 @@ int tick(void) {
                 }
             }
         }
+        if (mshrStalled) {
+            mshrStallTicks++;
+        }
 
         // check for data dependency stalls
         bool dataStalled = false;
@@ -638,6 +721,7 @@ int tick(void) {
             }
             DPRINTF("progress = 1 dispatch_queue reserve\n");
             progress = 1;
+            stateChanged = true;
             // b: delete I from dispatch queue
             assert(queue_delete(dispatch_queue, cur_instr));
             cur_node = next;
@@ -693,6 +777,7 @@ int tick(void) {
                             src->val = buses[CDB].val;
                             DPRINTF("progress = 1 scheduling a\n");
                             progress = 1;
+                            stateChanged = true;
                         }
                     }
                 }
@@ -717,13 +802,14 @@ int tick(void) {
             }
 
             // get and manage ops for each processor core
-            nextOp = tr->getNextOp(i);
+            nextOp = fetch_op(i);
 
             if (nextOp == NULL)
                 continue;
 
             DPRINTF("progress = 1 instruction\n");
             progress = 1;
+            stateChanged = true;
             instrCount++;
 
             instr *new_instr;
@@ -735,7 +821,7 @@ int tick(void) {
                 // nextOp->memAddress);
                 // memInstrCount++;
                 dataInstrCount++;
-                new_instr = init_instr(false, 0, nextOp, nextOp->dest_reg,
+                new_instr = init_instr(i, false, 0, nextOp, nextOp->dest_reg,
                                        nextOp->src_reg);
                 DPRINTF("push M %lx into dispatch queue\n", nextOp->memAddress);
                 assert(queue_push(dispatch_queue, new_instr));
@@ -751,7 +837,7 @@ int tick(void) {
                 if (pendingBranch[i] == 1) {
                     numMispredBranches++;
                 }
-                new_instr = init_instr(false, 1, nextOp, nextOp->dest_reg,
+                new_instr = init_instr(i, false, 1, nextOp, nextOp->dest_reg,
                                        nextOp->src_reg);
                 // DPRINTF("push B %lx into dispatch queue\n",
                 // nextOp->pcAddress);
@@ -763,16 +849,15 @@ int tick(void) {
                 // DPRINTF("fetched an ALU instruction (0x%lx)\n",
                 // nextOp->pcAddress);
                 dataInstrCount++;
-                new_instr = init_instr(nextOp->op == ALU_LONG, -1, nextOp,
-                                       nextOp->dest_reg, nextOp->src_reg);
+                new_instr = init_instr(i, nextOp->op == ALU_LONG, -1,
+                                       nextOp, nextOp->dest_reg,
+                                       nextOp->src_reg);
                 // DPRINTF("push A %lx into dispatch queue\n",
                 // nextOp->pcAddress);
                 assert(queue_push(dispatch_queue, new_instr));
                 //              queue_print("dispatch_queue", dispatch_queue);
                 break;
             }
-
-            free(nextOp);
         }
         // — END: I F/D LATCH —
 
@@ -785,10 +870,11 @@ int tick(void) {
             if (del_instr != NULL) {
                 DPRINTF("progress = 1 su f\n");
                 progress = 1;
+                stateChanged = true;
 
                 // unstall on any completed branch instruction
                 if (del_instr->op_typ == 1) {
-                    pendingBranch[i] = 0;
+                    pendingBranch[del_instr->core] = 0;
                 }
 
                 instr_queue *q = del_instr->is_long ? long_schedule_queue
@@ -809,9 +895,33 @@ int tick(void) {
         print_stats();
     }
 
+    lastTickIdle = !stateChanged;
+    idleDataStalls = dataStalls - startDataStalls;
+    idleDataStallTicks = dataStallTicks - startDataStallTicks;
+    idleMemStalls = memStalls - startMemStalls;
+    idleMemStallTicks = memStallTicks - startMemStallTicks;
+    idleMshrStalls = mshrStalls - startMshrStalls;
+    idleMshrStallTicks = mshrStallTicks - startMshrStallTicks;
+    idleBranchStalls = branchStalls - startBranchStalls;
+
     return progress;
 }
 
+int64_t nextTick(void) { return lastTickIdle ? INT64_MAX : 1; }
+
+void skipTicks(int64_t ticks) {
+    assert(ticks == 0 || lastTickIdle);
+
+    tickCount += ticks;
+    dataStalls += ticks * idleDataStalls;
+    dataStallTicks += ticks * idleDataStallTicks;
+    memStalls += ticks * idleMemStalls;
+    memStallTicks += ticks * idleMemStallTicks;
+    mshrStalls += ticks * idleMshrStalls;
+    mshrStallTicks += ticks * idleMshrStallTicks;
+    branchStalls += ticks * idleBranchStalls;
+}
+
 int finish(int outFd) {
     int c = cs->si.finish(outFd);
     int b = bs->si.finish(outFd);
@@ -839,7 +949,7 @@ int destroy(void) {
 
     free(pendingMem);
     free(pendingBranch);
-    free(memOpTag);
+    free(fetchBufs);
 
     int c = cs->si.destroy();
     int b = bs->si.destroy();
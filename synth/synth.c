@@ -0,0 +1,410 @@
+#include "trace.h"
+
+#include <stdio.h>
+#include <getopt.h>
+#include <stdlib.h>
+
+//
+// synth
+//
+//   A trace reader that generates its ops instead of reading them, selected
+// with the engine's "-T synth".  The "-t" argument describes the workload as
+// a pattern followed by key=value settings, e.g.:
+//
+//     -t stream,stride=64,ops=1000000
+//     -t migratory,footprint=4096,mem=50
+//
+//   Each core runs a small static program of code ops that it loops over,
+// so a PC is always the same kind of op and branches are as predictable as
+// "predict" says.  Memory ops take their addresses from the pattern.  Ops
+// are filled in the way the text parser would have produced them, except
+// that CHASE loads also write the register they read, so that each one has
+// to wait for the one before it.
+//
+
+trace_op* getNextOp(int);
+int getNextOps(int, trace_op*, int);
+
+int processorCount = 1;
+
+enum SYNTH_PATTERN {
+    STREAM,     // each core strides through its own footprint
+    RANDOM,     // uniform random lines in each core's own footprint
+    CHASE,      // dependent loads around a cycle through the footprint
+    PRODCONS,   // even cores store to a buffer the next odd core loads from
+    MIGRATORY   // every core reads then writes the same lines in turn
+};
+
+static char* const synthTokens[] = {
+    "stream", "random", "chase", "prodcons", "migratory",
+    "ops", "footprint", "stride", "size", "mem", "store", "branch", "long",
+    "dep", "predict", "code", "seed", NULL
+};
+
+enum SYNTH_TOKEN {
+    T_STREAM, T_RANDOM, T_CHASE, T_PRODCONS, T_MIGRATORY,
+    T_OPS, T_FOOTPRINT, T_STRIDE, T_SIZE, T_MEM, T_STORE, T_BRANCH, T_LONG,
+    T_DEP, T_PREDICT, T_CODE, T_SEED
+};
+
+#define SYNTH_REGS 32
+#define SYNTH_LINE 64
+#define PRIVATE_BASE 0x10000000UL
+#define SHARED_BASE 0x80000000UL
+#define CODE_BASE 0x400000UL
+
+typedef struct _synth_settings {
+    enum SYNTH_PATTERN pattern;
+    uint64_t ops;           // per core
+    uint64_t footprint;     // bytes, per core or shared
+    uint64_t stride;
+    int size;
+    int memPercent;         // of code ops
+    int storePercent;       // of memory ops
+    int branchPercent;      // of code ops
+    int longPercent;        // of ALU ops
+    int dep;                // distance back to the op a source reads, 0 for none
+    int predictPercent;     // branches going their usual way
+    int code;               // ops in each core's static program
+    uint64_t seed;
+} synth_settings;
+
+static synth_settings synth = {
+    .pattern = STREAM,
+    .ops = 1000000,
+    .footprint = 1 << 20,
+    .stride = SYNTH_LINE,
+    .size = 8,
+    .memPercent = 30,
+    .storePercent = 30,
+    .branchPercent = 15,
+    .longPercent = 10,
+    .dep = 2,
+    .predictPercent = 90,
+    .code = 1024,
+    .seed = 1
+};
+
+// The static program, shared by every core.
+typedef struct _code_op {
+    enum op_type op;
+    int store;
+    int target;     // code slot a taken branch goes to
+    int taken;      // which way the branch usually goes
+} code_op;
+
+typedef struct _core_state {
+    uint64_t rng;
+    uint64_t opCount;
+    uint64_t memCount;
+    uint64_t line;  // CHASE - current position in the cycle
+    int slot;
+} core_state;
+
+static code_op* program = NULL;
+static core_state* cores = NULL;
+static uint64_t chaseMask = 0;
+
+static inline uint64_t nextRandom(uint64_t* state)
+{
+    uint64_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    *state = x;
+    return x;
+}
+
+static inline int chance(uint64_t* state, int percent)
+{
+    return (int)(nextRandom(state) % 100) < percent;
+}
+
+static int parseSpec(char* spec)
+{
+    char* value;
+    while (*spec != '\0')
+    {
+        int token = getsubopt(&spec, synthTokens, &value);
+        if (token >= T_OPS && value == NULL)
+        {
+            fprintf(stderr, "Synthetic trace setting %s needs a value\n",
+                    synthTokens[token]);
+            return -1;
+        }
+
+        switch (token)
+        {
+            case T_STREAM:
+            case T_RANDOM:
+            case T_CHASE:
+            case T_PRODCONS:
+            case T_MIGRATORY:
+                synth.pattern = (enum SYNTH_PATTERN)token;
+                break;
+            case T_OPS: synth.ops = strtoull(value, NULL, 0); break;
+            case T_FOOTPRINT: synth.footprint = strtoull(value, NULL, 0); break;
+            case T_STRIDE: synth.stride = strtoull(value, NULL, 0); break;
+            case T_SIZE: synth.size = atoi(value); break;
+            case T_MEM: synth.memPercent = atoi(value); break;
+            case T_STORE: synth.storePercent = atoi(value); break;
+            case T_BRANCH: synth.branchPercent = atoi(value); break;
+            case T_LONG: synth.longPercent = atoi(value); break;
+            case T_DEP: synth.dep = atoi(value); break;
+            case T_PREDICT: synth.predictPercent = atoi(value); break;
+            case T_CODE: synth.code = atoi(value); break;
+            case T_SEED: synth.seed = strtoull(value, NULL, 0); break;
+            default:
+                fprintf(stderr, "Unknown synthetic trace setting - %s\n", value);
+                return -1;
+        }
+    }
+
+    if (synth.footprint < SYNTH_LINE || synth.code < 1 || synth.size < 1
+        || synth.memPercent + synth.branchPercent > 100)
+    {
+        fprintf(stderr, "Synthetic trace settings are out of range\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+//
+// buildProgram
+//
+//   Picks each code slot's op once, so the same PC always does the same
+// thing.  The last slot is always a branch back to the start.
+//
+static void buildProgram(void)
+{
+    uint64_t rng = synth.seed * 0x9E3779B97F4A7C15UL + 1;
+    for (int i = 0; i < synth.code; i++)
+    {
+        code_op* c = &program[i];
+        int pick = nextRandom(&rng) % 100;
+        if (pick < synth.memPercent)
+        {
+            c->op = MEM_LOAD;
+            c->store = chance(&rng, synth.storePercent);
+        }
+        else if (pick < synth.memPercent + synth.branchPercent)
+        {
+            c->op = BRANCH;
+            c->target = nextRandom(&rng) % synth.code;
+            c->taken = chance(&rng, 50);
+        }
+        else
+        {
+            c->op = chance(&rng, synth.longPercent) ? ALU_LONG : ALU;
+        }
+    }
+
+    program[synth.code - 1].op = BRANCH;
+    program[synth.code - 1].target = 0;
+    program[synth.code - 1].taken = 1;
+}
+
+// CHASE footprints are rounded down to a power of two number of lines,
+//   so they can be walked with a full period LCG instead of a table.
+static uint64_t chaseLines(void)
+{
+    uint64_t lines = synth.footprint / SYNTH_LINE;
+    while (lines & (lines - 1)) lines &= lines - 1;
+    return lines;
+}
+
+static uint64_t nextAddress(int processorNum, core_state* cs, int* store)
+{
+    uint64_t n = cs->memCount++;
+    uint64_t privateBase = PRIVATE_BASE + ((uint64_t)processorNum << 32);
+
+    switch (synth.pattern)
+    {
+        case STREAM:
+            return privateBase + (n * synth.stride) % synth.footprint;
+        case RANDOM:
+        {
+            uint64_t offset = nextRandom(&cs->rng) % synth.footprint;
+            return privateBase + offset - offset % synth.size;
+        }
+        case CHASE:
+            *store = 0;
+            cs->line = (cs->line * 6364136223846793005UL + 1442695040888963407UL)
+                       & chaseMask;
+            return privateBase + cs->line * SYNTH_LINE;
+        case PRODCONS:
+        {
+            // Each producer / consumer pair shares one buffer.
+            uint64_t buffer = SHARED_BASE + (uint64_t)(processorNum / 2)
+                                            * synth.footprint;
+            *store = (processorNum % 2) == 0;
+            return buffer + (n * synth.stride) % synth.footprint;
+        }
+        case MIGRATORY:
+        {
+            // Cores start evenly spread around the lines and move through
+            //   them at the same rate, loading and then storing each one.
+            uint64_t lines = synth.footprint / SYNTH_LINE;
+            uint64_t line = (n / 2 + processorNum * lines / processorCount)
+                            % lines;
+            *store = n % 2;
+            return SHARED_BASE + line * SYNTH_LINE;
+        }
+    }
+
+    return 0;
+}
+
+static void generateOp(int processorNum, core_state* cs, trace_op* op)
+{
+    int slot = cs->slot;
+    const code_op* c = &program[slot];
+
+    int src = -1;
+    if (synth.dep > 0)
+    {
+        src = ((slot - synth.dep) % SYNTH_REGS + SYNTH_REGS) % SYNTH_REGS;
+    }
+
+    op->op = c->op;
+    op->pcAddress = CODE_BASE + slot * 4;
+    op->dest_reg = -1;
+    op->src_reg[0] = -1;
+    op->src_reg[1] = -1;
+    op->size = 0;
+    cs->slot = (slot + 1) % synth.code;
+
+    switch (c->op)
+    {
+        case MEM_LOAD:
+        {
+            int store = c->store;
+            op->memAddress = nextAddress(processorNum, cs, &store);
+            op->size = synth.size;
+
+            // Matches the register placement of the text parser.
+            if (store)
+            {
+                op->op = MEM_STORE;
+                op->dest_reg = src;
+            }
+            else if (synth.pattern == CHASE)
+            {
+                op->dest_reg = 0;
+                op->src_reg[0] = 0;
+            }
+            else
+            {
+                op->src_reg[0] = slot % SYNTH_REGS;
+            }
+            break;
+        }
+        case BRANCH:
+        {
+            int taken = c->taken;
+            if (!chance(&cs->rng, synth.predictPercent)) taken = !taken;
+            if (taken) cs->slot = c->target;
+            op->nextPCAddress = CODE_BASE + cs->slot * 4;
+            op->src_reg[0] = src;
+            break;
+        }
+        default:
+            op->dest_reg = slot % SYNTH_REGS;
+            op->src_reg[0] = src;
+            break;
+    }
+}
+
+trace_reader* init(trace_sim_args* tsa)
+{
+    char* spec = NULL;
+    trace_reader* tr = malloc(sizeof(trace_reader));
+    if (tr == NULL) return NULL;
+    tr->getNextOp = getNextOp;
+    tr->getNextOps = getNextOps;
+
+    // Shares the engine's arguments with the trace reader.
+    int op = 0;
+    while ((op = getopt(tsa->arg_count, tsa->arg_list,
+                        "hdvxrc:p:o:n:i:b:t:s:m:F:W:T:")) != -1)
+    {
+        switch (op)
+        {
+            case 't':
+                spec = optarg;
+                break;
+        }
+    }
+
+    if (spec != NULL && parseSpec(spec) != 0)
+    {
+        free(tr);
+        return NULL;
+    }
+
+    program = calloc(synth.code, sizeof(code_op));
+    cores = calloc(processorCount, sizeof(core_state));
+    if (program == NULL || cores == NULL)
+    {
+        free(tr);
+        return NULL;
+    }
+
+    buildProgram();
+    chaseMask = chaseLines() - 1;
+    for (int i = 0; i < processorCount; i++)
+    {
+        cores[i].rng = (synth.seed + i + 1) * 0x9E3779B97F4A7C15UL;
+    }
+
+    tr->si.tick = tick;
+    tr->si.finish = finish;
+    tr->si.destroy = destroy;
+
+    return tr;
+}
+
+int getNextOps(int processorNum, trace_op* buf, int n)
+{
+    core_state* cs = &cores[processorNum];
+    uint64_t left = synth.ops - cs->opCount;
+    int count = (uint64_t)n < left ? n : (int)left;
+
+    for (int i = 0; i < count; i++)
+    {
+        generateOp(processorNum, cs, &buf[i]);
+    }
+
+    cs->opCount += count;
+    return count;
+}
+
+trace_op* getNextOp(int processorNum)
+{
+    trace_op* op = malloc(sizeof(trace_op));
+    if (op == NULL || getNextOps(processorNum, op, 1) == 0)
+    {
+        free(op);
+        return NULL;
+    }
+
+    return op;
+}
+
+int tick(void)
+{
+    return 1;
+}
+
+int finish(int outFd)
+{
+    return 0;
+}
+
+int destroy(void)
+{
+    free(program);
+    free(cores);
+    return 0;
+}
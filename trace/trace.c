@@ -11,51 +11,85 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <unistd.h>
 
 #include <dlfcn.h>
+#include <pthread.h>
+#include <sched.h>
 
 trace_op* getNextOp(int);
+int getNextOps(int, trace_op*, int);
 
 int processorCount = 1;
 
-FILE** traceFile = NULL;
+trace_stream* traceStreams = NULL;
+trace_ring* traceRings = NULL;
 int masterFD = 0;
 
 int8_t isTaskGraph = 0;
 trace_op* (*gno)(int processorNum) = NULL;
 
+// Read-ahead ("-r"): a separate thread decodes every processor's trace.
+int readAhead = 0;
+pthread_t decoderThread;
+_Atomic int stopDecoder = 0;
+
+static void* decodeTraces(void* arg);
+
+// Region of interest: skip each processor's first skipOps ops ("-F"), then
+//   replay at most replayOps of them ("-W", 0 for the rest of the trace).
+uint64_t skipOps = 0;
+uint64_t replayOps = 0;
+
+static void startStream(trace_stream* ts, int indexFD, const struct stat* sb);
+
 trace_reader* init(trace_sim_args* tsa)
 {
     char* trace = NULL;
     trace_reader* tr = malloc(sizeof(trace_reader));
     if (tr == NULL) return NULL;
     tr->getNextOp = getNextOp;
+    tr->getNextOps = getNextOps;
     
     int op = 0;
-    while ((op = getopt(tsa->arg_count, tsa->arg_list, "hdvc:p:o:n:i:b:t:s:m:")) != -1)
+    while ((op = getopt(tsa->arg_count, tsa->arg_list, "hdvxrc:p:o:n:i:b:t:s:m:F:W:T:")) != -1)
     {
         switch (op)
         {
             case 't':
                 trace = optarg;
                 break;
+            case 'r':
+                readAhead = 1;
+                break;
+            case 'F':
+                skipOps = strtoull(optarg, NULL, 0);
+                break;
+            case 'W':
+                replayOps = strtoull(optarg, NULL, 0);
+                break;
         }
     }
     
-    traceFile = calloc(processorCount, sizeof(FILE*));
+    traceStreams = calloc(processorCount, sizeof(trace_stream));
+    traceRings = calloc(processorCount, sizeof(trace_ring));
     
     if (trace == NULL)
     {
         fprintf(stderr, "No trace file / directory specified, continuing using stdin\n");
-        traceFile[0] = stdin;
+        traceStreams[0].type = STDIN;
+        traceStreams[0].textFile = stdin;
+        startStream(&traceStreams[0], -1, NULL);
     }
     else
     {
         masterFD = open(trace, O_DIRECTORY);
         if (masterFD == -1)
         {
-            traceFile[0] = fopen(trace, "rb");
-            if (traceFile[0] == NULL)
+            struct stat sb;
+            int traceFD = open(trace, O_RDONLY);
+            if (traceFD == -1 || fstat(traceFD, &sb) != 0
+                || openTraceStream(&traceStreams[0], traceFD) != 0)
             {
                 perror("Attempt to open trace file");
                 fprintf(stderr, "Failed on trace file name - %s\n", optarg);
@@ -74,7 +108,7 @@ trace_reader* init(trace_sim_args* tsa)
                 int8_t (*itg)(FILE*) = dlsym(handle, "initTaskGraph");
                 if (itg != NULL)
                 {
-                    isTaskGraph = itg(traceFile[0]);
+                    isTaskGraph = itg(traceStreams[0].textFile);
                 }
                 else
                 {
@@ -83,11 +117,37 @@ trace_reader* init(trace_sim_args* tsa)
                 
                 gno = dlsym(handle, "getNextOp");
             }
+            
+            if (isTaskGraph != 1)
+            {
+                int indexFD = -1;
+                if (skipOps > 0)
+                {
+                    char indexName[4096];
+                    snprintf(indexName, sizeof(indexName), "%s.idx", trace);
+                    indexFD = open(indexName, O_RDONLY);
+                }
+                startStream(&traceStreams[0], indexFD, &sb);
+            }
         }
         
         // openat()
     }
     
+    // Taskgraphs are decoded by their own library, on demand.
+    if (readAhead && isTaskGraph != 1)
+    {
+        if (pthread_create(&decoderThread, NULL, decodeTraces, NULL) != 0)
+        {
+            perror("Starting trace decoder thread, decoding inline instead");
+            readAhead = 0;
+        }
+    }
+    else
+    {
+        readAhead = 0;
+    }
+    
     tr->si.tick = tick;
     tr->si.finish = finish;
     tr->si.destroy = destroy;
@@ -95,134 +155,229 @@ trace_reader* init(trace_sim_args* tsa)
     return tr;
 }
 
-uint64_t opCount = 0;
-trace_op* getNextOp(int processorNum)
+//
+// startStream
+//
+//   Moves a newly opened trace to the start of the region of interest,
+// using its index (if indexFD is open) to avoid decoding every op before it.
+//
+static void startStream(trace_stream* ts, int indexFD, const struct stat* sb)
 {
-    trace_op* op = calloc(1, sizeof(trace_op));
-    FILE* tf = NULL;
-    
-    if (isTaskGraph == 1)
+    ts->opsLeft = replayOps > 0 ? replayOps : UINT64_MAX;
+    if (skipOps == 0)
     {
-        return gno(processorNum);
+        return;
     }
     
-    if (traceFile[processorNum] == NULL)
+    uint64_t skipped = skipTraceOps(ts, indexFD, sb, skipOps);
+    if (skipped < skipOps)
     {
-        char fileName[16];
-        snprintf(fileName, 16, "p%d.trace", processorNum);
+        fprintf(stderr, "Trace ended after %lu ops, before the %lu to skip\n",
+                skipped, skipOps);
+    }
+}
+
+// Opens a processor's trace from the trace directory on first use.
+static trace_stream* processorStream(int processorNum)
+{
+    trace_stream* ts = &traceStreams[processorNum];
+    if (ts->type == ASCII && ts->textFile == NULL)
+    {
+        char fileName[32];
+        snprintf(fileName, sizeof(fileName), "p%d.trace", processorNum);
         
+        struct stat sb;
         int tempFD = openat(masterFD, fileName, O_RDONLY);
-        if (tempFD == -1)
+        if (tempFD == -1 || fstat(tempFD, &sb) != 0)
         {
             perror("Error opening processor specific trace - ");
             
             return NULL;
         }
         
-        traceFile[processorNum] = fdopen(tempFD, "r");
-        if (traceFile[processorNum] == NULL)
+        if (openTraceStream(ts, tempFD) != 0)
         {
-            perror("Error converting FD for processor specific trace - ");
-            
             return NULL;
         }
+        
+        int indexFD = -1;
+        if (skipOps > 0)
+        {
+            snprintf(fileName, sizeof(fileName), "p%d.trace.idx",
+                     processorNum);
+            indexFD = openat(masterFD, fileName, O_RDONLY);
+        }
+        startStream(ts, indexFD, &sb);
     }
     
-    tf = traceFile[processorNum];
+    return ts;
+}
+
+//
+// fillRing
+//
+//   Producer side of a processor's ring.  Decodes ops until the ring is
+// full or the trace stops producing them, and returns how many slots were
+// queued.  A text trace can stop at a blank line and carry on after it,
+// which is queued as a NONE op so the consumer sees the gap in order.
+//
+static int fillRing(int processorNum)
+{
+    trace_ring* ring = &traceRings[processorNum];
+    trace_stream* ts = processorStream(processorNum);
+    if (ts == NULL)
+    {
+        atomic_store_explicit(&ring->ended, 1, memory_order_release);
+        return 0;
+    }
     
-    // TODO - Support for other basic formats
-    char opType = 0;
-    uint64_t memAddress, pcAddress, nextPC;
-    int opSize;
-    int32_t op0, op1, op2;
-    if (0 == fscanf(tf, "%c", &opType))
+    uint64_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    uint64_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    uint64_t start = tail;
+    int ended = 0;
+    while (tail - head < TRACE_RING_SIZE)
     {
-        free(op);
-        return NULL;
+        if (ts->opsLeft == 0)
+        {
+            ended = 1;
+            break;
+        }
+        
+        trace_op* op = &ring->ops[tail & TRACE_RING_MASK];
+        if (!readTraceOp(ts, op))
+        {
+            if (traceStreamEnded(ts))
+            {
+                ended = 1;
+                break;
+            }
+            
+            op->op = NONE;
+            tail++;
+            break;
+        }
+        ts->opsLeft--;
+        tail++;
     }
     
-    if (opType == '\0' || isspace(opType))
+    atomic_store_explicit(&ring->tail, tail, memory_order_release);
+    if (ended)
     {
-        free(op);
-        return NULL;
+        atomic_store_explicit(&ring->ended, 1, memory_order_release);
     }
     
-    switch (opType)
+    return tail - start;
+}
+
+static void* decodeTraces(void* arg)
+{
+    int idlePasses = 0;
+    
+    while (!atomic_load_explicit(&stopDecoder, memory_order_relaxed))
     {
-        case 'A':
-            op->op = ALU;
-            (void)!fscanf(tf, "%lx %d, %d, %d\n", &pcAddress, &op0, &op1, &op2);
-            op->pcAddress = pcAddress;
-            op->dest_reg = op0;
-            op->src_reg[0] = op1;
-            op->src_reg[1] = op2;
-            break;
-        case 'B':
-            op->op = BRANCH;
-            (void)!fscanf(tf, "%lx %lx", &pcAddress, &nextPC);
-            if (1 == fscanf(tf, " %d\n", &op0))
-            {
-                op->src_reg[0] = op0;
-            }
-            else
+        int queued = 0;
+        int active = 0;
+        for (int i = 0; i < processorCount; i++)
+        {
+            if (atomic_load_explicit(&traceRings[i].ended, memory_order_relaxed))
             {
-                (void)!fscanf(tf, "\n");
-                op->src_reg[0] = -1;
+                continue;
             }
-            op->pcAddress = pcAddress;
-            op->nextPCAddress = nextPC;
-            op->src_reg[1] = -1;
-            op->dest_reg = -1;
+            
+            active++;
+            queued += fillRing(i);
+        }
+        
+        if (active == 0)
+        {
             break;
-        case 'L':
-            op->op = MEM_LOAD;
-            (void)!fscanf(tf, "%lx,%d", &memAddress, &opSize);
-            if (1 == fscanf(tf, " %d\n", &op0))
-            {
-                op->src_reg[0] = op0;
-            }
+        }
+        
+        // Every ring is full, so the simulation is behind.  Back off to
+        //   sleeping if it stays that way.
+        if (queued == 0)
+        {
+            if (++idlePasses < 64)
+                sched_yield();
             else
+                usleep(50);
+        }
+        else
+        {
+            idlePasses = 0;
+        }
+    }
+    
+    return NULL;
+}
+
+int getNextOps(int processorNum, trace_op* buf, int n)
+{
+    int count = 0;
+    
+    if (isTaskGraph == 1)
+    {
+        trace_op* op;
+        while (count < n && (op = gno(processorNum)) != NULL)
+        {
+            buf[count++] = *op;
+            free(op);
+        }
+        return count;
+    }
+    
+    trace_ring* ring = &traceRings[processorNum];
+    uint64_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    while (count < n)
+    {
+        uint64_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+        if (head == tail)
+        {
+            // ended is only set after the final ops are published.
+            if (atomic_load_explicit(&ring->ended, memory_order_acquire)
+                && head == atomic_load_explicit(&ring->tail,
+                                                memory_order_acquire))
             {
-                (void)!fscanf(tf, "\n");
-                op->src_reg[0] = -1;
-            }
-            op->memAddress = memAddress;
-            op->size = opSize;
-            op->src_reg[1] = -1;
-            op->dest_reg = -1;
-            break;
-        case 'S':
-            op->op = MEM_STORE;
-            (void)!fscanf(tf, "%lx,%d", &memAddress, &opSize);
-            if (1 == fscanf(tf, " %d\n", &op0))
-            {
-                op->dest_reg = op0;
+                break;
             }
+            
+            if (readAhead)
+                sched_yield();
             else
-            {
-                (void)!fscanf(tf, "\n");
-                op->dest_reg = -1;
-            }
-            op->memAddress = memAddress;
-            op->size = opSize;
-            op->src_reg[0] = -1;
-            op->src_reg[1] = -1;
-            break;
-        case 'X':
-            op->op = ALU_LONG;
-            (void)!fscanf(tf, "%lx %d, %d, %d\n", &pcAddress, &op0, &op1, &op2);
-            op->pcAddress = pcAddress;
-            op->dest_reg = op0;
-            op->src_reg[0] = op1;
-            op->src_reg[1] = op2;
+                fillRing(processorNum);
+            continue;
+        }
+        
+        const trace_op* op = &ring->ops[head & TRACE_RING_MASK];
+        if (op->op == NONE)
+        {
+            // Hand back the ops before the gap first.
+            if (count == 0) head++;
             break;
-        default:
-            fprintf(stderr, "Invalid op type: %x on %ld\n", opType, opCount);
-            free(op);
-            return NULL;
+        }
+        
+        buf[count++] = *op;
+        head++;
+    }
+    
+    atomic_store_explicit(&ring->head, head, memory_order_release);
+    return count;
+}
+
+trace_op* getNextOp(int processorNum)
+{
+    if (isTaskGraph == 1)
+    {
+        return gno(processorNum);
+    }
+    
+    trace_op* op = malloc(sizeof(trace_op));
+    if (op == NULL || getNextOps(processorNum, op, 1) == 0)
+    {
+        free(op);
+        return NULL;
     }
     
-    opCount++;
     return op;
 }
 
@@ -239,9 +394,17 @@ int finish(int outFd)
 int destroy(void)
 {
     int i;
+    if (readAhead)
+    {
+        atomic_store_explicit(&stopDecoder, 1, memory_order_relaxed);
+        pthread_join(decoderThread, NULL);
+    }
+    
     for (i = 0; i < processorCount; i++)
     {
-        if (traceFile[i] != NULL) fclose(traceFile[i]);
+        closeTraceStream(&traceStreams[i]);
     }
+    free(traceStreams);
+    free(traceRings);
     return 0;
 }
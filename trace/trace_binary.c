@@ -0,0 +1,174 @@
+#include "trace.h"
+#include "trace_internal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+//
+// isBinaryTrace
+//
+//   Checks for the binary trace magic without moving the file offset, so
+// a text trace can still be read from the start.
+//
+int isBinaryTrace(int fd)
+{
+    char magic[8];
+    if (pread(fd, magic, sizeof(magic), 0) != sizeof(magic)) return 0;
+
+    return memcmp(magic, BINARY_TRACE_MAGIC, sizeof(magic)) == 0;
+}
+
+//
+// openBinaryTrace
+//
+//   Maps the whole trace read-only.  The fd can be closed afterward.
+// Returns 0 on success.
+//
+int openBinaryTrace(int fd, trace_stream* ts)
+{
+    struct stat sb;
+    if (fstat(fd, &sb) == -1)
+    {
+        perror("Getting binary trace size");
+        return -1;
+    }
+
+    if ((size_t)sb.st_size < sizeof(binary_trace_header))
+    {
+        fprintf(stderr, "Binary trace is missing its header\n");
+        return -1;
+    }
+
+    void* map = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED)
+    {
+        perror("Mapping binary trace");
+        return -1;
+    }
+    (void)madvise(map, sb.st_size, MADV_SEQUENTIAL);
+
+    const binary_trace_header* hdr = map;
+    if (hdr->version != BINARY_TRACE_VERSION
+        || hdr->recordSize != sizeof(binary_trace_record))
+    {
+        fprintf(stderr, "Unsupported binary trace version %u (record size %u)\n",
+                hdr->version, hdr->recordSize);
+        munmap(map, sb.st_size);
+        return -1;
+    }
+
+    // A trace cut short (e.g., by an interrupted conversion) is replayed
+    //   up to its last complete record.
+    uint64_t fileRecords = (sb.st_size - sizeof(binary_trace_header))
+                           / sizeof(binary_trace_record);
+    ts->recordCount = hdr->recordCount;
+    if (ts->recordCount > fileRecords)
+    {
+        fprintf(stderr, "Binary trace truncated, %lu of %lu records present\n",
+                fileRecords, hdr->recordCount);
+        ts->recordCount = fileRecords;
+    }
+
+    ts->type = BINARY;
+    ts->map = map;
+    ts->mapLength = sb.st_size;
+    ts->records = (const binary_trace_record*)(hdr + 1);
+    ts->nextRecord = 0;
+
+    return 0;
+}
+
+//
+// openBinaryTraceStream
+//
+//   Reads a compressed binary trace a chunk of records at a time, as it
+// cannot be mapped.  The header count is not trusted here, the writer may
+// not have been able to seek back and fill it in.
+//
+int openBinaryTraceStream(trace_stream* ts)
+{
+    binary_trace_header hdr;
+    if (readTraceBytes(ts, &hdr, sizeof(hdr)) != sizeof(hdr))
+    {
+        fprintf(stderr, "Binary trace is missing its header\n");
+        return -1;
+    }
+
+    if (hdr.version != BINARY_TRACE_VERSION
+        || hdr.recordSize != sizeof(binary_trace_record))
+    {
+        fprintf(stderr, "Unsupported binary trace version %u (record size %u)\n",
+                hdr.version, hdr.recordSize);
+        return -1;
+    }
+
+    ts->blockCapacity = BINARY_CHUNK_RECORDS * sizeof(binary_trace_record);
+    ts->block = malloc(ts->blockCapacity);
+    if (ts->block == NULL) return -1;
+
+    ts->type = BINARY;
+    ts->records = (const binary_trace_record*)ts->block;
+    ts->recordCount = 0;
+    ts->nextRecord = 0;
+
+    return 0;
+}
+
+// Called once every record read so far has been consumed.
+int refillBinaryTrace(trace_stream* ts)
+{
+    if (ts->gz == NULL)
+    {
+        ts->ended = 1;
+        return 0;
+    }
+
+    size_t len = readTraceBytes(ts, ts->block, ts->blockCapacity);
+    ts->recordCount = len / sizeof(binary_trace_record);
+    ts->nextRecord = 0;
+    if (ts->recordCount == 0)
+    {
+        ts->ended = 1;
+        return 0;
+    }
+
+    return 1;
+}
+
+void closeBinaryTrace(trace_stream* ts)
+{
+    if (ts->map != NULL) munmap(ts->map, ts->mapLength);
+    ts->map = NULL;
+    ts->records = NULL;
+}
+
+//
+// encodeBinaryOp
+//
+//   Packs an op into a record.  Returns 0 if a field does not fit.
+//
+int encodeBinaryOp(const trace_op* op, binary_trace_record* rec)
+{
+    if (op->dest_reg < INT8_MIN || op->dest_reg > INT8_MAX
+        || op->src_reg[0] < INT8_MIN || op->src_reg[0] > INT8_MAX
+        || op->src_reg[1] < INT8_MIN || op->src_reg[1] > INT8_MAX)
+    {
+        return 0;
+    }
+
+    memset(rec, 0, sizeof(binary_trace_record));
+    rec->pcAddress = op->pcAddress;
+    rec->address = op->memAddress;
+    rec->size = op->size;
+    rec->op = op->op;
+    rec->dest_reg = op->dest_reg;
+    rec->src_reg[0] = op->src_reg[0];
+    rec->src_reg[1] = op->src_reg[1];
+
+    return 1;
+}
@@ -0,0 +1,210 @@
+#include "trace.h"
+#include "trace_internal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static inline uint64_t zigzag(int64_t v)
+{
+    return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+
+static inline int64_t unzigzag(uint64_t v)
+{
+    return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+static inline size_t putVarint(uint8_t* out, uint64_t v)
+{
+    size_t n = 0;
+    while (v >= 0x80)
+    {
+        out[n++] = (uint8_t)v | 0x80;
+        v >>= 7;
+    }
+    out[n++] = (uint8_t)v;
+    return n;
+}
+
+// Block buffers are padded by DELTA_MAX_OP_BYTES, so a corrupt op can run
+//   past the end of its block but not out of the buffer.
+static inline uint64_t getVarint(const uint8_t** pos)
+{
+    const uint8_t* p = *pos;
+    uint64_t v = *p & 0x7f;
+    int shift = 7;
+    while ((*p++ & 0x80) && shift < 64)
+    {
+        v |= (uint64_t)(*p & 0x7f) << shift;
+        shift += 7;
+    }
+    *pos = p;
+    return v;
+}
+
+int openDeltaTrace(trace_stream* ts)
+{
+    delta_trace_header hdr;
+    if (readTraceBytes(ts, &hdr, sizeof(hdr)) != sizeof(hdr))
+    {
+        fprintf(stderr, "Delta trace is missing its header\n");
+        return -1;
+    }
+
+    if (hdr.version != DELTA_TRACE_VERSION)
+    {
+        fprintf(stderr, "Unsupported delta trace version %u\n", hdr.version);
+        return -1;
+    }
+
+    ts->type = DELTA;
+    ts->blockOpsLeft = 0;
+    return 0;
+}
+
+//
+// readDeltaBlock
+//
+//   Reads the next block whole, so its ops are decoded straight from memory
+// rather than byte by byte from the file.  Returns 0 at the end of the trace.
+//
+static int readDeltaBlock(trace_stream* ts)
+{
+    delta_block_header bh;
+    size_t len = readTraceBytes(ts, &bh, sizeof(bh));
+    if (len == 0) return 0;
+    if (len != sizeof(bh))
+    {
+        fprintf(stderr, "Delta trace ends inside a block header\n");
+        return 0;
+    }
+
+    if (bh.byteLength > (size_t)bh.opCount * DELTA_MAX_OP_BYTES)
+    {
+        fprintf(stderr, "Delta trace block is corrupt (%u ops in %u bytes)\n",
+                bh.opCount, bh.byteLength);
+        return 0;
+    }
+
+    if (bh.byteLength + DELTA_MAX_OP_BYTES > ts->blockCapacity)
+    {
+        uint8_t* block = realloc(ts->block, bh.byteLength + DELTA_MAX_OP_BYTES);
+        if (block == NULL) return 0;
+        ts->block = block;
+        ts->blockCapacity = bh.byteLength + DELTA_MAX_OP_BYTES;
+    }
+    memset(ts->block + bh.byteLength, 0, DELTA_MAX_OP_BYTES);
+
+    if (readTraceBytes(ts, ts->block, bh.byteLength) != bh.byteLength)
+    {
+        fprintf(stderr, "Delta trace ends inside a block\n");
+        return 0;
+    }
+
+    ts->blockPos = ts->block;
+    ts->blockEnd = ts->block + bh.byteLength;
+    ts->blockOpsLeft = bh.opCount;
+    ts->state.pcAddress = 0;
+    ts->state.memAddress = 0;
+    return 1;
+}
+
+int readDeltaOp(trace_stream* ts, trace_op* op)
+{
+    while (ts->blockOpsLeft == 0)
+    {
+        if (!readDeltaBlock(ts))
+        {
+            ts->ended = 1;
+            return 0;
+        }
+    }
+    ts->blockOpsLeft--;
+
+    const uint8_t* p = ts->blockPos;
+    delta_state* ds = &ts->state;
+    uint8_t tag = *p++;
+
+    memset(op, 0, sizeof(trace_op));
+    op->op = tag & DELTA_TAG_OP_MASK;
+    ds->pcAddress += unzigzag(getVarint(&p));
+    op->pcAddress = ds->pcAddress;
+
+    switch (op->op)
+    {
+        case MEM_LOAD:
+        case MEM_STORE:
+            ds->memAddress += unzigzag(getVarint(&p));
+            op->memAddress = ds->memAddress;
+            op->size = getVarint(&p);
+            break;
+        case BRANCH:
+            op->nextPCAddress = op->pcAddress + unzigzag(getVarint(&p));
+            break;
+        default:
+            break;
+    }
+
+    op->dest_reg = (tag & DELTA_TAG_DEST) ? unzigzag(getVarint(&p)) : -1;
+    op->src_reg[0] = (tag & DELTA_TAG_SRC0) ? unzigzag(getVarint(&p)) : -1;
+    op->src_reg[1] = (tag & DELTA_TAG_SRC1) ? unzigzag(getVarint(&p)) : -1;
+
+    if (p > ts->blockEnd)
+    {
+        fprintf(stderr, "Delta trace block is corrupt, op runs past its end\n");
+        ts->blockOpsLeft = 0;
+        ts->ended = 1;
+        return 0;
+    }
+
+    ts->blockPos = p;
+    return 1;
+}
+
+void closeDeltaTrace(trace_stream* ts)
+{
+    free(ts->block);
+    ts->block = NULL;
+    ts->blockCapacity = 0;
+}
+
+//
+// encodeDeltaOp
+//
+//   Appends op to out, which must have room for DELTA_MAX_OP_BYTES, and
+// returns how many bytes it took.  ds must be zeroed at each block start.
+//
+size_t encodeDeltaOp(delta_state* ds, const trace_op* op, uint8_t* out)
+{
+    size_t n = 1;
+    uint8_t tag = op->op & DELTA_TAG_OP_MASK;
+    if (op->dest_reg != -1) tag |= DELTA_TAG_DEST;
+    if (op->src_reg[0] != -1) tag |= DELTA_TAG_SRC0;
+    if (op->src_reg[1] != -1) tag |= DELTA_TAG_SRC1;
+    out[0] = tag;
+
+    n += putVarint(out + n, zigzag(op->pcAddress - ds->pcAddress));
+    ds->pcAddress = op->pcAddress;
+
+    switch (op->op)
+    {
+        case MEM_LOAD:
+        case MEM_STORE:
+            n += putVarint(out + n, zigzag(op->memAddress - ds->memAddress));
+            ds->memAddress = op->memAddress;
+            n += putVarint(out + n, (uint32_t)op->size);
+            break;
+        case BRANCH:
+            n += putVarint(out + n, zigzag(op->nextPCAddress - op->pcAddress));
+            break;
+        default:
+            break;
+    }
+
+    if (tag & DELTA_TAG_DEST) n += putVarint(out + n, zigzag(op->dest_reg));
+    if (tag & DELTA_TAG_SRC0) n += putVarint(out + n, zigzag(op->src_reg[0]));
+    if (tag & DELTA_TAG_SRC1) n += putVarint(out + n, zigzag(op->src_reg[1]));
+
+    return n;
+}
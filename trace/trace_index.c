@@ -0,0 +1,161 @@
+#include "trace.h"
+#include "trace_internal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <unistd.h>
+
+static int64_t modifiedTime(const struct stat* sb)
+{
+    return (int64_t)sb->st_mtim.tv_sec * 1000000000 + sb->st_mtim.tv_nsec;
+}
+
+//
+// writeTraceIndex
+//
+//   Reads the whole trace from its current position, noting where it can be
+// resumed every interval ops.  sb is the trace's stat, to tell later if the
+// index still matches it.  Returns the number of entries written, or -1.
+//
+int writeTraceIndex(trace_stream* ts, const struct stat* sb, FILE* out,
+                    uint32_t interval)
+{
+    trace_index_header hdr = {0};
+    memcpy(hdr.magic, TRACE_INDEX_MAGIC, sizeof(hdr.magic));
+    hdr.version = TRACE_INDEX_VERSION;
+    hdr.interval = interval;
+    hdr.traceSize = sb->st_size;
+    hdr.traceModified = modifiedTime(sb);
+
+    // The count is filled in once the trace has been read.
+    if (fwrite(&hdr, sizeof(hdr), 1, out) != 1) return -1;
+
+    uint64_t ops = 0;
+    uint64_t lastEntry = 0;
+    trace_op op;
+    while (1)
+    {
+        int64_t offset = traceStreamTell(ts);
+        if (offset >= 0 && ops - lastEntry >= interval)
+        {
+            trace_index_entry e = {ops, offset};
+            if (fwrite(&e, sizeof(e), 1, out) != 1) return -1;
+            hdr.entryCount++;
+            lastEntry = ops;
+        }
+
+        if (!readTraceOp(ts, &op))
+        {
+            if (traceStreamEnded(ts)) break;
+            continue;
+        }
+        ops++;
+    }
+
+    if (fseek(out, 0, SEEK_SET) != 0) return -1;
+    if (fwrite(&hdr, sizeof(hdr), 1, out) != 1) return -1;
+
+    return hdr.entryCount;
+}
+
+//
+// findIndexEntry
+//
+//   Finds the last place in the index at or before op number target.
+// Returns 0 if there is none or the index does not belong to this trace.
+//
+static int findIndexEntry(int indexFD, const struct stat* sb, uint64_t target,
+                          trace_index_entry* found)
+{
+    trace_index_header hdr;
+    if (pread(indexFD, &hdr, sizeof(hdr), 0) != sizeof(hdr)
+        || memcmp(hdr.magic, TRACE_INDEX_MAGIC, sizeof(hdr.magic)) != 0
+        || hdr.version != TRACE_INDEX_VERSION)
+    {
+        fprintf(stderr, "Trace index is not valid, ignoring it\n");
+        return 0;
+    }
+
+    if (hdr.traceSize != (uint64_t)sb->st_size
+        || hdr.traceModified != modifiedTime(sb))
+    {
+        fprintf(stderr, "Trace index is out of date, ignoring it\n");
+        return 0;
+    }
+
+    size_t len = hdr.entryCount * sizeof(trace_index_entry);
+    trace_index_entry* entries = malloc(len);
+    if (entries == NULL) return 0;
+    if (pread(indexFD, entries, len, sizeof(hdr)) != (ssize_t)len)
+    {
+        fprintf(stderr, "Trace index is truncated, ignoring it\n");
+        free(entries);
+        return 0;
+    }
+
+    // Binary search for the first entry past target.
+    uint64_t lo = 0, hi = hdr.entryCount;
+    while (lo < hi)
+    {
+        uint64_t mid = lo + (hi - lo) / 2;
+        if (entries[mid].opCount <= target)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    int r = 0;
+    if (lo > 0)
+    {
+        *found = entries[lo - 1];
+        r = 1;
+    }
+
+    free(entries);
+    return r;
+}
+
+//
+// skipTraceOps
+//
+//   Moves a newly opened trace past its first ops ("-F").  Binary traces are
+// seeked directly.  Otherwise the trace's index is used, if indexFD is open
+// and matches the trace, and the ops from there on are decoded and dropped.
+// Closes indexFD.  Returns how many ops were skipped, fewer than asked for
+// only if the trace ended first.
+//
+uint64_t skipTraceOps(trace_stream* ts, int indexFD, const struct stat* sb,
+                      uint64_t ops)
+{
+    uint64_t skipped = 0;
+
+    if (ts->type == BINARY && ts->map != NULL)
+    {
+        skipped = ops < ts->recordCount ? ops : ts->recordCount;
+        ts->nextRecord = skipped;
+    }
+    else if (indexFD != -1)
+    {
+        trace_index_entry e;
+        if (findIndexEntry(indexFD, sb, ops, &e)
+            && traceStreamSeek(ts, e.offset) == 0)
+        {
+            skipped = e.opCount;
+        }
+    }
+
+    if (indexFD != -1) close(indexFD);
+
+    trace_op op;
+    while (skipped < ops)
+    {
+        if (readTraceOp(ts, &op))
+            skipped++;
+        else if (traceStreamEnded(ts))
+            break;
+    }
+
+    return skipped;
+}
@@ -1,11 +1,222 @@
 #ifndef TRACE_INTERNAL_H
 #define TRACE_INTERNAL_H
 
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <sys/stat.h>
+
+#include "trace.h"
+
 enum TRACE_TYPE {
     ASCII,
     STDIN,
     PIN,
-    CONTECH
+    CONTECH,
+    BINARY,
+    DELTA
 };
 
-#endif
\ No newline at end of file
+//
+// Binary traces
+//
+//   A binary trace is a binary_trace_header followed by recordCount
+// fixed size records.  The file is mapped and each op is decoded with
+// a few loads instead of being parsed.  All fields are little-endian.
+//
+#define BINARY_TRACE_MAGIC "CADSSBT1"
+#define BINARY_TRACE_VERSION 1
+
+typedef struct _binary_trace_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t recordSize;
+    uint64_t recordCount;
+} binary_trace_header;
+
+typedef struct _binary_trace_record {
+    uint64_t pcAddress;
+    uint64_t address;   // memAddress or nextPCAddress, depending on op
+    int32_t size;
+    uint8_t op;
+    int8_t dest_reg;
+    int8_t src_reg[2];
+} binary_trace_record;
+
+//
+// Delta traces
+//
+//   A delta trace is a delta_trace_header followed by blocks, each a
+// delta_block_header and byteLength bytes holding opCount ops.  An op is a
+// tag byte (op type, plus which registers are not -1) followed by varints:
+// the PC as a zigzag delta from the previous PC, then for memory ops the
+// address as a zigzag delta from the previous memory address and the size,
+// for branches the target as a zigzag delta from the PC, and last each
+// register present.  Deltas restart from zero at every block, so a block
+// can be decoded without the ones before it.
+//
+#define DELTA_TRACE_MAGIC "CADSSDT1"
+#define DELTA_TRACE_VERSION 1
+#define DELTA_BLOCK_OPS 16384
+#define DELTA_MAX_OP_BYTES 64
+
+#define DELTA_TAG_OP_MASK 0x7
+#define DELTA_TAG_DEST 0x8
+#define DELTA_TAG_SRC0 0x10
+#define DELTA_TAG_SRC1 0x20
+
+typedef struct _delta_trace_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t blockOps;
+    uint64_t opCount;   // 0 if the writer could not go back and fill it in
+} delta_trace_header;
+
+typedef struct _delta_block_header {
+    uint32_t opCount;
+    uint32_t byteLength;
+} delta_block_header;
+
+typedef struct _delta_state {
+    uint64_t pcAddress;
+    uint64_t memAddress;
+} delta_state;
+
+// Gzip compressed traces of any of the above are read through zlib
+//   when it is available.
+#define GZIP_MAGIC "\x1f\x8b"
+
+// Records read at a time from a gzip compressed binary trace.
+#define BINARY_CHUNK_RECORDS 4096
+
+//
+// Trace indexes
+//
+//   A sidecar file (the trace's name plus ".idx") listing places a trace
+// can be resumed from: after opCount ops, reading starts again at byte
+// offset.  Entries are at least interval ops apart and in order.  Text
+// traces can resume at any line, delta traces at any block.  Binary
+// traces are seeked to directly and are not indexed.  traceSize and
+// traceModified catch an index left over from an older trace.
+//
+#define TRACE_INDEX_MAGIC "CADSSIX1"
+#define TRACE_INDEX_VERSION 1
+#define TRACE_INDEX_INTERVAL 65536
+
+typedef struct _trace_index_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t interval;
+    uint64_t entryCount;
+    uint64_t traceSize;
+    int64_t traceModified;  // nanoseconds
+} trace_index_header;
+
+typedef struct _trace_index_entry {
+    uint64_t opCount;
+    uint64_t offset;
+} trace_index_entry;
+
+// One processor's trace, whichever format it is in.
+typedef struct _trace_stream {
+    enum TRACE_TYPE type;
+    int ended;
+    FILE* textFile;
+    uint64_t opsLeft;   // ops still to replay, once "-W" limits them
+
+    // BINARY - either the whole mapped file or the last chunk read
+    void* map;
+    size_t mapLength;
+    const binary_trace_record* records;
+    uint64_t recordCount;
+    uint64_t nextRecord;
+
+    // DELTA - the current block, read whole and decoded in place
+    int fd;
+    uint8_t* block;
+    size_t blockCapacity;
+    const uint8_t* blockPos;
+    const uint8_t* blockEnd;
+    uint32_t blockOpsLeft;
+    delta_state state;
+
+    void* gz;   // gzFile the bytes come from, if compressed
+} trace_stream;
+
+//
+// Decoded ops waiting to be handed to a processor.  Each ring has a single
+//   producer (the decoder thread, or the simulation itself when there is
+//   none) and a single consumer, so head and tail are only ever written by
+//   one side.  They only increase, the slot is the count modulo the size.
+//
+//   A NONE op marks a point where the trace produced no op (e.g., a blank
+//   line in a text trace), which is reported to the consumer as an empty
+//   fetch.  ended is set once every op has been queued.
+//
+#define TRACE_RING_SIZE 4096
+#define TRACE_RING_MASK (TRACE_RING_SIZE - 1)
+
+typedef struct _trace_ring {
+    _Atomic uint64_t head;
+    char pad[64 - sizeof(uint64_t)];    // keep head and tail on separate lines
+    _Atomic uint64_t tail;
+    _Atomic int ended;
+    trace_op ops[TRACE_RING_SIZE];
+} trace_ring;
+
+// trace_stream.c - format independent access to one trace
+int openTraceStream(trace_stream* ts, int fd);
+int readTraceOp(trace_stream* ts, trace_op* op);
+int traceStreamEnded(trace_stream* ts);
+void closeTraceStream(trace_stream* ts);
+
+// trace_stream.c - where reading can resume from, or -1 if it cannot
+//   resume from here (e.g., inside a delta block or a compressed trace)
+int64_t traceStreamTell(trace_stream* ts);
+int traceStreamSeek(trace_stream* ts, int64_t offset);
+
+// trace_stream.c - reads the raw bytes of a trace, decompressing if needed,
+//   returns how many were read before the end of the file
+size_t readTraceBytes(trace_stream* ts, void* buf, size_t len);
+
+// trace_text.c - parse one op from a text trace, returns 1 if op was filled
+int readTextOp(FILE* tf, trace_op* op);
+
+// trace_binary.c
+int isBinaryTrace(int fd);
+int openBinaryTrace(int fd, trace_stream* ts);
+void closeBinaryTrace(trace_stream* ts);
+int openBinaryTraceStream(trace_stream* ts);
+int refillBinaryTrace(trace_stream* ts);
+int encodeBinaryOp(const trace_op* op, binary_trace_record* rec);
+
+// trace_index.c
+int writeTraceIndex(trace_stream* ts, const struct stat* sb, FILE* out,
+                    uint32_t interval);
+uint64_t skipTraceOps(trace_stream* ts, int indexFD, const struct stat* sb,
+                      uint64_t ops);
+
+// trace_delta.c
+int openDeltaTrace(trace_stream* ts);
+int readDeltaOp(trace_stream* ts, trace_op* op);
+void closeDeltaTrace(trace_stream* ts);
+size_t encodeDeltaOp(delta_state* ds, const trace_op* op, uint8_t* out);
+
+static inline int readBinaryOp(trace_stream* ts, trace_op* op)
+{
+    if (ts->nextRecord >= ts->recordCount && !refillBinaryTrace(ts)) return 0;
+
+    const binary_trace_record* rec = &ts->records[ts->nextRecord++];
+    op->op = rec->op;
+    op->pcAddress = rec->pcAddress;
+    op->memAddress = rec->address;
+    op->size = rec->size;
+    op->dest_reg = rec->dest_reg;
+    op->src_reg[0] = rec->src_reg[0];
+    op->src_reg[1] = rec->src_reg[1];
+
+    return 1;
+}
+
+#endif
@@ -0,0 +1,217 @@
+#define _GNU_SOURCE
+#include "trace.h"
+#include "trace_internal.h"
+
+#include <stdio.h>
+
+#include <unistd.h>
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+size_t readTraceBytes(trace_stream* ts, void* buf, size_t len)
+{
+    size_t total = 0;
+    while (total < len)
+    {
+        ssize_t r;
+#ifdef HAVE_ZLIB
+        if (ts->gz != NULL)
+            r = gzread(ts->gz, (char*)buf + total, len - total);
+        else
+#endif
+            r = read(ts->fd, (char*)buf + total, len - total);
+
+        if (r <= 0) break;
+        total += r;
+    }
+    return total;
+}
+
+#ifdef HAVE_ZLIB
+// Lets the text parser read a compressed text trace through a FILE*.
+static ssize_t gzCookieRead(void* cookie, char* buf, size_t size)
+{
+    return gzread(cookie, buf, size);
+}
+
+static int gzCookieClose(void* cookie)
+{
+    return gzclose(cookie) == Z_OK ? 0 : -1;
+}
+
+//
+// openGzipStream
+//
+//   Looks inside a gzip compressed trace to find which format it holds,
+// then reads it through zlib.
+//
+static int openGzipStream(trace_stream* ts, int fd)
+{
+    ts->gz = gzdopen(fd, "rb");
+    if (ts->gz == NULL)
+    {
+        fprintf(stderr, "Failed to open compressed trace\n");
+        close(fd);
+        return -1;
+    }
+    gzbuffer(ts->gz, 256 * 1024);
+
+    char magic[8] = {0};
+    (void)gzread(ts->gz, magic, sizeof(magic));
+    if (gzrewind(ts->gz) != 0)
+    {
+        fprintf(stderr, "Failed to rewind compressed trace\n");
+        return -1;
+    }
+
+    if (memcmp(magic, BINARY_TRACE_MAGIC, sizeof(magic)) == 0)
+    {
+        return openBinaryTraceStream(ts);
+    }
+    if (memcmp(magic, DELTA_TRACE_MAGIC, sizeof(magic)) == 0)
+    {
+        return openDeltaTrace(ts);
+    }
+
+    cookie_io_functions_t gzio = {gzCookieRead, NULL, NULL, gzCookieClose};
+    ts->type = ASCII;
+    ts->textFile = fopencookie(ts->gz, "r", gzio);
+    if (ts->textFile == NULL)
+    {
+        perror("Opening compressed text trace");
+        return -1;
+    }
+
+    // The FILE* now owns the gzFile.
+    ts->gz = NULL;
+    return 0;
+}
+#endif
+
+//
+// openTraceStream
+//
+//   Sets up a trace from an open file, mapping it if it is a binary trace,
+// decoding it block by block if it is a delta trace and otherwise reading
+// it as text.  Gzip compressed traces are read through zlib when the
+// reader is built with it.  Takes ownership of fd.  Returns 0 on success.
+//
+int openTraceStream(trace_stream* ts, int fd)
+{
+    char magic[8] = {0};
+    (void)!pread(fd, magic, sizeof(magic), 0);
+
+    ts->fd = -1;
+    if (memcmp(magic, GZIP_MAGIC, 2) == 0)
+    {
+#ifdef HAVE_ZLIB
+        return openGzipStream(ts, fd);
+#else
+        fprintf(stderr, "Trace is gzip compressed, but the reader was built "
+                        "without zlib\n");
+        close(fd);
+        return -1;
+#endif
+    }
+
+    if (isBinaryTrace(fd))
+    {
+        int r = openBinaryTrace(fd, ts);
+        close(fd);
+        return r;
+    }
+
+    if (memcmp(magic, DELTA_TRACE_MAGIC, sizeof(magic)) == 0)
+    {
+        ts->fd = fd;
+        return openDeltaTrace(ts);
+    }
+
+    ts->type = ASCII;
+    ts->textFile = fdopen(fd, "r");
+    if (ts->textFile == NULL)
+    {
+        perror("Error converting FD for processor specific trace - ");
+        close(fd);
+        return -1;
+    }
+
+    return 0;
+}
+
+int readTraceOp(trace_stream* ts, trace_op* op)
+{
+    switch (ts->type)
+    {
+        case BINARY:
+            return readBinaryOp(ts, op);
+        case DELTA:
+            return readDeltaOp(ts, op);
+        default:
+            return readTextOp(ts->textFile, op);
+    }
+}
+
+int64_t traceStreamTell(trace_stream* ts)
+{
+    switch (ts->type)
+    {
+        case ASCII:
+            return ftello(ts->textFile);
+        case DELTA:
+            if (ts->gz != NULL || ts->blockOpsLeft != 0) return -1;
+            return lseek(ts->fd, 0, SEEK_CUR);
+        default:
+            return -1;
+    }
+}
+
+// Resumes reading at an offset from traceStreamTell.  Returns 0 on success.
+int traceStreamSeek(trace_stream* ts, int64_t offset)
+{
+    switch (ts->type)
+    {
+        case ASCII:
+            return fseeko(ts->textFile, offset, SEEK_SET);
+        case DELTA:
+            if (ts->gz != NULL || lseek(ts->fd, offset, SEEK_SET) != offset)
+            {
+                return -1;
+            }
+            ts->blockOpsLeft = 0;
+            ts->ended = 0;
+            return 0;
+        default:
+            return -1;
+    }
+}
+
+// Whether a failed readTraceOp was the end of the trace, rather than
+//   a line that held no op.
+int traceStreamEnded(trace_stream* ts)
+{
+    switch (ts->type)
+    {
+        case BINARY:
+        case DELTA:
+            return ts->ended;
+        default:
+            return feof(ts->textFile);
+    }
+}
+
+void closeTraceStream(trace_stream* ts)
+{
+    if (ts->textFile != NULL) fclose(ts->textFile);
+    ts->textFile = NULL;
+    closeBinaryTrace(ts);
+    closeDeltaTrace(ts);
+#ifdef HAVE_ZLIB
+    if (ts->gz != NULL) gzclose(ts->gz);
+#endif
+    ts->gz = NULL;
+    if (ts->fd > 0) close(ts->fd);
+    ts->fd = -1;
+}
@@ -0,0 +1,114 @@
+#include "trace.h"
+#include "trace_internal.h"
+
+#include <stdio.h>
+#include <ctype.h>
+
+uint64_t opCount = 0;
+
+//
+// readTextOp
+//
+//   Parses the next A/B/L/S/X line of an ASCII trace into op.  Returns 0
+// when the trace has ended or the line is not a valid op, in which case
+// the rest of the line is skipped.
+//
+int readTextOp(FILE* tf, trace_op* op)
+{
+    // TODO - Support for other basic formats
+    char opType = 0;
+    uint64_t memAddress, pcAddress, nextPC;
+    int opSize;
+    int32_t op0, op1, op2;
+    memset(op, 0, sizeof(trace_op));
+    if (0 == fscanf(tf, "%c", &opType))
+    {
+        return 0;
+    }
+
+    if (opType == '\0' || isspace(opType))
+    {
+        return 0;
+    }
+
+    switch (opType)
+    {
+        case 'A':
+            op->op = ALU;
+            (void)!fscanf(tf, "%lx %d, %d, %d\n", &pcAddress, &op0, &op1, &op2);
+            op->pcAddress = pcAddress;
+            op->dest_reg = op0;
+            op->src_reg[0] = op1;
+            op->src_reg[1] = op2;
+            break;
+        case 'B':
+            op->op = BRANCH;
+            (void)!fscanf(tf, "%lx %lx", &pcAddress, &nextPC);
+            if (1 == fscanf(tf, " %d\n", &op0))
+            {
+                op->src_reg[0] = op0;
+            }
+            else
+            {
+                (void)!fscanf(tf, "\n");
+                op->src_reg[0] = -1;
+            }
+            op->pcAddress = pcAddress;
+            op->nextPCAddress = nextPC;
+            op->src_reg[1] = -1;
+            op->dest_reg = -1;
+            break;
+        case 'L':
+            op->op = MEM_LOAD;
+            (void)!fscanf(tf, "%lx,%d", &memAddress, &opSize);
+            if (1 == fscanf(tf, " %d\n", &op0))
+            {
+                op->src_reg[0] = op0;
+            }
+            else
+            {
+                (void)!fscanf(tf, "\n");
+                op->src_reg[0] = -1;
+            }
+            op->memAddress = memAddress;
+            op->size = opSize;
+            op->src_reg[1] = -1;
+            op->dest_reg = -1;
+            break;
+        case 'S':
+            op->op = MEM_STORE;
+            (void)!fscanf(tf, "%lx,%d", &memAddress, &opSize);
+            if (1 == fscanf(tf, " %d\n", &op0))
+            {
+                op->dest_reg = op0;
+            }
+            else
+            {
+                (void)!fscanf(tf, "\n");
+                op->dest_reg = -1;
+            }
+            op->memAddress = memAddress;
+            op->size = opSize;
+            op->src_reg[0] = -1;
+            op->src_reg[1] = -1;
+            break;
+        case 'X':
+            op->op = ALU_LONG;
+            (void)!fscanf(tf, "%lx %d, %d, %d\n", &pcAddress, &op0, &op1, &op2);
+            op->pcAddress = pcAddress;
+            op->dest_reg = op0;
+            op->src_reg[0] = op1;
+            op->src_reg[1] = op2;
+            break;
+        default:
+            fprintf(stderr, "Invalid op type: %x on %ld\n", opType, opCount);
+            // drop the rest of the line, so it is one empty fetch, not one
+            //   per character
+            (void)!fscanf(tf, "%*[^\n]");
+            (void)!fscanf(tf, "\n");
+            return 0;
+    }
+
+    opCount++;
+    return 1;
+}
@@ -0,0 +1,388 @@
+#include "trace.h"
+#include "trace_internal.h"
+
+#include <stdio.h>
+#include <getopt.h>
+#include <stdlib.h>
+#include <errno.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+//
+// cadss-trace
+//
+//   Converts traces between the formats understood by the trace reader.
+// Either a single trace or a directory of p%d.trace files can be given.
+//
+
+void printHelp(char* prog)
+{
+    printf("%s -i <in> -o <out>\n", prog);
+    printf("%s -i <in> -I\n", prog);
+    printf("  -h          \t Help message\n");
+    printf("  -i <file>   \t Input trace file / directory (any format)\n");
+    printf("  -o <file>   \t Output trace file / directory\n");
+    printf("  -f <format> \t Output format: binary (default), delta\n");
+    printf("  -z          \t Gzip the output\n");
+    printf("  -I          \t Index the input for seeking (engine -F), the\n"
+           "              \t  index is written next to each trace as .idx\n");
+    printf("  -k <ops>    \t Ops between index entries (default %d)\n",
+           TRACE_INDEX_INTERVAL);
+}
+
+enum OUT_FORMAT {
+    OUT_BINARY,
+    OUT_DELTA
+};
+
+static enum OUT_FORMAT outFormat = OUT_BINARY;
+static int compressOutput = 0;
+
+// Where a converted trace is written, a plain file or a gzip stream.
+typedef struct _trace_out {
+    FILE* file;
+    void* gz;
+} trace_out;
+
+static int writeOut(trace_out* out, const void* buf, size_t len)
+{
+#ifdef HAVE_ZLIB
+    if (out->gz != NULL)
+    {
+        return gzwrite(out->gz, buf, len) == (int)len ? 0 : -1;
+    }
+#endif
+    return fwrite(buf, len, 1, out->file) == 1 ? 0 : -1;
+}
+
+// Fills in the header counts once they are known.  A gzip stream cannot be
+//   rewritten, so its counts are left at 0 and the reader does not use them.
+static int rewriteHeader(trace_out* out, const void* hdr, size_t len)
+{
+    if (out->gz != NULL) return 0;
+    if (fseek(out->file, 0, SEEK_SET) != 0) return -1;
+    return writeOut(out, hdr, len);
+}
+
+// Text traces may contain blank lines, which the reader treats as a tick
+//   without an op, so only stop at the end of the file.
+static int nextOp(trace_stream* in, trace_op* op)
+{
+    while (!readTraceOp(in, op))
+    {
+        if (traceStreamEnded(in)) return 0;
+    }
+    return 1;
+}
+
+static int writeBinaryTrace(trace_stream* in, trace_out* out)
+{
+    binary_trace_header hdr = {0};
+    memcpy(hdr.magic, BINARY_TRACE_MAGIC, sizeof(hdr.magic));
+    hdr.version = BINARY_TRACE_VERSION;
+    hdr.recordSize = sizeof(binary_trace_record);
+
+    // The count is filled in once the input has been read.
+    if (writeOut(out, &hdr, sizeof(hdr)) != 0) return -1;
+
+    trace_op op;
+    binary_trace_record rec;
+    while (nextOp(in, &op))
+    {
+        if (!encodeBinaryOp(&op, &rec))
+        {
+            fprintf(stderr, "Op %lu has a register that does not fit in the "
+                            "binary format\n", hdr.recordCount);
+            return -1;
+        }
+        if (writeOut(out, &rec, sizeof(rec)) != 0) return -1;
+        hdr.recordCount++;
+    }
+
+    if (rewriteHeader(out, &hdr, sizeof(hdr)) != 0) return -1;
+
+    fprintf(stderr, "Wrote %lu ops\n", hdr.recordCount);
+    return 0;
+}
+
+static int writeDeltaBlock(trace_out* out, const uint8_t* buf, uint32_t ops,
+                           uint32_t len)
+{
+    delta_block_header bh = {ops, len};
+    if (writeOut(out, &bh, sizeof(bh)) != 0) return -1;
+    return writeOut(out, buf, len);
+}
+
+static int writeDeltaTrace(trace_stream* in, trace_out* out)
+{
+    delta_trace_header hdr = {0};
+    memcpy(hdr.magic, DELTA_TRACE_MAGIC, sizeof(hdr.magic));
+    hdr.version = DELTA_TRACE_VERSION;
+    hdr.blockOps = DELTA_BLOCK_OPS;
+
+    if (writeOut(out, &hdr, sizeof(hdr)) != 0) return -1;
+
+    uint8_t* buf = malloc(DELTA_BLOCK_OPS * DELTA_MAX_OP_BYTES);
+    if (buf == NULL) return -1;
+
+    trace_op op;
+    delta_state ds = {0};
+    uint32_t blockOps = 0;
+    uint32_t blockLength = 0;
+    int r = 0;
+    while (nextOp(in, &op))
+    {
+        blockLength += encodeDeltaOp(&ds, &op, buf + blockLength);
+        blockOps++;
+        hdr.opCount++;
+
+        if (blockOps == DELTA_BLOCK_OPS)
+        {
+            r = writeDeltaBlock(out, buf, blockOps, blockLength);
+            if (r != 0) break;
+            memset(&ds, 0, sizeof(ds));
+            blockOps = 0;
+            blockLength = 0;
+        }
+    }
+
+    if (r == 0 && blockOps > 0)
+    {
+        r = writeDeltaBlock(out, buf, blockOps, blockLength);
+    }
+    free(buf);
+
+    if (r != 0 || rewriteHeader(out, &hdr, sizeof(hdr)) != 0) return -1;
+
+    fprintf(stderr, "Wrote %lu ops\n", hdr.opCount);
+    return 0;
+}
+
+static int convertTrace(int inFD, const char* outName)
+{
+    trace_stream in = {0};
+    if (openTraceStream(&in, inFD) != 0) return -1;
+
+    trace_out out = {0};
+#ifdef HAVE_ZLIB
+    if (compressOutput) out.gz = gzopen(outName, "wb");
+    else
+#endif
+        out.file = fopen(outName, "wb");
+    if (out.file == NULL && out.gz == NULL)
+    {
+        perror("Opening output trace");
+        closeTraceStream(&in);
+        return -1;
+    }
+
+    int r = outFormat == OUT_DELTA ? writeDeltaTrace(&in, &out)
+                                   : writeBinaryTrace(&in, &out);
+    if (r != 0) perror("Writing output trace");
+
+#ifdef HAVE_ZLIB
+    if (out.gz != NULL && gzclose(out.gz) != Z_OK) r = -1;
+#endif
+    if (out.file != NULL && fclose(out.file) != 0) r = -1;
+    closeTraceStream(&in);
+    return r;
+}
+
+static uint32_t indexInterval = TRACE_INDEX_INTERVAL;
+
+static int indexTrace(int inFD, int outDir, const char* outName)
+{
+    struct stat sb;
+    trace_stream in = {0};
+    if (fstat(inFD, &sb) != 0 || openTraceStream(&in, inFD) != 0) return -1;
+
+    if (in.type == BINARY)
+    {
+        fprintf(stderr, "Binary traces are seeked directly, no index needed\n");
+        closeTraceStream(&in);
+        return 0;
+    }
+
+    if (traceStreamTell(&in) < 0)
+    {
+        fprintf(stderr, "Compressed traces cannot be seeked, not indexing\n");
+        closeTraceStream(&in);
+        return -1;
+    }
+
+    int outFD = openat(outDir, outName, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    FILE* out = outFD == -1 ? NULL : fdopen(outFD, "wb");
+    if (out == NULL)
+    {
+        perror("Opening trace index");
+        closeTraceStream(&in);
+        return -1;
+    }
+
+    int entries = writeTraceIndex(&in, &sb, out, indexInterval);
+    if (entries < 0)
+        perror("Writing trace index");
+    else
+        fprintf(stderr, "Wrote %d index entries\n", entries);
+
+    int r = entries < 0 ? -1 : 0;
+    if (fclose(out) != 0) r = -1;
+    closeTraceStream(&in);
+    return r;
+}
+
+static int indexDirectory(int inDir)
+{
+    int processorNum;
+    for (processorNum = 0; ; processorNum++)
+    {
+        char fileName[32];
+        snprintf(fileName, sizeof(fileName), "p%d.trace", processorNum);
+
+        int inFD = openat(inDir, fileName, O_RDONLY);
+        if (inFD == -1) break;
+
+        fprintf(stderr, "%s: ", fileName);
+        snprintf(fileName, sizeof(fileName), "p%d.trace.idx", processorNum);
+        if (indexTrace(inFD, inDir, fileName) != 0) return -1;
+    }
+
+    if (processorNum == 0)
+    {
+        fprintf(stderr, "No p0.trace found in input directory\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+static int convertDirectory(int inDir, const char* outName)
+{
+    if (mkdir(outName, 0755) == -1 && errno != EEXIST)
+    {
+        perror("Creating output directory");
+        return -1;
+    }
+
+    int processorNum;
+    for (processorNum = 0; ; processorNum++)
+    {
+        char fileName[32];
+        snprintf(fileName, sizeof(fileName), "p%d.trace", processorNum);
+
+        int inFD = openat(inDir, fileName, O_RDONLY);
+        if (inFD == -1) break;
+
+        char outPath[4096];
+        snprintf(outPath, sizeof(outPath), "%s/%s", outName, fileName);
+        fprintf(stderr, "%s: ", fileName);
+        if (convertTrace(inFD, outPath) != 0) return -1;
+    }
+
+    if (processorNum == 0)
+    {
+        fprintf(stderr, "No p0.trace found in input directory\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    int opt;
+    char* inName = NULL;
+    char* outName = NULL;
+    int buildIndex = 0;
+
+    while ((opt = getopt(argc, argv, "hi:o:f:zIk:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'h':
+                printHelp(argv[0]);
+                return 0;
+            case 'i':
+                inName = optarg;
+                break;
+            case 'o':
+                outName = optarg;
+                break;
+            case 'f':
+                if (strcmp(optarg, "binary") == 0)
+                {
+                    outFormat = OUT_BINARY;
+                }
+                else if (strcmp(optarg, "delta") == 0)
+                {
+                    outFormat = OUT_DELTA;
+                }
+                else
+                {
+                    fprintf(stderr, "Unknown output format - %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'z':
+#ifdef HAVE_ZLIB
+                compressOutput = 1;
+                break;
+#else
+                fprintf(stderr, "Built without zlib, cannot compress output\n");
+                return 1;
+#endif
+            case 'I':
+                buildIndex = 1;
+                break;
+            case 'k':
+                indexInterval = atoi(optarg);
+                if (indexInterval == 0)
+                {
+                    fprintf(stderr, "Index interval must be at least 1 op\n");
+                    return 1;
+                }
+                break;
+            default:
+                printHelp(argv[0]);
+                return 1;
+        }
+    }
+
+    if (inName == NULL || (outName == NULL && !buildIndex))
+    {
+        printHelp(argv[0]);
+        return 1;
+    }
+
+    int inDir = open(inName, O_DIRECTORY);
+    if (inDir != -1)
+    {
+        int r = buildIndex ? indexDirectory(inDir)
+                           : convertDirectory(inDir, outName);
+        close(inDir);
+        return r == 0 ? 0 : 1;
+    }
+
+    int inFD = open(inName, O_RDONLY);
+    if (inFD == -1)
+    {
+        perror("Opening input trace");
+        return 1;
+    }
+
+    if (buildIndex)
+    {
+        char indexName[4096];
+        snprintf(indexName, sizeof(indexName), "%s.idx", inName);
+        return indexTrace(inFD, AT_FDCWD, indexName) == 0 ? 0 : 1;
+    }
+
+    return convertTrace(inFD, outName) == 0 ? 0 : 1;
+}